@@ -0,0 +1,177 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "BackgroundModel.h"
+#include "mincut_segmentation.h"
+
+// Rounds the learning steps to the nearest millimeter
+#define LEARN_HALF (1 << (BACKGROUND_LEARN_SHIFT - 1))
+
+// How much nearer than its background a pixel has to be to be foreground
+static inline int margin(int deviation)
+{
+    return std::max(BACKGROUND_MIN_MARGIN, BACKGROUND_DEVIATIONS*deviation);
+}
+
+#ifdef __SSE2__
+static inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i margin(__m128i deviation)
+{
+    return _mm_max_epi16(_mm_set1_epi16(BACKGROUND_MIN_MARGIN),
+                         _mm_mullo_epi16(deviation,
+                                         _mm_set1_epi16(BACKGROUND_DEVIATIONS)));
+}
+#endif
+
+void BackgroundModel::init(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    mean.assign(width*height, 0);
+    deviation.assign(width*height, 0);
+}
+
+void BackgroundModel::update(const unsigned short *depth)
+{
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++)
+    {
+        int i = y*width, end = i + width;
+
+#ifdef __SSE2__
+        // The depths are below 2^15, so the signed 16 bit operations hold
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i half = _mm_set1_epi16(LEARN_HALF);
+        for (; i + 8 <= end; i += 8)
+        {
+            __m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+            __m128i m = _mm_loadu_si128((const __m128i *)(&mean[i]));
+            __m128i dev = _mm_loadu_si128((const __m128i *)(&deviation[i]));
+
+            __m128i t = margin(dev);
+            __m128i nearer = _mm_subs_epu16(m, d);
+            __m128i farther = _mm_subs_epu16(d, m);
+
+            __m128i unknown = _mm_cmpeq_epi16(d, zero);
+            __m128i replace = _mm_andnot_si128(unknown,
+                    _mm_or_si128(_mm_cmpeq_epi16(m, zero),
+                                 _mm_cmpgt_epi16(farther, t)));
+            __m128i learn = _mm_andnot_si128(
+                    _mm_or_si128(_mm_or_si128(unknown, replace),
+                                 _mm_cmpgt_epi16(nearer, t)),
+                    _mm_cmpeq_epi16(zero, zero));
+
+            __m128i step = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(d, m),
+                                                        half),
+                                          BACKGROUND_LEARN_SHIFT);
+            __m128i new_m = _mm_add_epi16(m, step);
+
+            __m128i dstep = _mm_srai_epi16(
+                    _mm_add_epi16(_mm_sub_epi16(_mm_or_si128(nearer, farther),
+                                                dev), half),
+                    BACKGROUND_LEARN_SHIFT);
+            __m128i new_dev = _mm_min_epi16(_mm_add_epi16(dev, dstep),
+                                _mm_set1_epi16(BACKGROUND_MAX_DEVIATION));
+
+            m = select(learn, new_m, select(replace, d, m));
+            dev = select(learn, new_dev, _mm_andnot_si128(replace, dev));
+            _mm_storeu_si128((__m128i *)(&mean[i]), m);
+            _mm_storeu_si128((__m128i *)(&deviation[i]), dev);
+        }
+#endif
+
+        for (; i < end; i++)
+        {
+            int d = depth[i];
+            if (d == 0)
+                continue;
+
+            int m = mean[i], dev = deviation[i];
+            int t = margin(dev);
+            if (m == 0 || d - m > t)
+            {
+                mean[i] = d;
+                deviation[i] = 0;
+            }
+            else if (m - d <= t)
+            {
+                int diff = d - m;
+                mean[i] = m + ((diff + LEARN_HALF) >> BACKGROUND_LEARN_SHIFT);
+                dev += (abs(diff) - dev + LEARN_HALF) >> BACKGROUND_LEARN_SHIFT;
+                deviation[i] = std::min(dev, BACKGROUND_MAX_DEVIATION);
+            }
+        }
+    }
+}
+
+void BackgroundModel::label(const unsigned short *depth, const image_roi &roi,
+                            bool *foreground, unsigned char *trimap,
+                            trimap_planes *planes) const
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int x = roi.x0;
+
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i undefined = _mm_set1_epi8(TRIMAP_U);
+        for (; x + 8 <= roi.x1; x += 8)
+        {
+            int i = y*width + x;
+            __m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+            __m128i m = _mm_loadu_si128((const __m128i *)(&mean[i]));
+            __m128i dev = _mm_loadu_si128((const __m128i *)(&deviation[i]));
+
+            __m128i unknown = _mm_cmpeq_epi16(d, zero);
+            __m128i fg = _mm_andnot_si128(unknown,
+                    _mm_cmpgt_epi16(_mm_subs_epu16(m, d), margin(dev)));
+
+            // As bytes: the foreground of label_depth_map() includes the
+            // pixels of unknown depth, the trimap has them undefined
+            __m128i fg8 = _mm_packs_epi16(fg, zero);
+            __m128i unknown8 = _mm_packs_epi16(unknown, zero);
+            _mm_storel_epi64((__m128i *)(foreground + i),
+                             _mm_and_si128(_mm_or_si128(fg8, unknown8), one));
+            _mm_storel_epi64((__m128i *)(trimap + i),
+                             _mm_or_si128(_mm_and_si128(fg8, one),
+                                          _mm_and_si128(unknown8, undefined)));
+            if (planes)
+            {
+                planes->foreground.put_bits(x, y, _mm_movemask_epi8(fg8), 8);
+                planes->unknown.put_bits(x, y, _mm_movemask_epi8(unknown8), 8);
+            }
+        }
+#endif
+
+        for (; x < roi.x1; x++)
+        {
+            int i = y*width + x;
+            int d = depth[i];
+            bool fg = d != 0 && mean[i] - d > margin(deviation[i]);
+            foreground[i] = fg || d == 0;
+            trimap[i] = d == 0 ? TRIMAP_U : fg;
+            if (planes)
+            {
+                planes->foreground.set(x, y, fg);
+                planes->unknown.set(x, y, d == 0);
+            }
+        }
+    }
+}
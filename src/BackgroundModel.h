@@ -0,0 +1,74 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef BACKGROUND_MODEL_H
+#define BACKGROUND_MODEL_H
+
+#include <vector>
+
+#include "bitmask.h"
+#include "roi.h"
+
+// The background of a pixel moves 1/2^BACKGROUND_LEARN_SHIFT of the way to
+// each new depth that matches it
+#define BACKGROUND_LEARN_SHIFT 4
+
+// A pixel is foreground if it is nearer than its background by more than
+// BACKGROUND_DEVIATIONS mean absolute deviations, and never by less than
+// BACKGROUND_MIN_MARGIN millimeters, well above the kinect noise at a few
+// meters. The deviation is capped at BACKGROUND_MAX_DEVIATION.
+#define BACKGROUND_DEVIATIONS 4
+#define BACKGROUND_MIN_MARGIN 60
+#define BACKGROUND_MAX_DEVIATION 250
+
+/*
+ * A running model of the depth of the background of each pixel.
+ *
+ * Each pixel keeps the running mean of its background depth and the
+ * running mean absolute deviation from it, both in millimeters as 16 bit
+ * integers. Pixels much nearer than their background are foreground and
+ * leave the model alone. Pixels much farther replace it, since the
+ * background is the farthest surface seen there, so whatever stood in
+ * front of the camera when the model started is forgotten as soon as it
+ * moves. Pixels with unknown depth are neither learned nor labelled.
+ *
+ * Labelling is a single pass over the pixels with no global clustering,
+ * so it copes with rooms where no single threshold splits the user from
+ * the furniture around them.
+ */
+class BackgroundModel
+{
+    public:
+        BackgroundModel() : width(0), height(0) {}
+
+        // Start over with no background
+        void init(int width, int height);
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+
+        // Learn the background from a depth frame
+        void update(const unsigned short *depth);
+
+        // Label the pixels inside roi of a depth frame as label_depth_map()
+        // does, with the pixels nearer than their background as foreground,
+        // setting the planes too if not NULL
+        void label(const unsigned short *depth, const image_roi &roi,
+                   bool *foreground, unsigned char *trimap,
+                   trimap_planes *planes = 0) const;
+
+    private:
+        int width, height;
+
+        // The background depth of each pixel, 0 if not seen yet, and its
+        // mean absolute deviation
+        std::vector<unsigned short> mean, deviation;
+};
+
+#endif // BACKGROUND_MODEL_H
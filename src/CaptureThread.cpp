@@ -0,0 +1,152 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <errno.h>
+#include <iostream>
+#include <string.h>
+#include <time.h>
+
+#include "CaptureThread.h"
+
+using namespace std;
+
+CaptureThread::CaptureThread(FrameSource *source)
+    : source(source), started(false), running(false), failed(false)
+{
+    width = source->getWidth();
+    height = source->getHeight();
+    source->getFieldOfView(&hfov, &vfov);
+
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&published, 0);
+}
+
+CaptureThread::~CaptureThread()
+{
+    stop();
+    pthread_cond_destroy(&published);
+    pthread_mutex_destroy(&lock);
+}
+
+bool CaptureThread::start()
+{
+    if (started)
+        return true;
+
+    running = true;
+    if (pthread_create(&thread, 0, &CaptureThread::run, this) != 0)
+    {
+        cerr << "Could not create the capture thread\n";
+        running = false;
+        return false;
+    }
+    started = true;
+
+    // Don't hand out an empty frame
+    while (running && !ring.hasFresh())
+        waitForFrame(1000);
+
+    return ring.hasFresh();
+}
+
+void CaptureThread::stop()
+{
+    if (!started)
+        return;
+
+    running = false;
+    pthread_join(thread, 0);
+    started = false;
+}
+
+bool CaptureThread::waitForFrame(int timeout_ms)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms/1000;
+    deadline.tv_nsec += (timeout_ms % 1000)*1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    // The thread publishes before it takes the lock to signal, so a frame
+    // is either seen here or signalled after we started waiting
+    pthread_mutex_lock(&lock);
+    int err = 0;
+    while (running && !ring.hasFresh() && err != ETIMEDOUT)
+        err = pthread_cond_timedwait(&published, &lock, &deadline);
+    bool fresh = ring.hasFresh();
+    pthread_mutex_unlock(&lock);
+
+    return fresh;
+}
+
+void CaptureThread::signal()
+{
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&published);
+    pthread_mutex_unlock(&lock);
+}
+
+void *CaptureThread::run(void *arg)
+{
+    ((CaptureThread *)arg)->capture();
+    return 0;
+}
+
+void CaptureThread::capture()
+{
+    int npts = width*height;
+
+    while (running)
+    {
+        if (!source->update())
+        {
+            failed = true;
+            break;
+        }
+
+        // Copy the frame to the back slot with one bulk copy per image.
+        // The slot buffers are reused unless the processing thread still
+        // holds a reference to them.
+        CapturedFrame &frame = ring.getBack();
+        size_t depth_size = npts*sizeof(unsigned short);
+        void *depth = frame.depth.makeWritable(depth_size);
+        void *rgb = frame.rgb.makeWritable(3*npts);
+        if (!depth || !rgb)
+        {
+            // Drop the frame, the next one may find the memory
+            cerr << "Could not allocate a captured frame\n";
+            continue;
+        }
+        memcpy(depth, source->getDepthMap(), depth_size);
+        memcpy(rgb, source->getRGBImage(), 3*npts);
+        frame.users = source->getUsers();
+        frame.frame_id = source->getFrameID();
+        frame.timestamp = source->getTimestamp();
+        frame.capture_time = source->getCaptureTime();
+
+        ring.publish();
+        signal();
+    }
+
+    // Stop under the lock, so that waitForFrame() sees it together with
+    // failed
+    pthread_mutex_lock(&lock);
+    running = false;
+    pthread_cond_broadcast(&published);
+    pthread_mutex_unlock(&lock);
+}
+
+bool CaptureThread::update()
+{
+    return ring.acquire();
+}
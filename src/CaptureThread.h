@@ -0,0 +1,130 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef CAPTURE_THREAD_H
+#define CAPTURE_THREAD_H
+
+#include <pthread.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "FrameBuffer.h"
+#include "FrameSource.h"
+#include "TripleBuffer.h"
+
+// A frame copied out of a FrameSource
+struct CapturedFrame
+{
+    FrameRef depth;
+    FrameRef rgb;
+    std::vector<UserSkeleton> users;
+    unsigned int frame_id;
+    unsigned long long timestamp;
+    double capture_time;
+};
+
+/*
+ * Grabs frames from another FrameSource (usually the kinect) on a
+ * dedicated thread, so the processing thread never blocks on the device.
+ *
+ * The captured frames go through a triple buffer: update() returns the
+ * newest complete frame immediately, or false if no new frame arrived
+ * since the last call. The buffers returned by getDepthBuffer() and
+ * getRGBBuffer() are owned by the capture thread, and are never written
+ * to again while someone still references them. waitForFrame() sleeps
+ * until a new frame arrives, for a processing thread with nothing else to
+ * do.
+ */
+class CaptureThread : public FrameSource
+{
+    public:
+        // The capture thread takes over the source, which must not be
+        // updated by anyone else while the thread is running
+        CaptureThread(FrameSource *source);
+        ~CaptureThread();
+
+        // Start capturing, and wait until the first frame is available to
+        // update()
+        bool start();
+        void stop();
+
+        // Wait up to timeout_ms milliseconds for a frame update() has not
+        // returned yet. Returns false if none arrived, or if the thread
+        // stopped.
+        bool waitForFrame(int timeout_ms);
+
+        // True once the thread stopped because the source failed to give
+        // it a frame
+        bool hasFailed() const { return failed; }
+
+        // The number of captured frames that were never processed
+        int getDroppedFrames() const { return ring.getDropped(); }
+
+        // FrameSource interface
+        bool update();
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+
+        const unsigned short *getDepthMap()
+        {
+            return (const unsigned short *)ring.getFront().depth.getData();
+        }
+        const unsigned char *getRGBImage()
+        {
+            return (const unsigned char *)ring.getFront().rgb.getData();
+        }
+
+        FrameRef getDepthBuffer() { return ring.getFront().depth; }
+        FrameRef getRGBBuffer() { return ring.getFront().rgb; }
+
+        std::vector<UserSkeleton> &getUsers() { return ring.getFront().users; }
+
+        unsigned int getFrameID() const { return ring.getFront().frame_id; }
+        unsigned long long getTimestamp() const
+        {
+            return ring.getFront().timestamp;
+        }
+        double getCaptureTime() const { return ring.getFront().capture_time; }
+
+        void getFieldOfView(double *hfov, double *vfov) const
+        {
+            *hfov = this->hfov;
+            *vfov = this->vfov;
+        }
+
+        void convertProjectiveToRealWorld(int n, const cv::Vec3d *proj,
+                                          cv::Vec3d *world)
+        {
+            source->convertProjectiveToRealWorld(n, proj, world);
+        }
+
+    private:
+        static void *run(void *arg);
+        void capture();
+
+        FrameSource *source;
+        int width, height;
+        double hfov, vfov;
+
+        TripleBuffer<CapturedFrame> ring;
+
+        pthread_t thread;
+        bool started;
+        volatile bool running;
+        volatile bool failed;
+
+        // Signalled when a frame is published, and when the thread stops
+        pthread_mutex_t lock;
+        pthread_cond_t published;
+        void signal();
+};
+
+#endif // CAPTURE_THREAD_H
@@ -0,0 +1,130 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <stdlib.h>
+
+#include "ChangeDetector.h"
+
+// The number of samples per tile side
+#define TILE_SAMPLES (CHANGE_TILE_SIZE/CHANGE_SAMPLE_STEP)
+
+static inline int luma(const unsigned char *rgb)
+{
+    return (rgb[0] + 2*rgb[1] + rgb[2]) >> 2;
+}
+
+void ChangeDetector::init(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+
+    swidth = (width + CHANGE_SAMPLE_STEP - 1)/CHANGE_SAMPLE_STEP;
+    sheight = (height + CHANGE_SAMPLE_STEP - 1)/CHANGE_SAMPLE_STEP;
+    tiles_x = (width + CHANGE_TILE_SIZE - 1)/CHANGE_TILE_SIZE;
+    tiles_y = (height + CHANGE_TILE_SIZE - 1)/CHANGE_TILE_SIZE;
+
+    ref_depth.assign(swidth*sheight, 0);
+    ref_luma.assign(swidth*sheight, 0);
+    has_reference.assign(tiles_x*tiles_y, 0);
+}
+
+void ChangeDetector::tileRange(const image_roi &roi, int *tx0, int *ty0,
+                               int *tx1, int *ty1) const
+{
+    *tx0 = roi.x0/CHANGE_TILE_SIZE;
+    *ty0 = roi.y0/CHANGE_TILE_SIZE;
+    *tx1 = (roi.x1 + CHANGE_TILE_SIZE - 1)/CHANGE_TILE_SIZE;
+    *ty1 = (roi.y1 + CHANGE_TILE_SIZE - 1)/CHANGE_TILE_SIZE;
+}
+
+image_roi ChangeDetector::findChanges(const unsigned short *depth,
+                                      const unsigned char *rgb,
+                                      const image_roi &roi) const
+{
+    image_roi changed = {0, 0, 0, 0};
+    if (roi.empty())
+        return changed;
+
+    int tx0, ty0, tx1, ty1;
+    tileRange(roi, &tx0, &ty0, &tx1, &ty1);
+
+    for (int ty = ty0; ty < ty1; ty++)
+    {
+        for (int tx = tx0; tx < tx1; tx++)
+        {
+            bool dirty = !has_reference[ty*tiles_x + tx];
+
+            if (!dirty)
+            {
+                int depth_sad = 0, luma_sad = 0, n = 0;
+                int sy1 = std::min((ty + 1)*TILE_SAMPLES, sheight);
+                int sx1 = std::min((tx + 1)*TILE_SAMPLES, swidth);
+                for (int sy = ty*TILE_SAMPLES; sy < sy1; sy++)
+                {
+                    int y = sy*CHANGE_SAMPLE_STEP;
+                    for (int sx = tx*TILE_SAMPLES; sx < sx1; sx++)
+                    {
+                        int i = y*width + sx*CHANGE_SAMPLE_STEP;
+                        int s = sy*swidth + sx;
+
+                        int d = depth[i], r = ref_depth[s];
+                        if (d && r)
+                            depth_sad += abs(d - r);
+                        else if (d != r)
+                            depth_sad += CHANGE_HOLE_PENALTY;
+
+                        luma_sad += abs(luma(rgb + 3*i) - ref_luma[s]);
+                        n++;
+                    }
+                }
+
+                dirty = depth_sad > n*CHANGE_DEPTH_THRESHOLD ||
+                        luma_sad > n*CHANGE_LUMA_THRESHOLD;
+            }
+
+            if (dirty)
+            {
+                image_roi tile = {tx*CHANGE_TILE_SIZE, ty*CHANGE_TILE_SIZE,
+                                  (tx + 1)*CHANGE_TILE_SIZE,
+                                  (ty + 1)*CHANGE_TILE_SIZE};
+                changed = roi_union(changed, tile);
+            }
+        }
+    }
+
+    return roi_intersection(changed, roi);
+}
+
+void ChangeDetector::accept(const unsigned short *depth,
+                            const unsigned char *rgb, const image_roi &roi)
+{
+    if (roi.empty())
+        return;
+
+    int tx0, ty0, tx1, ty1;
+    tileRange(roi, &tx0, &ty0, &tx1, &ty1);
+
+    int sy1 = std::min(ty1*TILE_SAMPLES, sheight);
+    int sx1 = std::min(tx1*TILE_SAMPLES, swidth);
+    for (int sy = ty0*TILE_SAMPLES; sy < sy1; sy++)
+    {
+        int y = sy*CHANGE_SAMPLE_STEP;
+        for (int sx = tx0*TILE_SAMPLES; sx < sx1; sx++)
+        {
+            int i = y*width + sx*CHANGE_SAMPLE_STEP;
+            int s = sy*swidth + sx;
+            ref_depth[s] = depth[i];
+            ref_luma[s] = luma(rgb + 3*i);
+        }
+    }
+
+    for (int ty = ty0; ty < ty1; ty++)
+        for (int tx = tx0; tx < tx1; tx++)
+            has_reference[ty*tiles_x + tx] = 1;
+}
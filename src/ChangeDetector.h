@@ -0,0 +1,74 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include <vector>
+
+#include "roi.h"
+
+// The size of the tiles, in pixels
+#define CHANGE_TILE_SIZE 16
+
+// The tiles are compared on every 4th pixel of every 4th row
+#define CHANGE_SAMPLE_STEP 4
+
+// A tile changed if the mean absolute difference of its samples is above
+// these, in millimeters and gray levels. The depth one is well above the
+// kinect noise at a few meters.
+#define CHANGE_DEPTH_THRESHOLD 40
+#define CHANGE_LUMA_THRESHOLD 12
+
+// The depth difference counted for a sample that became valid or invalid
+#define CHANGE_HOLE_PENALTY 200
+
+/*
+ * Finds the parts of a frame that changed since a reference frame.
+ *
+ * The frame is split in tiles, and each tile is compared with the same
+ * tile of the reference by the sum of absolute differences of the depth
+ * and the luma of a subsampled grid of pixels. The reference of a tile
+ * only moves forward when accept() is called for it, so slow changes add
+ * up until the tile is processed again.
+ */
+class ChangeDetector
+{
+    public:
+        ChangeDetector() : width(0), height(0) {}
+
+        // Start over with no reference, so every tile has changed
+        void init(int width, int height);
+
+        // The bounding box of the tiles covering roi that changed, clipped
+        // to roi. Empty if nothing changed.
+        image_roi findChanges(const unsigned short *depth,
+                              const unsigned char *rgb,
+                              const image_roi &roi) const;
+
+        // Make the current frame the reference of the tiles covering roi
+        void accept(const unsigned short *depth, const unsigned char *rgb,
+                    const image_roi &roi);
+
+    private:
+        // The tiles covering roi: [tx0, tx1) x [ty0, ty1)
+        void tileRange(const image_roi &roi, int *tx0, int *ty0,
+                       int *tx1, int *ty1) const;
+
+        int width, height;
+        int swidth, sheight;            // the size of the sample grid
+        int tiles_x, tiles_y;
+
+        // The reference samples, and whether each tile has a reference
+        std::vector<unsigned short> ref_depth;
+        std::vector<unsigned char> ref_luma;
+        std::vector<unsigned char> has_reference;
+};
+
+#endif // CHANGE_DETECTOR_H
@@ -0,0 +1,88 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <math.h>
+
+#include "DepthProjection.h"
+
+void DepthProjection::init(int width, int height, double hfov, double vfov)
+{
+    this->width = width;
+    this->height = height;
+
+    double xzfactor = 2*tan(hfov/2);
+    double yzfactor = 2*tan(vfov/2);
+
+    ray_x.resize(width);
+    for (int x = 0; x < width; x++)
+        ray_x[x] = (x/(double)width - 0.5)*xzfactor;
+
+    ray_y.resize(height);
+    for (int y = 0; y < height; y++)
+        ray_y[y] = (0.5 - y/(double)height)*yzfactor;
+
+    pixel_size = xzfactor/width;
+}
+
+void DepthProjection::toPointCloud(const unsigned short *depth,
+                                   const unsigned char *mask,
+                                   unsigned char label,
+                                   const image_roi &roi,
+                                   std::vector<cv::Vec3d> &points) const
+{
+    int nrows = roi.height();
+    if (roi.empty())
+    {
+        points.clear();
+        return;
+    }
+
+    // Count the points of each row...
+    std::vector<int> row_start(nrows + 1);
+    #pragma omp parallel for
+    for (int r = 0; r < nrows; r++)
+    {
+        int y = roi.y0 + r;
+        const unsigned short *pDepth = depth + y*width;
+        const unsigned char *pMask = mask + y*width;
+        int count = 0;
+        for (int x = roi.x0; x < roi.x1; x++)
+            count += (pMask[x] == label) & (pDepth[x] != 0);
+        row_start[r + 1] = count;
+    }
+
+    // ...so each row knows where its points go
+    row_start[0] = 0;
+    for (int r = 0; r < nrows; r++)
+        row_start[r + 1] += row_start[r];
+
+    points.resize(row_start[nrows]);
+    if (points.empty())
+        return;
+
+    cv::Vec3d *P = &points[0];
+
+    #pragma omp parallel for
+    for (int r = 0; r < nrows; r++)
+    {
+        int y = roi.y0 + r;
+        const unsigned short *pDepth = depth + y*width;
+        const unsigned char *pMask = mask + y*width;
+        cv::Vec3d *pPoint = P + row_start[r];
+        double ry = ray_y[y];
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            if (pMask[x] == label && pDepth[x])
+            {
+                double z = pDepth[x];
+                *pPoint++ = cv::Vec3d(ray_x[x]*z, ry*z, z);
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef DEPTH_PROJECTION_H
+#define DEPTH_PROJECTION_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "roi.h"
+
+/*
+ * Converts depth pixels to real world points with a precomputed ray table.
+ *
+ * The depth camera is modelled as a pinhole camera built from its field of
+ * view, the same model OpenNI uses in ConvertProjectiveToRealWorld. The
+ * real world point of pixel (x, y) with depth z is z*(rx[x], ry[y], 1), so
+ * the ray table reduces to one entry per column and one per row, which is
+ * computed once and stays in cache.
+ */
+class DepthProjection
+{
+    public:
+        DepthProjection() : width(0), height(0) {}
+
+        // Build the ray table for a width x height depth camera with the
+        // given horizontal and vertical field of view, in radians
+        void init(int width, int height, double hfov, double vfov);
+
+        bool isInitialized() const { return width > 0; }
+
+        // The real world point of pixel (x, y) with depth z
+        cv::Vec3d toRealWorld(int x, int y, double z) const
+        {
+            return cv::Vec3d(ray_x[x]*z, ray_y[y]*z, z);
+        }
+
+        // The number of pixels spanned by size millimeters at depth z
+        double toPixels(double size, double z) const
+        {
+            return size/(z*pixel_size);
+        }
+
+        // Collect the real world points of the pixels i inside roi with
+        // mask[i] == label and a valid depth. The rows are converted in
+        // parallel, and points is resized only once. The same projection
+        // can be used from several threads at once.
+        void toPointCloud(const unsigned short *depth,
+                          const unsigned char *mask, unsigned char label,
+                          const image_roi &roi,
+                          std::vector<cv::Vec3d> &points) const;
+
+        // The same, over the whole image
+        void toPointCloud(const unsigned short *depth,
+                          const unsigned char *mask, unsigned char label,
+                          std::vector<cv::Vec3d> &points) const
+        {
+            toPointCloud(depth, mask, label, full_roi(width, height), points);
+        }
+
+    private:
+        int width, height;
+        std::vector<double> ray_x;      // one entry per column
+        std::vector<double> ray_y;      // one entry per row
+
+        // The width of a pixel at a depth of 1mm
+        double pixel_size;
+};
+
+#endif // DEPTH_PROJECTION_H
@@ -0,0 +1,166 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alignment of the buffers we allocate, enough for AVX loads
+#define FRAME_BUFFER_ALIGNMENT 32
+
+/*
+ * A reference counted image buffer.
+ *
+ * A buffer either owns an aligned block of memory, or borrows memory that
+ * belongs to someone else (OpenNI's frame, a memory mapped session file).
+ * Borrowed memory is only valid until the frame source that handed it out
+ * is updated; use FrameRef::detach() to keep a frame beyond that.
+ *
+ * Buffers are handled through FrameRef, which keeps the reference count,
+ * so a buffer is only freed once nobody uses it anymore. The count is
+ * updated atomically, so references can be passed between threads.
+ */
+class FrameBuffer
+{
+    public:
+        // Allocate an aligned buffer of size bytes
+        static FrameBuffer *allocate(size_t size)
+        {
+            void *p = 0;
+            if (posix_memalign(&p, FRAME_BUFFER_ALIGNMENT, size) != 0)
+                return 0;
+            return new FrameBuffer(p, size, true);
+        }
+
+        // Wrap memory owned by someone else, without copying it
+        static FrameBuffer *borrow(const void *data, size_t size)
+        {
+            return new FrameBuffer(const_cast<void *>(data), size, false);
+        }
+
+        void retain() { __sync_add_and_fetch(&refcount, 1); }
+
+        void release()
+        {
+            if (__sync_sub_and_fetch(&refcount, 1) == 0)
+                delete this;
+        }
+
+        const void *getData() const { return data; }
+        size_t getSize() const { return size; }
+
+        bool isOwned() const { return owned; }
+        bool isUnique() const { return refcount == 1; }
+
+        // Only owned buffers may be written to
+        void *getWritableData()
+        {
+            assert(owned);
+            return data;
+        }
+
+    private:
+        FrameBuffer(void *data, size_t size, bool owned)
+            : data(data), size(size), owned(owned), refcount(1) {}
+
+        ~FrameBuffer()
+        {
+            if (owned)
+                free(data);
+        }
+
+        void *data;
+        size_t size;
+        bool owned;
+        volatile int refcount;
+};
+
+// A counted reference to a FrameBuffer
+class FrameRef
+{
+    public:
+        FrameRef() : buffer(0) {}
+
+        // Takes over the reference returned by FrameBuffer::allocate()
+        // or FrameBuffer::borrow()
+        explicit FrameRef(FrameBuffer *buffer) : buffer(buffer) {}
+
+        FrameRef(const FrameRef &ref) : buffer(ref.buffer)
+        {
+            if (buffer)
+                buffer->retain();
+        }
+
+        ~FrameRef()
+        {
+            if (buffer)
+                buffer->release();
+        }
+
+        FrameRef &operator=(const FrameRef &ref)
+        {
+            if (ref.buffer)
+                ref.buffer->retain();
+            if (buffer)
+                buffer->release();
+            buffer = ref.buffer;
+            return *this;
+        }
+
+        bool isNull() const { return buffer == 0; }
+
+        const void *getData() const { return buffer ? buffer->getData() : 0; }
+        size_t getSize() const { return buffer ? buffer->getSize() : 0; }
+
+        void *getWritableData()
+        {
+            return buffer ? buffer->getWritableData() : 0;
+        }
+
+        bool isOwned() const { return buffer && buffer->isOwned(); }
+
+        // True if nobody else holds a reference to the buffer, so it can be
+        // overwritten without anyone noticing
+        bool isUnique() const { return buffer && buffer->isUnique(); }
+
+        // Make this reference point to an owned buffer of size bytes that
+        // nobody else references, reusing the current buffer if possible,
+        // and return its memory. Returns 0, leaving a null reference, if
+        // the buffer could not be allocated.
+        void *makeWritable(size_t size)
+        {
+            if (!isOwned() || !isUnique() || getSize() != size)
+                *this = FrameRef(FrameBuffer::allocate(size));
+            return getWritableData();
+        }
+
+        // A reference to a buffer that stays valid independently of the
+        // frame source: the buffer itself if it is owned, otherwise a copy
+        // of it made with a single bulk copy into an aligned buffer. The
+        // reference is null if the copy could not be allocated.
+        FrameRef detach() const
+        {
+            if (!buffer || buffer->isOwned())
+                return *this;
+
+            FrameRef copy(FrameBuffer::allocate(buffer->getSize()));
+            if (!copy.isNull())
+                memcpy(copy.getWritableData(), buffer->getData(),
+                       buffer->getSize());
+            return copy;
+        }
+
+    private:
+        FrameBuffer *buffer;
+};
+
+#endif // FRAME_BUFFER_H
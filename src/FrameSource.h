@@ -0,0 +1,124 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <math.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "FrameBuffer.h"
+
+// The skeleton of a tracked user: the 3D joint positions, and their
+// projections on the depth image
+struct UserSkeleton
+{
+    unsigned int id;
+    std::vector<cv::Vec3d> joints;
+    std::vector<cv::Vec2d> joints_projected;
+};
+
+/*
+ * A source of registered depth + rgb frames and the tracked user skeletons.
+ *
+ * This is what the processing pipeline in main.cpp pulls its data from, so
+ * it can run either from a live device (KinectInterface) or from a
+ * recorded session (SessionPlayer) without knowing which one it is.
+ */
+class FrameSource
+{
+    public:
+        virtual ~FrameSource() {}
+
+        // Advance to the next frame. Returns false if there are no more
+        // frames (end of a recorded session) or the device failed.
+        virtual bool update() = 0;
+
+        // The size of the depth and rgb images
+        virtual int getWidth() const = 0;
+        virtual int getHeight() const = 0;
+
+        // The depth map of the current frame (in millimeters, 0 where the
+        // depth is unknown) and the rgb image registered to it. The
+        // pointers are valid until the next call to update().
+        virtual const unsigned short *getDepthMap() = 0;
+        virtual const unsigned char *getRGBImage() = 0;
+
+        // The same images as reference counted buffers, so they can be
+        // processed in place. By default these borrow the memory returned
+        // by getDepthMap() and getRGBImage(), so they are only valid until
+        // the next call to update(); sources that own their frames return
+        // buffers that stay valid for as long as they are referenced.
+        virtual FrameRef getDepthBuffer();
+        virtual FrameRef getRGBBuffer();
+
+        // The skeletons of all the users being tracked in the current
+        // frame. Empty if nobody is being tracked.
+        virtual std::vector<UserSkeleton> &getUsers() = 0;
+
+        // The sensor frame id and timestamp (in microseconds) of the
+        // current frame
+        virtual unsigned int getFrameID() const = 0;
+        virtual unsigned long long getTimestamp() const = 0;
+
+        // The wall clock time (getTime()) the current frame was captured
+        // at, or read at when replaying a session
+        virtual double getCaptureTime() const = 0;
+
+        // The horizontal and vertical field of view of the depth camera,
+        // in radians
+        virtual void getFieldOfView(double *hfov, double *vfov) const = 0;
+
+        // Convert n points from projective coordinates (x, y, depth) to
+        // real world coordinates. proj and world may be the same array.
+        //
+        // The default implementation uses the same pinhole model as
+        // OpenNI, built from the depth camera field of view.
+        virtual void convertProjectiveToRealWorld(int n, const cv::Vec3d *proj,
+                                                  cv::Vec3d *world);
+};
+
+inline
+FrameRef FrameSource::getDepthBuffer()
+{
+    size_t size = getWidth()*getHeight()*sizeof(unsigned short);
+    return FrameRef(FrameBuffer::borrow(getDepthMap(), size));
+}
+
+inline
+FrameRef FrameSource::getRGBBuffer()
+{
+    size_t size = 3*getWidth()*getHeight();
+    return FrameRef(FrameBuffer::borrow(getRGBImage(), size));
+}
+
+inline
+void FrameSource::convertProjectiveToRealWorld(int n, const cv::Vec3d *proj,
+                                               cv::Vec3d *world)
+{
+    double hfov, vfov;
+    getFieldOfView(&hfov, &vfov);
+
+    double xres = getWidth();
+    double yres = getHeight();
+    double xzfactor = 2*tan(hfov/2);
+    double yzfactor = 2*tan(vfov/2);
+
+    for (int i = 0; i < n; i++)
+    {
+        double z = proj[i][2];
+        double x = (proj[i][0]/xres - 0.5)*z*xzfactor;
+        double y = (0.5 - proj[i][1]/yres)*z*yzfactor;
+        world[i] = cv::Vec3d(x, y, z);
+    }
+}
+
+#endif // FRAME_SOURCE_H
@@ -14,6 +14,7 @@
 #include <opencv/highgui.h>
 
 #include "KinectInterface.h"
+#include "PipelineStats.h"
 #include "Skeleton.h"
 
 using namespace std;
@@ -23,10 +24,15 @@ using namespace std;
 xn::ImageGenerator KinectInterface::g_ImageGenerator;
 xn::DepthGenerator KinectInterface::g_DepthGenerator;
 xn::UserGenerator KinectInterface::g_UserGenerator;
+xn::DepthMetaData KinectInterface::g_DepthMD;
+xn::ImageMetaData KinectInterface::g_ImageMD;
 xn::Context KinectInterface::context;
         
-std::vector<cv::Vec3d> KinectInterface::joints;
-std::vector<cv::Vec2d> KinectInterface::joints_projected;
+std::vector<UserSkeleton> KinectInterface::users;
+double KinectInterface::capture_time;
+
+// The most users OpenNI reports at once
+#define MAX_USERS 15
 
 KinectInterface::KinectInterface()
 {
@@ -202,56 +208,100 @@ bool KinectInterface::Init()
     nRetVal = context.StartGeneratingAll();
     // TODO: check error code
 
+    // Fill in the meta data so the image size is known before the first
+    // frame is grabbed
+    g_DepthGenerator.GetMetaData(g_DepthMD);
+    g_ImageGenerator.GetMetaData(g_ImageMD);
+
     return true;
 }
 
-void KinectInterface::updateKinectData()
+bool KinectInterface::updateKinectData()
 { 
     // Update to next frame
     XnStatus nRetVal = context.WaitAndUpdateAll();
-    // TODO: check error code
-    
-    xn::ImageMetaData imageMD;
-    xn::DepthMetaData depthMD;
+    if (nRetVal != XN_STATUS_OK)
+    {
+        cerr << "Could not update the kinect: " << xnGetStatusString(nRetVal)
+             << endl;
+        return false;
+    }
+    capture_time = getTime();
     
     // Retrieve the RGB image 
-    g_ImageGenerator.GetMetaData(imageMD);
+    g_ImageGenerator.GetMetaData(g_ImageMD);
 
     // Retrieve the depth map
-    g_DepthGenerator.GetMetaData(depthMD);
+    g_DepthGenerator.GetMetaData(g_DepthMD);
 
-    XnUserID aUsers[8];
-    XnUInt16 nUsers = 8;
+    XnUserID aUsers[MAX_USERS];
+    XnUInt16 nUsers = MAX_USERS;
     g_UserGenerator.GetUsers(aUsers, nUsers);
 
-    joints.resize(30);
-    joints_projected.resize(30);
-    
-    if (nUsers > 0 && g_UserGenerator.GetSkeletonCap().IsTracking(aUsers[0]))
-    {
-        int joint_id_OpenNI = (int)XN_SKEL_HEAD;
-        int joint_id = 0;
+    xn::SkeletonCapability skeleton = g_UserGenerator.GetSkeletonCap();
 
-        for (; joint_id_OpenNI <= XN_SKEL_RIGHT_FOOT; joint_id_OpenNI++)
+    // Collect the skeleton of every tracked user. The user entries are
+    // reused from frame to frame, so their joint vectors don't get
+    // reallocated.
+    unsigned int ntracked = 0;
+    for (int u = 0; u < nUsers; u++)
+    {
+        if (!skeleton.IsTracking(aUsers[u]))
+            continue;
+
+        if (ntracked == users.size())
+            users.resize(ntracked + 1);
+        UserSkeleton &user = users[ntracked++];
+        user.id = aUsers[u];
+
+        XnPoint3D position[XN_SKEL_RIGHT_FOOT];
+        int njoints = 0;
+        for (int joint_id_OpenNI = (int)XN_SKEL_HEAD;
+             joint_id_OpenNI <= XN_SKEL_RIGHT_FOOT; joint_id_OpenNI++)
         {
-            if (!g_UserGenerator.GetSkeletonCap().IsJointActive((XnSkeletonJoint)joint_id_OpenNI))
+            if (!skeleton.IsJointActive((XnSkeletonJoint)joint_id_OpenNI))
                 continue;
 
             XnSkeletonJointPosition Joint;
-            g_UserGenerator.GetSkeletonCap().GetSkeletonJointPosition(aUsers[0], (XnSkeletonJoint)(joint_id_OpenNI), Joint);
-            
-            joints[joint_id] = cv::Vec3d(Joint.position.X, Joint.position.Y, Joint.position.Z);
+            skeleton.GetSkeletonJointPosition(aUsers[u], (XnSkeletonJoint)(joint_id_OpenNI), Joint);
+            position[njoints++] = Joint.position;
+        }
 
-            g_DepthGenerator.ConvertRealWorldToProjective(1, &Joint.position, &Joint.position);
-            joints_projected[joint_id] = cv::Vec2d(Joint.position.X, Joint.position.Y);
+        user.joints.resize(njoints);
+        for (int i = 0; i < njoints; i++)
+            user.joints[i] = cv::Vec3d(position[i].X, position[i].Y, position[i].Z);
 
-            joint_id++;
-        }
+        // Project all the joints of the user at once
+        g_DepthGenerator.ConvertRealWorldToProjective(njoints, position, position);
+        user.joints_projected.resize(njoints);
+        for (int i = 0; i < njoints; i++)
+            user.joints_projected[i] = cv::Vec2d(position[i].X, position[i].Y);
     }
-    else
+    users.resize(ntracked);
+
+    return true;
+}
+
+void KinectInterface::getFieldOfView(double *hfov, double *vfov) const
+{
+    XnFieldOfView fov;
+    g_DepthGenerator.GetFieldOfView(fov);
+
+    *hfov = fov.fHFOV;
+    *vfov = fov.fVFOV;
+}
+
+void KinectInterface::convertProjectiveToRealWorld(int n, const cv::Vec3d *proj,
+                                                   cv::Vec3d *world)
+{
+    for (int i = 0; i < n; i++)
     {
-        joints.resize(0);
-        joints_projected.resize(0);
+        XnPoint3D P;
+        P.X = proj[i][0];
+        P.Y = proj[i][1];
+        P.Z = proj[i][2];
+        g_DepthGenerator.ConvertProjectiveToRealWorld(1, &P, &P);
+        world[i] = cv::Vec3d(P.X, P.Y, P.Z);
     }
 }
 
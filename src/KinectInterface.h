@@ -17,7 +17,9 @@
 #include <XnCppWrapper.h>
 #include <XnVNite.h>
 
-class KinectInterface
+#include "FrameSource.h"
+
+class KinectInterface : public FrameSource
 {
     public:
         KinectInterface();
@@ -28,13 +30,30 @@ class KinectInterface
             context.Shutdown();
         }
 
-        static void updateKinectData();
+        // Wait for the next frame of the device. Returns false if it failed.
+        static bool updateKinectData();
 
         static IplImage *getRGB() { return 0; }
-        static IplImage *getDepthMap() { return 0; };
 
-        static std::vector<cv::Vec3d> &getJoints() { return joints; }
-        static std::vector<cv::Vec2d> &getProjectedJoints() { return joints_projected; }
+        // FrameSource interface
+        bool update() { return updateKinectData(); }
+
+        int getWidth() const { return g_DepthMD.XRes(); }
+        int getHeight() const { return g_DepthMD.YRes(); }
+
+        const unsigned short *getDepthMap() { return g_DepthMD.Data(); }
+        const unsigned char *getRGBImage() { return g_ImageMD.Data(); }
+
+        std::vector<UserSkeleton> &getUsers() { return users; }
+
+        unsigned int getFrameID() const { return g_DepthMD.FrameID(); }
+        unsigned long long getTimestamp() const { return g_DepthMD.Timestamp(); }
+        double getCaptureTime() const { return capture_time; }
+
+        void getFieldOfView(double *hfov, double *vfov) const;
+
+        void convertProjectiveToRealWorld(int n, const cv::Vec3d *proj,
+                                          cv::Vec3d *world);
 
         static xn::Context& getContext() { return context; }
 
@@ -68,11 +87,18 @@ class KinectInterface
         static xn::DepthGenerator g_DepthGenerator;
         static xn::ImageGenerator g_ImageGenerator;
         static xn::UserGenerator g_UserGenerator;
+
+        // The meta data of the last frame
+        static xn::DepthMetaData g_DepthMD;
+        static xn::ImageMetaData g_ImageMD;
     
         static xn::Context context;
 
-        static std::vector<cv::Vec3d> joints;
-        static std::vector<cv::Vec2d> joints_projected;
+        // The skeletons of the users tracked in the last frame
+        static std::vector<UserSkeleton> users;
+
+        // When the current frame arrived
+        static double capture_time;
 };
 
 #endif // KINECT_INTERFACE_H
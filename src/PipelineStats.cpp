@@ -0,0 +1,63 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <algorithm>
+
+#include "PipelineStats.h"
+
+PipelineStats::PipelineStats(int window)
+    : window(window), next(0), frames(0), dropped(0), started(false),
+      last_frame_id(0), capture_time(0), last_latency(0)
+{
+    latencies.reserve(window);
+}
+
+void PipelineStats::frameStarted(unsigned int frame_id, double capture_time)
+{
+    // A frame id that doesn't move forward means the device restarted or
+    // the session looped, which doesn't drop anything
+    if (started && frame_id > last_frame_id)
+        dropped += frame_id - last_frame_id - 1;
+
+    started = true;
+    last_frame_id = frame_id;
+    this->capture_time = capture_time;
+}
+
+void PipelineStats::frameFinished()
+{
+    last_latency = getTime() - capture_time;
+    frames++;
+
+    if ((int)latencies.size() < window)
+        latencies.push_back(last_latency);
+    else
+        latencies[next] = last_latency;
+    next = (next + 1) % window;
+}
+
+double PipelineStats::getLatencyPercentile(double p) const
+{
+    if (latencies.empty())
+        return 0;
+
+    std::vector<double> sorted(latencies);
+    int k = (int)(p/100*(sorted.size() - 1) + 0.5);
+    k = std::max(0, std::min(k, (int)sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+void PipelineStats::print(FILE *f) const
+{
+    fprintf(f, "%d frames, %d dropped, latency p50 %.1lf ms, p95 %.1lf ms, "
+            "p99 %.1lf ms\n", frames, dropped,
+            1000*getLatencyPercentile(50), 1000*getLatencyPercentile(95),
+            1000*getLatencyPercentile(99));
+}
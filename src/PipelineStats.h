@@ -0,0 +1,74 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+// The time in seconds on the monotonic clock, which unlike the wall clock
+// never jumps. The frame sources stamp their frames with it, and the
+// pipeline is timed against it.
+inline double getTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/*
+ * Keeps track of how stale the measurements are and of how many sensor
+ * frames never made it through the pipeline.
+ *
+ * The latency of a frame goes from the time it was captured (or read
+ * from a session when replaying) until its measurements are done. Frames
+ * are dropped when the sensor frame id jumps by more than one, which
+ * happens when the processing is slower than the sensor, and shows up in
+ * sessions recorded that way as well.
+ */
+class PipelineStats
+{
+    public:
+        // The latency percentiles are computed over the last window frames
+        PipelineStats(int window = 300);
+
+        // Start timing a frame. Frames must be started in capture order,
+        // and each one finished before the next one is started.
+        void frameStarted(unsigned int frame_id, double capture_time);
+
+        // The measurements of the frame being timed are done
+        void frameFinished();
+
+        int getFrames() const { return frames; }
+        int getDroppedFrames() const { return dropped; }
+
+        // The latency of the last finished frame, in seconds
+        double getLatency() const { return last_latency; }
+
+        // The p-th percentile (0 to 100) of the latency of the last frames,
+        // in seconds. 0 if no frame was finished yet.
+        double getLatencyPercentile(double p) const;
+
+        // Print the frame counts and the p50/p95/p99 latencies
+        void print(FILE *f) const;
+
+    private:
+        // The last latencies, as a ring buffer
+        std::vector<double> latencies;
+        int window, next;
+
+        int frames, dropped;
+        bool started;
+        unsigned int last_frame_id;
+        double capture_time, last_latency;
+};
+
+#endif // PIPELINE_STATS_H
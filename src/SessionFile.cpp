@@ -0,0 +1,426 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SessionFile.h"
+#include "PipelineStats.h"
+#include "session_codec.h"
+
+using namespace std;
+
+// Size of a block once padded to 8 bytes
+static inline uint64_t padded(uint64_t size)
+{
+    return (size + 7) & ~(uint64_t)7;
+}
+
+// The largest image a session may hold, so a corrupt header cannot make
+// the player allocate wildly
+#define SESSION_MAX_SIDE 4096
+
+SessionRecorder::SessionRecorder()
+    : file(0), offset(0)
+{
+}
+
+bool SessionRecorder::open(const char *filename, FrameSource &source,
+                           bool compress)
+{
+    close();
+
+    file = fopen(filename, "wb");
+    if (!file)
+    {
+        cerr << "Could not create session file " << filename << endl;
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.width = source.getWidth();
+    header.height = source.getHeight();
+    header.flags = compress ? SESSION_FLAG_COMPRESSED : 0;
+    source.getFieldOfView(&header.hfov, &header.vfov);
+
+    offsets.clear();
+    offset = 0;
+
+    // The header is rewritten in close() with the frame count and index
+    return writeBlock(&header, sizeof(header));
+}
+
+bool SessionRecorder::writeBlock(const void *data, size_t size)
+{
+    static const char zeros[8] = {0};
+    size_t padding = padded(size) - size;
+
+    if (fwrite(data, 1, size, file) != size ||
+        fwrite(zeros, 1, padding, file) != padding)
+    {
+        cerr << "Error writing the session file\n";
+        return false;
+    }
+    offset += size + padding;
+    return true;
+}
+
+bool SessionRecorder::writeFrame(FrameSource &source)
+{
+    if (!file)
+        return false;
+
+    int npts = header.width*header.height;
+
+    // Gather the joints of all users in one block
+    std::vector<UserSkeleton> &users = source.getUsers();
+    user_table.resize(users.size());
+    joints.clear();
+    joints_projected.clear();
+    for (unsigned int u = 0; u < users.size(); u++)
+    {
+        user_table[u].id = users[u].id;
+        user_table[u].njoints = users[u].joints.size();
+        joints.insert(joints.end(), users[u].joints.begin(),
+                      users[u].joints.end());
+        joints_projected.insert(joints_projected.end(),
+                                users[u].joints_projected.begin(),
+                                users[u].joints_projected.end());
+    }
+
+    SessionFrameHeader frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.frame_id = source.getFrameID();
+    frame.njoints = joints.size();
+    frame.timestamp = source.getTimestamp();
+    frame.depth_size = npts*sizeof(unsigned short);
+    frame.rgb_size = 3*npts;
+    frame.nusers = users.size();
+
+    const void *depth = source.getDepthMap();
+    const void *rgb = source.getRGBImage();
+
+    if (header.flags & SESSION_FLAG_COMPRESSED)
+    {
+        depth_code.clear();
+        encode_depth(source.getDepthMap(), header.width, header.height,
+                     depth_code);
+        frame.depth_size = depth_code.size();
+        depth = &depth_code[0];
+
+        rgb_code.clear();
+        encode_rgb(source.getRGBImage(), header.width, header.height,
+                   rgb_code);
+        frame.rgb_size = rgb_code.size();
+        rgb = &rgb_code[0];
+    }
+
+    offsets.push_back(offset);
+
+    bool ok = writeBlock(&frame, sizeof(frame));
+    if (frame.nusers > 0)
+        ok = ok && writeBlock(&user_table[0],
+                              frame.nusers*sizeof(SessionUser));
+    if (frame.njoints > 0)
+    {
+        ok = ok && writeBlock(&joints[0], frame.njoints*sizeof(cv::Vec3d));
+        ok = ok && writeBlock(&joints_projected[0],
+                              frame.njoints*sizeof(cv::Vec2d));
+    }
+    ok = ok && writeBlock(depth, frame.depth_size);
+    ok = ok && writeBlock(rgb, frame.rgb_size);
+
+    return ok;
+}
+
+void SessionRecorder::close()
+{
+    if (!file)
+        return;
+
+    // Append the frame index and fill in the header
+    header.nframes = offsets.size();
+    header.index_offset = offset;
+    if (!offsets.empty())
+        writeBlock(&offsets[0], offsets.size()*sizeof(uint64_t));
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = 0;
+}
+
+SessionPlayer::SessionPlayer()
+    : data(0), size(0), current(-1), loop(false),
+      depth(0), rgb(0), frame_id(0), timestamp(0), capture_time(0)
+{
+}
+
+bool SessionPlayer::open(const char *filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "Could not open session file " << filename << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SessionHeader))
+    {
+        cerr << "Invalid session file " << filename << endl;
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+
+    void *p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        cerr << "Could not map session file " << filename << endl;
+        return false;
+    }
+    data = (const unsigned char *)p;
+
+    // The frames are usually played in order
+    madvise(p, size, MADV_SEQUENTIAL);
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SESSION_MAGIC || header.version < 1 ||
+        header.version > SESSION_VERSION ||
+        header.width == 0 || header.width > SESSION_MAX_SIDE ||
+        header.height == 0 || header.height > SESSION_MAX_SIDE)
+    {
+        cerr << "Invalid session file " << filename << endl;
+        close();
+        return false;
+    }
+
+    if (!buildIndex())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool SessionPlayer::buildIndex()
+{
+    offsets.clear();
+
+    uint64_t index_size = (uint64_t)header.nframes*sizeof(uint64_t);
+    if (header.index_offset != 0 && header.index_offset % 8 == 0 &&
+        header.index_offset <= size && index_size <= size - header.index_offset)
+    {
+        const uint64_t *index = (const uint64_t *)(data + header.index_offset);
+        offsets.assign(index, index + header.nframes);
+
+        bool valid = true;
+        for (size_t i = 0; i < offsets.size() && valid; i++)
+            valid = frameValid(offsets[i]);
+        if (valid)
+            return true;
+        cerr << "Session frame index is corrupt, rebuilding it\n";
+        offsets.clear();
+    }
+    else
+        cout << "Session has no frame index, rebuilding it\n";
+
+    // The recording was not closed, so walk the frames to find them, up
+    // to the first one that is cut short or corrupt
+    uint64_t offset = sizeof(SessionHeader);
+    while (frameValid(offset))
+    {
+        offsets.push_back(offset);
+        offset += frameSize((const SessionFrameHeader *)(data + offset));
+    }
+    header.nframes = offsets.size();
+
+    return true;
+}
+
+// Whether a whole frame starts at offset, with sizes that agree with the
+// session header
+bool SessionPlayer::frameValid(uint64_t offset) const
+{
+    uint64_t header_size = header.version == 1 ?
+                           SESSION_FRAME_HEADER_V1_SIZE :
+                           sizeof(SessionFrameHeader);
+    if (offset % 8 != 0 || offset > size || header_size > size - offset)
+        return false;
+
+    const SessionFrameHeader *frame =
+        (const SessionFrameHeader *)(data + offset);
+    if (frameSize(frame) > size - offset)
+        return false;
+
+    // The joints of the user table have to add up to those of the frame
+    if (header.version > 1)
+    {
+        const SessionUser *user_table = (const SessionUser *)
+                (data + offset + padded(sizeof(SessionFrameHeader)));
+        uint64_t njoints = 0;
+        for (unsigned int u = 0; u < frame->nusers; u++)
+            njoints += user_table[u].njoints;
+        if (njoints != frame->njoints)
+            return false;
+    }
+
+    // The images are used in place when they are not compressed
+    uint64_t npts = (uint64_t)header.width*header.height;
+    if (!(header.flags & SESSION_FLAG_COMPRESSED) &&
+        (frame->depth_size != npts*sizeof(unsigned short) ||
+         frame->rgb_size != 3*npts))
+        return false;
+
+    return true;
+}
+
+// The size of a frame, including its header
+uint64_t SessionPlayer::frameSize(const SessionFrameHeader *frame) const
+{
+    uint64_t size = padded(frame->njoints*sizeof(cv::Vec3d)) +
+                    padded(frame->njoints*sizeof(cv::Vec2d)) +
+                    padded(frame->depth_size) + padded(frame->rgb_size);
+    if (header.version == 1)
+        return size + padded(SESSION_FRAME_HEADER_V1_SIZE);
+    return size + padded(sizeof(SessionFrameHeader)) +
+           padded(frame->nusers*sizeof(SessionUser));
+}
+
+void SessionPlayer::close()
+{
+    if (data)
+        munmap((void *)data, size);
+    data = 0;
+    size = 0;
+    offsets.clear();
+    current = -1;
+    depth = 0;
+    rgb = 0;
+    depth_buffer = FrameRef();
+    rgb_buffer = FrameRef();
+    users.clear();
+}
+
+bool SessionPlayer::seek(int i)
+{
+    if (!data || i < 0 || i >= (int)offsets.size())
+        return false;
+
+    if (!frameValid(offsets[i]))
+    {
+        cerr << "Corrupt frame " << i << " in session file\n";
+        return false;
+    }
+
+    const unsigned char *p = data + offsets[i];
+    const SessionFrameHeader *frame = (const SessionFrameHeader *)p;
+
+    frame_id = frame->frame_id;
+    timestamp = frame->timestamp;
+    capture_time = getTime();
+
+    // Version 1 sessions hold the joints of a single user
+    SessionUser single_user = {1, frame->njoints};
+    const SessionUser *user_table = &single_user;
+    unsigned int nusers = frame->njoints > 0 ? 1 : 0;
+    if (header.version == 1)
+        p += padded(SESSION_FRAME_HEADER_V1_SIZE);
+    else
+    {
+        p += padded(sizeof(SessionFrameHeader));
+        user_table = (const SessionUser *)p;
+        nusers = frame->nusers;
+        p += padded(nusers*sizeof(SessionUser));
+    }
+
+    const cv::Vec3d *pJoints = (const cv::Vec3d *)p;
+    p += padded(frame->njoints*sizeof(cv::Vec3d));
+    const cv::Vec2d *pProjected = (const cv::Vec2d *)p;
+    p += padded(frame->njoints*sizeof(cv::Vec2d));
+
+    users.resize(nusers);
+    for (unsigned int u = 0; u < nusers; u++)
+    {
+        int njoints = user_table[u].njoints;
+        users[u].id = user_table[u].id;
+        users[u].joints.assign(pJoints, pJoints + njoints);
+        users[u].joints_projected.assign(pProjected, pProjected + njoints);
+        pJoints += njoints;
+        pProjected += njoints;
+    }
+
+    if (header.flags & SESSION_FLAG_COMPRESSED)
+    {
+        // Decode into new buffers if the previous frame is still in use
+        int npts = header.width*header.height;
+        depth = (unsigned short *)depth_buffer.makeWritable(
+                                        npts*sizeof(unsigned short));
+        rgb = (unsigned char *)rgb_buffer.makeWritable(3*npts);
+        if (!depth || !rgb)
+        {
+            cerr << "Could not allocate frame " << i << " of session file\n";
+            return false;
+        }
+
+        if (!decode_depth(p, frame->depth_size, header.width, header.height,
+                          (unsigned short *)depth) ||
+            !decode_rgb(p + padded(frame->depth_size), frame->rgb_size,
+                        header.width, header.height, (unsigned char *)rgb))
+        {
+            cerr << "Corrupt frame " << i << " in session file\n";
+            return false;
+        }
+    }
+    else
+    {
+        depth = (const unsigned short *)p;
+        rgb = p + padded(frame->depth_size);
+    }
+
+    current = i;
+    return true;
+}
+
+FrameRef SessionPlayer::getDepthBuffer()
+{
+    if (header.flags & SESSION_FLAG_COMPRESSED)
+        return depth_buffer;
+    return FrameSource::getDepthBuffer();
+}
+
+FrameRef SessionPlayer::getRGBBuffer()
+{
+    if (header.flags & SESSION_FLAG_COMPRESSED)
+        return rgb_buffer;
+    return FrameSource::getRGBBuffer();
+}
+
+bool SessionPlayer::update()
+{
+    int next = current + 1;
+    if (next >= (int)offsets.size())
+    {
+        if (!loop)
+            return false;
+        next = 0;
+    }
+    return seek(next);
+}
@@ -0,0 +1,202 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "FrameSource.h"
+
+/*
+ * Recorded sessions.
+ *
+ * A session file stores, for every frame, the depth map (uint16), the rgb
+ * image, the joints of every tracked user and their projections, and the
+ * sensor frame id and timestamp. The layout is
+ *
+ *     SessionHeader
+ *     frame 0: SessionFrameHeader, one SessionUser per user, the joints
+ *              of all users, their projections, depth, rgb
+ *     frame 1: ...
+ *     frame index: one uint64_t file offset per frame
+ *
+ * Every block is padded to 8 bytes, so the depth maps can be used in place
+ * when the file is memory mapped. The header is rewritten with the frame
+ * count and the index offset when the recording is closed; a session that
+ * was not closed properly has index_offset == 0, and its index is rebuilt
+ * by walking the frames when it is opened.
+ *
+ * If the header has the SESSION_FLAG_COMPRESSED flag, the depth and rgb
+ * blocks are coded with encode_depth() and encode_rgb() (session_codec.h),
+ * and depth_size and rgb_size are the sizes of the coded blocks.
+ *
+ * Version 1 sessions had a single user and no user table: their frame
+ * header ends before nusers, and the joints follow it directly.
+ */
+
+#define SESSION_MAGIC   0x534b4d42      // "BMKS"
+#define SESSION_VERSION 2
+
+// Size of the frame header of version 1 sessions
+#define SESSION_FRAME_HEADER_V1_SIZE 24
+
+// SessionHeader flags
+#define SESSION_FLAG_COMPRESSED 0x1
+
+struct SessionHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t flags;
+    uint32_t nframes;
+    double hfov, vfov;          // depth camera field of view, in radians
+    uint64_t index_offset;      // file offset of the frame index
+};
+
+struct SessionFrameHeader
+{
+    uint32_t frame_id;
+    uint32_t njoints;           // the total number of joints of all users
+    uint64_t timestamp;         // microseconds
+    uint32_t depth_size;        // size in bytes of the depth block
+    uint32_t rgb_size;          // size in bytes of the rgb block
+    uint32_t nusers;
+    uint32_t reserved;
+};
+
+struct SessionUser
+{
+    uint32_t id;
+    uint32_t njoints;
+};
+
+// Writes the frames of a FrameSource to a session file
+class SessionRecorder
+{
+    public:
+        SessionRecorder();
+        ~SessionRecorder() { close(); }
+
+        // Create the session file. The image size and field of view are
+        // taken from the source. If compress is set, the depth maps and
+        // rgb images are stored with the lossless session codec.
+        bool open(const char *filename, FrameSource &source,
+                  bool compress = false);
+
+        // Append the current frame of the source to the session
+        bool writeFrame(FrameSource &source);
+
+        // Write the frame index and finish the header
+        void close();
+
+        bool isOpen() const { return file != 0; }
+
+        int getFrameCount() const { return offsets.size(); }
+
+    private:
+        bool writeBlock(const void *data, size_t size);
+
+        FILE *file;
+        SessionHeader header;
+        std::vector<uint64_t> offsets;
+        uint64_t offset;
+
+        // Scratch buffers for the user table, the joints and the coded
+        // images
+        std::vector<SessionUser> user_table;
+        std::vector<cv::Vec3d> joints;
+        std::vector<cv::Vec2d> joints_projected;
+        std::vector<unsigned char> depth_code, rgb_code;
+};
+
+// Plays back a session file. The file is memory mapped, and the frames are
+// located through the frame index, so seeking is O(1). The depth maps and
+// rgb images of uncompressed sessions are used directly from the mapping;
+// compressed ones are decoded in parallel into buffers owned by the player.
+class SessionPlayer : public FrameSource
+{
+    public:
+        SessionPlayer();
+        ~SessionPlayer() { close(); }
+
+        bool open(const char *filename);
+        void close();
+
+        bool isOpen() const { return data != 0; }
+
+        int getFrameCount() const { return offsets.size(); }
+
+        // The index of the current frame, -1 before the first update()
+        int getCurrentFrame() const { return current; }
+
+        // Make frame i the current frame
+        bool seek(int i);
+
+        // If loop is set, update() wraps around to the first frame at the
+        // end of the session
+        void setLoop(bool loop) { this->loop = loop; }
+
+        // FrameSource interface
+        bool update();
+
+        int getWidth() const { return header.width; }
+        int getHeight() const { return header.height; }
+
+        const unsigned short *getDepthMap() { return depth; }
+        const unsigned char *getRGBImage() { return rgb; }
+
+        // The frames of uncompressed sessions borrow the memory mapping,
+        // which stays valid while the session is open
+        FrameRef getDepthBuffer();
+        FrameRef getRGBBuffer();
+
+        std::vector<UserSkeleton> &getUsers() { return users; }
+
+        unsigned int getFrameID() const { return frame_id; }
+        unsigned long long getTimestamp() const { return timestamp; }
+        double getCaptureTime() const { return capture_time; }
+
+        void getFieldOfView(double *hfov, double *vfov) const
+        {
+            *hfov = header.hfov;
+            *vfov = header.vfov;
+        }
+
+    private:
+        bool buildIndex();
+        bool frameValid(uint64_t offset) const;
+        uint64_t frameSize(const SessionFrameHeader *frame) const;
+
+        const unsigned char *data;
+        size_t size;
+
+        SessionHeader header;
+        std::vector<uint64_t> offsets;
+        int current;
+        bool loop;
+
+        const unsigned short *depth;
+        const unsigned char *rgb;
+        std::vector<UserSkeleton> users;
+        unsigned int frame_id;
+        unsigned long long timestamp;
+        double capture_time;
+
+        // Decoded images of compressed sessions
+        FrameRef depth_buffer;
+        FrameRef rgb_buffer;
+};
+
+#endif // SESSION_FILE_H
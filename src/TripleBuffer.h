@@ -0,0 +1,83 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+/*
+ * Lock-free triple buffer between one producer and one consumer thread.
+ *
+ * The producer always owns a back slot it can write to, and the consumer
+ * always owns a front slot it can read from. The third slot sits in the
+ * middle: publish() swaps the back slot with it, and acquire() swaps the
+ * front slot with it if it holds a frame the consumer has not seen yet.
+ * Neither side ever waits for the other, and the consumer always gets the
+ * newest complete frame; frames published while the consumer was busy are
+ * dropped.
+ */
+template <class T>
+class TripleBuffer
+{
+    public:
+        TripleBuffer() : back(0), middle(1), front(2), dropped(0) {}
+
+        // The slot the producer writes the next frame into
+        T &getBack() { return slots[back]; }
+
+        // Make the back slot available to the consumer
+        void publish()
+        {
+            int prev = exchange(back | FRESH);
+            if (prev & FRESH)
+                __sync_fetch_and_add(&dropped, 1);
+            back = prev & INDEX;
+        }
+
+        // If a new frame was published since the last call, make it the
+        // front slot and return true
+        bool acquire()
+        {
+            if (!(middle & FRESH))
+                return false;
+            front = exchange(front) & INDEX;
+            return true;
+        }
+
+        // The slot the consumer reads from
+        T &getFront() { return slots[front]; }
+        const T &getFront() const { return slots[front]; }
+
+        // True if there is a frame the consumer has not acquired yet
+        bool hasFresh() const { return (middle & FRESH) != 0; }
+
+        // The number of published frames the consumer never saw
+        int getDropped() const { return dropped; }
+
+    private:
+        enum { INDEX = 3, FRESH = 4 };
+
+        // Atomically replace the middle slot, returning the previous one
+        int exchange(int value)
+        {
+            int prev;
+            do
+            {
+                prev = middle;
+            } while (__sync_val_compare_and_swap(&middle, prev, value) != prev);
+            return prev;
+        }
+
+        T slots[3];
+        int back;               // owned by the producer
+        volatile int middle;    // shared: slot index | FRESH
+        int front;              // owned by the consumer
+        volatile int dropped;
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,218 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitmask.h"
+#include "mincut_segmentation.h"
+
+void bit_mask::resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    words_per_row = (width + 63)/64;
+    bits.assign(words_per_row*height, 0);
+}
+
+void bit_mask::clear()
+{
+    bits.assign(bits.size(), 0);
+}
+
+void bit_mask::clear_span(int y, int x0, int x1)
+{
+    if (x0 >= x1)
+        return;
+
+    uint64_t *r = row(y);
+    for (int w = x0 >> 6; w <= (x1 - 1) >> 6; w++)
+        r[w] &= ~row_word_mask(w, x0, x1);
+}
+
+uint64_t bit_mask::shifted_word(int y, int word, int dx) const
+{
+    if (y < 0 || y >= height)
+        return 0;
+
+    const uint64_t *r = row(y);
+    int start = 64*word + dx;
+    int q = start >> 6;     // rounds down for negative starts too
+    int s = start & 63;
+
+    uint64_t lo = q >= 0 && q < words_per_row ? r[q] : 0;
+    if (s == 0)
+        return lo;
+    uint64_t hi = q + 1 >= 0 && q + 1 < words_per_row ? r[q + 1] : 0;
+    return (lo >> s) | (hi << (64 - s));
+}
+
+void bit_mask::pack(const bool *values, const image_roi &roi)
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        uint64_t *r = row(y);
+        const bool *v = values + y*width;
+        for (int w = roi.x0 >> 6; w <= (roi.x1 - 1) >> 6; w++)
+        {
+            int x0 = std::max(roi.x0, 64*w), x1 = std::min(roi.x1, 64*w + 64);
+            uint64_t word = 0;
+            for (int x = x0; x < x1; x++)
+                word |= (uint64_t)v[x] << (x & 63);
+
+            uint64_t m = row_word_mask(w, roi.x0, roi.x1);
+            r[w] = (r[w] & ~m) | word;
+        }
+    }
+}
+
+void bit_mask::unpack(bool *values, const image_roi &roi) const
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        const uint64_t *r = row(y);
+        bool *v = values + y*width;
+        for (int x = roi.x0; x < roi.x1; x++)
+            v[x] = (r[x >> 6] >> (x & 63)) & 1;
+    }
+}
+
+unsigned char trimap_planes::get(int x, int y) const
+{
+    if (unknown.test(x, y))
+        return TRIMAP_U;
+    return foreground.test(x, y) ? TRIMAP_FG : TRIMAP_BG;
+}
+
+void trimap_planes::pack(const unsigned char *trimap, const image_roi &roi)
+{
+    int width = foreground.get_width();
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        uint64_t *fg = foreground.row(y);
+        uint64_t *u = unknown.row(y);
+        const unsigned char *t = trimap + y*width;
+        for (int w = roi.x0 >> 6; w <= (roi.x1 - 1) >> 6; w++)
+        {
+            int x0 = std::max(roi.x0, 64*w), x1 = std::min(roi.x1, 64*w + 64);
+            uint64_t fg_word = 0, u_word = 0;
+
+#ifdef __SSE2__
+            if (x1 - x0 == 64)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    __m128i v = _mm_loadu_si128((const __m128i *)(t + x0 + 16*k));
+                    unsigned fg_bits = _mm_movemask_epi8(
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8(TRIMAP_FG)));
+                    unsigned u_bits = _mm_movemask_epi8(
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8(TRIMAP_U)));
+                    fg_word |= (uint64_t)fg_bits << (16*k);
+                    u_word |= (uint64_t)u_bits << (16*k);
+                }
+            }
+            else
+#endif
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    fg_word |= (uint64_t)(t[x] == TRIMAP_FG) << (x & 63);
+                    u_word |= (uint64_t)(t[x] == TRIMAP_U) << (x & 63);
+                }
+            }
+
+            uint64_t m = row_word_mask(w, roi.x0, roi.x1);
+            fg[w] = (fg[w] & ~m) | fg_word;
+            u[w] = (u[w] & ~m) | u_word;
+        }
+    }
+}
+
+void trimap_planes::unpack(unsigned char *trimap, const image_roi &roi) const
+{
+    int width = foreground.get_width();
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        const uint64_t *fg = foreground.row(y);
+        const uint64_t *u = unknown.row(y);
+        unsigned char *t = trimap + y*width;
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            int shift = x & 63;
+            if ((u[x >> 6] >> shift) & 1)
+                t[x] = TRIMAP_U;
+            else
+                t[x] = (fg[x >> 6] >> shift) & 1;
+        }
+    }
+}
+
+void majority_filter(const bit_mask &src, const image_roi &roi, int radius,
+                     bit_mask &dst)
+{
+    dst = src;
+
+    int x0 = roi.x0 + radius, x1 = roi.x1 - radius;
+    int y0 = roi.y0 + radius, y1 = roi.y1 - radius;
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    // A pixel is set if more than half of its window is set
+    int n = (2*radius + 1)*(2*radius + 1);
+    int majority = n/2 + 1;
+    int nplanes = 0;
+    while ((1 << nplanes) <= n)
+        nplanes++;
+
+    // Bit p of the window count of the 64 pixels of a word
+    uint64_t plane[32];
+
+    for (int y = y0; y < y1; y++)
+    {
+        uint64_t *out = dst.row(y);
+        for (int w = x0 >> 6; w <= (x1 - 1) >> 6; w++)
+        {
+            for (int p = 0; p < nplanes; p++)
+                plane[p] = 0;
+
+            // Add the window pixels one neighbour offset at a time, with
+            // a ripple carry through the bit planes
+            for (int dy = -radius; dy <= radius; dy++)
+            {
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    uint64_t carry = src.shifted_word(y + dy, w, dx);
+                    for (int p = 0; p < nplanes && carry; p++)
+                    {
+                        uint64_t t = plane[p] & carry;
+                        plane[p] ^= carry;
+                        carry = t;
+                    }
+                }
+            }
+
+            // count >= majority, comparing from the most significant bit
+            uint64_t greater = 0, equal = ~(uint64_t)0;
+            for (int p = nplanes - 1; p >= 0; p--)
+            {
+                if ((majority >> p) & 1)
+                    equal &= plane[p];
+                else
+                {
+                    greater |= equal & plane[p];
+                    equal &= ~plane[p];
+                }
+            }
+
+            uint64_t m = row_word_mask(w, x0, x1);
+            out[w] = (out[w] & ~m) | ((greater | equal) & m);
+        }
+    }
+}
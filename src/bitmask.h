@@ -0,0 +1,134 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef BITMASK_H
+#define BITMASK_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "roi.h"
+
+/*
+ * A binary image packed 1 bit per pixel.
+ *
+ * Each row is a run of 64 bit words, pixel x of a row being bit x % 64 of
+ * word x / 64. The bits past the width of a row are always 0, so whole
+ * words can be scanned without looking at the width.
+ */
+class bit_mask
+{
+    public:
+        bit_mask() : width(0), height(0), words_per_row(0) {}
+        bit_mask(int width, int height) { resize(width, height); }
+
+        // Change the size of the mask, clearing it
+        void resize(int width, int height);
+
+        int get_width() const { return width; }
+        int get_height() const { return height; }
+        int get_words_per_row() const { return words_per_row; }
+
+        uint64_t *row(int y) { return &bits[y*words_per_row]; }
+        const uint64_t *row(int y) const { return &bits[y*words_per_row]; }
+
+        bool test(int x, int y) const
+        {
+            return (row(y)[x >> 6] >> (x & 63)) & 1;
+        }
+        void set(int x, int y, bool value)
+        {
+            uint64_t bit = (uint64_t)1 << (x & 63);
+            if (value)
+                row(y)[x >> 6] |= bit;
+            else
+                row(y)[x >> 6] &= ~bit;
+        }
+
+        void clear();
+
+        // Clear the pixels x0 <= x < x1 of row y
+        void clear_span(int y, int x0, int x1);
+
+        // Set the n < 64 pixels of row y starting at x from the low n bits
+        // of 'bits', bit k being pixel x + k. The SIMD labelling passes
+        // write the movemask of their compare masks with it.
+        void put_bits(int x, int y, uint64_t bits, int n)
+        {
+            uint64_t keep = ((uint64_t)1 << n) - 1;
+            uint64_t *r = row(y) + (x >> 6);
+            int shift = x & 63;
+            r[0] = (r[0] & ~(keep << shift)) | (bits << shift);
+            if (shift + n > 64)
+                r[1] = (r[1] & ~(keep >> (64 - shift))) |
+                       (bits >> (64 - shift));
+        }
+
+        // The 64 pixels of row y starting at x = 64*word + dx, with dx
+        // between -63 and 63. The pixels outside the mask are 0.
+        uint64_t shifted_word(int y, int word, int dx) const;
+
+        // Set the pixels inside roi from an array of bools of an image
+        // with the same width, or the other way around
+        void pack(const bool *values, const image_roi &roi);
+        void unpack(bool *values, const image_roi &roi) const;
+
+    private:
+        int width, height, words_per_row;
+        std::vector<uint64_t> bits;
+};
+
+// The bits of word 'word' of a row for the pixels inside [x0, x1)
+inline uint64_t row_word_mask(int word, int x0, int x1)
+{
+    int first = x0 - 64*word, last = x1 - 64*word;
+    uint64_t mask = ~(uint64_t)0;
+    if (first > 0)
+        mask = first >= 64 ? 0 : mask << first;
+    if (last < 64)
+        mask &= last <= 0 ? 0 : ~(uint64_t)0 >> (64 - last);
+    return mask;
+}
+
+/*
+ * A trimap packed 2 bits per pixel, as a plane with the foreground pixels
+ * and a plane with the undefined ones (TRIMAP_U). The pixels in neither
+ * are background.
+ */
+struct trimap_planes
+{
+    bit_mask foreground, unknown;
+
+    void resize(int width, int height)
+    {
+        foreground.resize(width, height);
+        unknown.resize(width, height);
+    }
+
+    unsigned char get(int x, int y) const;
+
+    // Set the pixels inside roi from a trimap of an image with the same
+    // width, or the other way around
+    void pack(const unsigned char *trimap, const image_roi &roi);
+    void unpack(unsigned char *trimap, const image_roi &roi) const;
+};
+
+/*
+ * Set each pixel of dst inside roi that is at least radius pixels away
+ * from the border of roi to the majority value of the (2*radius + 1)^2
+ * pixels of src around it. The other pixels are copied from src. src and
+ * dst must be different masks of the same size.
+ *
+ * The window counts are kept bit-sliced, so 64 pixels are filtered with
+ * each word operation.
+ */
+void majority_filter(const bit_mask &src, const image_roi &roi, int radius,
+                     bit_mask &dst);
+
+#endif // BITMASK_H
@@ -0,0 +1,88 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef CLUSTER_CONTROL_H
+#define CLUSTER_CONTROL_H
+
+#include "PipelineStats.h"
+
+/*
+ * How an iterative clustering starts, and how long it may run.
+ *
+ * Consecutive frames barely change, so the clustering can start from the
+ * parameters found on the last frame and converge in a few iterations.
+ * The budget bounds the iterations of frames that do change a lot, at the
+ * cost of stopping before convergence.
+ */
+struct cluster_control
+{
+    // Start from the parameters passed in, when they are valid
+    bool warm_start;
+
+    // The most iterations and seconds to run for, 0 for no limit
+    int max_iterations;
+    double max_time;
+
+    // Set by the clustering: the iterations it ran, whether it converged
+    // before running out of budget, how far the model moved in the last
+    // iteration (for the clusterings that report it), and the seconds it
+    // took. Stopped early, the clustering still returns the model of its
+    // last iteration.
+    int iterations;
+    bool converged;
+    double shift, elapsed;
+
+    // When the clustering started
+    double start_time;
+};
+
+inline cluster_control make_cluster_control(bool warm_start = false,
+                                            int max_iterations = 0,
+                                            double max_time = 0)
+{
+    cluster_control control = {warm_start, max_iterations, max_time,
+                               0, false, 0, 0, 0};
+    return control;
+}
+
+// Called by the clustering before the first iteration
+inline void cluster_control_start(cluster_control *control)
+{
+    if (!control)
+        return;
+    control->iterations = 0;
+    control->converged = false;
+    control->shift = control->elapsed = 0;
+    control->start_time = getTime();
+}
+
+// Called by the clustering after each iteration, with how far the model
+// moved in it. Returns false if it has to stop: it converged, or the
+// budget is used up.
+inline bool cluster_control_next(cluster_control *control, bool converged,
+                                 double shift = 0)
+{
+    if (!control)
+        return !converged;
+
+    control->iterations++;
+    control->converged = converged;
+    control->shift = shift;
+    control->elapsed = getTime() - control->start_time;
+    if (converged)
+        return false;
+    if (control->max_iterations > 0 &&
+        control->iterations >= control->max_iterations)
+        return false;
+    if (control->max_time > 0 && control->elapsed >= control->max_time)
+        return false;
+    return true;
+}
+
+#endif // CLUSTER_CONTROL_H
@@ -0,0 +1,87 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <algorithm>
+#include <string.h>
+
+#include "color_histogram.h"
+
+#define SHIFT (8 - COLOR_HISTOGRAM_BITS)
+
+color_histogram::color_histogram()
+    : bin_of(COLOR_HISTOGRAM_BINS)
+{
+    cell empty;
+    memset(&empty, 0, sizeof(empty));
+    table.assign(COLOR_HISTOGRAM_BINS, empty);
+    colors.reserve(COLOR_HISTOGRAM_BINS);
+}
+
+void color_histogram::build(const pixel_partition &pixels,
+                            unsigned char label)
+{
+    // Only clear the colors of the last build
+    for (size_t b = 0; b < colors.size(); b++)
+        memset(&table[colors[b]], 0, sizeof(cell));
+    colors.clear();
+
+    int npixels = pixels.size(label);
+    pixel_color.resize(npixels);
+    lowest = highest = cv::Vec3d(0, 0, 0);
+    if (npixels == 0)
+        return;
+
+    const unsigned char *rgb[3] = {pixels.channel(label, 0),
+                                   pixels.channel(label, 1),
+                                   pixels.channel(label, 2)};
+    unsigned short *pixel = &pixel_color[0];
+    cell *t = &table[0];
+
+    // The colors are new in scan order, so the bins come out in the order
+    // of their first pixel. The range of the colors is taken in the same
+    // pass.
+    int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+    for (int i = 0; i < npixels; i++)
+    {
+        int r = rgb[0][i], g = rgb[1][i], b = rgb[2][i];
+        low[0] = std::min(low[0], r);
+        low[1] = std::min(low[1], g);
+        low[2] = std::min(low[2], b);
+        high[0] = std::max(high[0], r);
+        high[1] = std::max(high[1], g);
+        high[2] = std::max(high[2], b);
+
+        int color = (r >> SHIFT) << 2*COLOR_HISTOGRAM_BITS |
+                    (g >> SHIFT) << COLOR_HISTOGRAM_BITS | b >> SHIFT;
+        pixel[i] = color;
+
+        cell &c = t[color];
+        if (c.count++ == 0)
+            colors.push_back(color);
+        c.sum[0] += r;
+        c.sum[1] += g;
+        c.sum[2] += b;
+    }
+
+    for (size_t b = 0; b < colors.size(); b++)
+        bin_of[colors[b]] = b;
+
+    for (int c = 0; c < 3; c++)
+    {
+        lowest[c] = low[c];
+        highest[c] = high[c];
+    }
+}
+
+void color_histogram::lookup(const unsigned char *value, const int *index,
+                             unsigned char *cluster) const
+{
+    for (size_t i = 0; i < pixel_color.size(); i++)
+        cluster[index[i]] = value[bin_of[pixel_color[i]]];
+}
@@ -0,0 +1,83 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef COLOR_HISTOGRAM_H
+#define COLOR_HISTOGRAM_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "pixel_partition.h"
+
+// The bits kept of each channel: 32x32x32 bins
+#define COLOR_HISTOGRAM_BITS 5
+#define COLOR_HISTOGRAM_BINS (1 << 3*COLOR_HISTOGRAM_BITS)
+
+/*
+ * The colors of the pixels of a partition with a label, binned into a
+ * coarse rgb histogram.
+ *
+ * Only the bins with pixels in them are kept, each with its pixel count
+ * and the sum of their exact colors, so an algorithm can run on the few
+ * thousand bins of an image instead of on its pixels, and then hand its
+ * result per bin back to each pixel with lookup(). The buffers are kept
+ * from frame to frame.
+ */
+class color_histogram
+{
+    public:
+        color_histogram();
+
+        // Bin the colors of the pixels of a partition with a label
+        void build(const pixel_partition &pixels, unsigned char label);
+
+        // The number of bins with pixels in them
+        int size() const { return colors.size(); }
+
+        // The number of pixels in bin b
+        int count(int b) const { return table[colors[b]].count; }
+
+        // The sum of the colors of the pixels in bin b, and their mean
+        cv::Vec3d sum(int b) const
+        {
+            const cell &c = table[colors[b]];
+            return cv::Vec3d(c.sum[0], c.sum[1], c.sum[2]);
+        }
+        cv::Vec3d mean(int b) const { return sum(b)*(1.0/count(b)); }
+
+        // The lowest and highest value of each channel of the colors
+        const cv::Vec3d &low() const { return lowest; }
+        const cv::Vec3d &high() const { return highest; }
+
+        // Set cluster[index[i]] to value[b] for each pixel i of the
+        // partition, b being its bin
+        void lookup(const unsigned char *value, const int *index,
+                    unsigned char *cluster) const;
+
+    private:
+        struct cell
+        {
+            int count;
+            unsigned int sum[3];
+        };
+
+        // The pixel count and color sum of every quantized color, the
+        // colors with pixels, and the bin of each of those
+        std::vector<cell> table;
+        std::vector<int> colors;
+        std::vector<unsigned short> bin_of;
+
+        cv::Vec3d lowest, highest;
+
+        // The quantized color of each pixel
+        std::vector<unsigned short> pixel_color;
+};
+
+#endif // COLOR_HISTOGRAM_H
@@ -0,0 +1,265 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "connected_components.h"
+#include "mincut_segmentation.h"
+
+// Append the runs of set pixels of a mask row inside [x0, x1). A run
+// starts or ends wherever a pixel differs from the one before it, so the
+// edges of a word alternate between starts and ends.
+static void find_runs(const uint64_t *row, int x0, int x1, int y,
+                      std::vector<pixel_run> &runs)
+{
+    int start = -1;
+    uint64_t carry = 0;     // the pixel before the word
+
+    for (int w = x0 >> 6; w <= (x1 - 1) >> 6; w++)
+    {
+        uint64_t bits = row[w] & row_word_mask(w, x0, x1);
+        uint64_t edges = bits ^ ((bits << 1) | carry);
+        carry = bits >> 63;
+
+        while (edges)
+        {
+            int x = 64*w + __builtin_ctzll(edges);
+            edges &= edges - 1;
+
+            if (start < 0)
+                start = x;
+            else
+            {
+                pixel_run run = {y, start, x};
+                runs.push_back(run);
+                start = -1;
+            }
+        }
+    }
+
+    if (start >= 0)
+    {
+        pixel_run run = {y, start, x1};
+        runs.push_back(run);
+    }
+}
+
+// Join the components of runs a and b. The root of a component is always
+// its first run, so every run comes after its parent.
+static void unite(std::vector<int> &parent, int a, int b)
+{
+    while (parent[a] != a)
+        a = parent[a] = parent[parent[a]];
+    while (parent[b] != b)
+        b = parent[b] = parent[parent[b]];
+
+    if (a < b)
+        parent[b] = a;
+    else
+        parent[a] = b;
+}
+
+// Join the runs [a0, a1) of a row with the 8-connected runs [b0, b1) of
+// the row below
+static void join_rows(const std::vector<pixel_run> &runs,
+                      std::vector<int> &parent,
+                      int a0, int a1, int b0, int b1)
+{
+    int a = a0, b = b0;
+    while (a < a1 && b < b1)
+    {
+        if (runs[a].x1 < runs[b].x0)
+            a++;
+        else if (runs[b].x1 < runs[a].x0)
+            b++;
+        else
+        {
+            unite(parent, a, b);
+            if (runs[a].x1 < runs[b].x1)
+                a++;
+            else
+                b++;
+        }
+    }
+}
+
+void component_labeller::label(const bit_mask &mask, const image_roi &roi)
+{
+    this->roi = roi;
+    runs.clear();
+    parent.clear();
+    component.clear();
+    row_start.assign(std::max(roi.height(), 0) + 1, 0);
+    if (roi.empty())
+        return;
+
+    int nstrips = (roi.height() + COMPONENT_STRIP_ROWS - 1)/COMPONENT_STRIP_ROWS;
+    if ((int)strip_runs.size() < nstrips)
+    {
+        strip_runs.resize(nstrips);
+        strip_parent.resize(nstrips);
+    }
+
+    // First pass: the runs of each strip, and their components inside the
+    // strip. The number of runs of each row goes into row_start.
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < nstrips; s++)
+    {
+        std::vector<pixel_run> &srun = strip_runs[s];
+        std::vector<int> &sparent = strip_parent[s];
+        srun.clear();
+        sparent.clear();
+
+        int y0 = roi.y0 + s*COMPONENT_STRIP_ROWS;
+        int y1 = std::min(y0 + COMPONENT_STRIP_ROWS, roi.y1);
+        int prev = 0;
+        for (int y = y0; y < y1; y++)
+        {
+            int first = srun.size();
+            find_runs(mask.row(y), roi.x0, roi.x1, y, srun);
+            int last = srun.size();
+            row_start[y - roi.y0 + 1] = last - first;
+
+            for (int i = first; i < last; i++)
+                sparent.push_back(i);
+            if (y > y0)
+                join_rows(srun, sparent, prev, first, first, last);
+            prev = first;
+        }
+    }
+
+    for (unsigned int y = 1; y < row_start.size(); y++)
+        row_start[y] += row_start[y - 1];
+
+    // Put the strips together, and join them along their borders
+    runs.reserve(row_start.back());
+    parent.reserve(row_start.back());
+    for (int s = 0; s < nstrips; s++)
+    {
+        int offset = runs.size();
+        runs.insert(runs.end(), strip_runs[s].begin(), strip_runs[s].end());
+        for (unsigned int i = 0; i < strip_parent[s].size(); i++)
+            parent.push_back(strip_parent[s][i] + offset);
+    }
+
+    for (int s = 1; s < nstrips; s++)
+    {
+        int row = s*COMPONENT_STRIP_ROWS;
+        join_rows(runs, parent, row_start[row - 1], row_start[row],
+                  row_start[row], row_start[row + 1]);
+    }
+
+    // Second pass: parents come first, so their components are known by
+    // the time their children are reached
+    component.resize(runs.size());
+    for (unsigned int i = 0; i < runs.size(); i++)
+        component[i] = parent[i] == (int)i ? i : component[parent[i]];
+}
+
+int component_labeller::find_run(int x, int y) const
+{
+    if (y < roi.y0 || y >= roi.y1)
+        return -1;
+
+    // The last run of the row starting at or before x
+    int lo = row_start[y - roi.y0], hi = row_start[y - roi.y0 + 1];
+    while (lo < hi)
+    {
+        int mid = (lo + hi)/2;
+        if (runs[mid].x0 <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > row_start[y - roi.y0] && x < runs[lo - 1].x1)
+        return lo - 1;
+    return -1;
+}
+
+int component_labeller::find_nearest_run(int x, int y, int radius) const
+{
+    int run = find_run(x, y);
+    if (run >= 0)
+        return run;
+
+    int best_distance = radius + 1;
+    int ymin = std::max(y - radius, roi.y0);
+    int ymax = std::min(y + radius + 1, roi.y1);
+    for (int ry = ymin; ry < ymax; ry++)
+    {
+        int dy = abs(ry - y);
+        if (dy >= best_distance)
+            continue;
+
+        for (int i = row_start[ry - roi.y0]; i < row_start[ry - roi.y0 + 1]; i++)
+        {
+            int dx = 0;
+            if (x < runs[i].x0)
+                dx = runs[i].x0 - x;
+            else if (x >= runs[i].x1)
+                dx = x - (runs[i].x1 - 1);
+
+            int distance = std::max(dx, dy);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                run = i;
+            }
+        }
+    }
+    return run;
+}
+
+image_roi isolate_blob(component_labeller &labeller, bit_mask &mask,
+                       int width, const image_roi &roi,
+                       int seed_x, int seed_y, int search_radius,
+                       bool *foreground, unsigned char *trimap,
+                       unsigned char *segmented, unsigned char *cmap,
+                       const unsigned char colors[3][3])
+{
+    image_roi relabelled = {0, 0, 0, 0};
+
+    labeller.label(mask, roi);
+    int seed = labeller.find_nearest_run(seed_x, seed_y, search_radius);
+    if (seed < 0)
+        return relabelled;
+    int blob = labeller.get_component(seed);
+
+    for (int i = 0; i < labeller.get_n_runs(); i++)
+    {
+        if (labeller.get_component(i) == blob)
+            continue;
+
+        const pixel_run &run = labeller.get_run(i);
+        int first = run.y*width + run.x0;
+        int n = run.x1 - run.x0;
+
+        memset(foreground + first, 0, n*sizeof(bool));
+        memset(trimap + first, TRIMAP_BG, n);
+        mask.clear_span(run.y, run.x0, run.x1);
+        if (segmented)
+            memset(segmented + 3*first, 0, 3*n);
+        if (cmap)
+        {
+            for (int k = 3*first; k < 3*(first + n); k += 3)
+            {
+                cmap[k] = colors[TRIMAP_BG][0];
+                cmap[k + 1] = colors[TRIMAP_BG][1];
+                cmap[k + 2] = colors[TRIMAP_BG][2];
+            }
+        }
+
+        image_roi box = {run.x0, run.y, run.x1, run.y + 1};
+        relabelled = roi_union(relabelled, box);
+    }
+
+    return relabelled;
+}
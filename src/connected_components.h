@@ -0,0 +1,90 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef CONNECTED_COMPONENTS_H
+#define CONNECTED_COMPONENTS_H
+
+#include <vector>
+
+#include "bitmask.h"
+#include "roi.h"
+
+// The rows of a strip the components are first labelled in on their own
+#define COMPONENT_STRIP_ROWS 32
+
+// A horizontal run of set pixels, x0 <= x < x1 of row y
+struct pixel_run
+{
+    int y, x0, x1;
+};
+
+/*
+ * The 8-connected components of the set pixels of a mask, as runs.
+ *
+ * Labelling takes two passes. The first one splits the rows in strips and,
+ * in parallel, finds the runs of each strip a word at a time and joins the
+ * runs that touch on consecutive rows with a union-find. The strips are
+ * then joined along their borders, and the second pass points each run
+ * at the first run of its component. The buffers are kept from call to
+ * call, so a labeller should be reused from frame to frame.
+ */
+class component_labeller
+{
+    public:
+        void label(const bit_mask &mask, const image_roi &roi);
+
+        int get_n_runs() const { return runs.size(); }
+        const pixel_run &get_run(int run) const { return runs[run]; }
+
+        // The component of a run, the index of its first run
+        int get_component(int run) const { return component[run]; }
+
+        // The run containing pixel (x, y), -1 if it is not set
+        int find_run(int x, int y) const;
+
+        // The run with the pixel nearest (x, y) that is at most radius
+        // pixels away in x and y, -1 if there is none
+        int find_nearest_run(int x, int y, int radius) const;
+
+    private:
+        image_roi roi;
+
+        std::vector<pixel_run> runs;
+
+        // The runs of row y are runs [row_start[y - roi.y0],
+        // row_start[y - roi.y0 + 1])
+        std::vector<int> row_start;
+
+        std::vector<int> parent, component;
+
+        // The runs and union-find of each strip, before they are joined
+        std::vector<std::vector<pixel_run> > strip_runs;
+        std::vector<std::vector<int> > strip_parent;
+};
+
+/*
+ * Keep the blob of a user: relabel as background the foreground pixels
+ * inside roi that are not 8-connected to the foreground pixel nearest the
+ * seed, at most search_radius pixels away from it. mask holds the pixels
+ * labelled foreground (TRIMAP_FG) in the trimap, as the labelling pass
+ * leaves it in the foreground plane of a trimap_planes.
+ *
+ * foreground, trimap and mask are updated, and if segmented and cmap are
+ * not NULL, the relabelled pixels are painted as background in them too.
+ * Returns the bounding box of the relabelled pixels, which is empty when
+ * there is no foreground near the seed.
+ */
+image_roi isolate_blob(component_labeller &labeller, bit_mask &mask,
+                       int width, const image_roi &roi,
+                       int seed_x, int seed_y, int search_radius,
+                       bool *foreground, unsigned char *trimap,
+                       unsigned char *segmented, unsigned char *cmap,
+                       const unsigned char colors[3][3]);
+
+#endif // CONNECTED_COMPONENTS_H
@@ -0,0 +1,475 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "depth_labelling.h"
+#include "mincut_segmentation.h"
+
+// The SSSE3 and AVX2 kernels are compiled for those on their own, and only
+// called when the processor has them, so the rest of the program still
+// runs without
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_KERNEL
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+// A depth limit as a signed short offset by 0x8000, so that depth < limit
+// is a signed comparison. For integer depths, depth < limit is depth <
+// ceil(limit).
+struct depth_limit
+{
+    short value;
+    bool above_all;         // every 16 bit depth is below the limit
+};
+
+static inline depth_limit make_depth_limit(double limit)
+{
+    limit = ceil(limit);
+
+    depth_limit l;
+    l.above_all = limit > 65535;
+    int limit16 = limit < 0 ? 0 : (l.above_all ? 65535 : (int)limit);
+    l.value = (short)(limit16 ^ 0x8000);
+    return l;
+}
+
+// What label_depth_band() reads and writes
+struct label_args
+{
+    const unsigned short *depth;
+    const unsigned char *rgb;
+    int width;
+    double near_depth, far_depth;
+    depth_limit near_limit, far_limit;
+    bool *foreground;
+    unsigned char *trimap;
+    trimap_planes *planes;              // NULL if not packing
+    unsigned char *segmented, *cmap;    // NULL if not painting
+    const unsigned char (*colors)[3];
+};
+
+static inline void paint_pixel(const unsigned char *rgb, unsigned char label,
+                               bool unknown, unsigned char *segmented,
+                               unsigned char *cmap,
+                               const unsigned char colors[3][3])
+{
+    for (int c = 0; c < 3; c++)
+    {
+        segmented[c] = label == TRIMAP_FG ? rgb[c] : 0;
+        cmap[c] = unknown ? colors[label][c]*3/4 : colors[label][c];
+    }
+}
+
+// Label the pixels x0 <= x < x1 of row y
+static void label_pixels_scalar(const label_args &a, int y, int x0, int x1)
+{
+    for (int x = x0; x < x1; x++)
+    {
+        int i = y*a.width + x;
+        a.foreground[i] = a.depth[i] >= a.near_depth &&
+                          a.depth[i] < a.far_depth;
+        a.trimap[i] = a.depth[i] == 0 ? TRIMAP_U : a.foreground[i];
+        if (a.planes)
+        {
+            a.planes->foreground.set(x, y, a.trimap[i] == TRIMAP_FG);
+            a.planes->unknown.set(x, y, a.depth[i] == 0);
+        }
+        if (a.segmented)
+            paint_pixel(a.rgb + 3*i, a.trimap[i], a.depth[i] == 0,
+                        a.segmented + 3*i, a.cmap + 3*i, a.colors);
+    }
+}
+
+// Set the n pixels of the planes from x on, given the movemasks of the
+// foreground and unknown ones
+static inline void put_plane_bits(const label_args &a, int x, int y,
+                                  uint32_t foreground, uint32_t unknown, int n)
+{
+    a.planes->foreground.put_bits(x, y, foreground, n);
+    a.planes->unknown.put_bits(x, y, unknown, n);
+}
+
+#ifdef __SSE2__
+
+// A mask of the 16 depths at depth that are 0
+static inline __m128i unknown_depth(const unsigned short *depth)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i d0 = _mm_loadu_si128((const __m128i *)depth);
+    __m128i d1 = _mm_loadu_si128((const __m128i *)(depth + 8));
+    return _mm_packs_epi16(_mm_cmpeq_epi16(d0, zero),
+                           _mm_cmpeq_epi16(d1, zero));
+}
+
+// A mask of the 16 depths at depth that are below limit
+static inline __m128i depth_below(const unsigned short *depth,
+                                  const depth_limit &limit)
+{
+    if (limit.above_all)
+        return _mm_set1_epi8(-1);
+
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i value = _mm_set1_epi16(limit.value);
+    __m128i d0 = _mm_loadu_si128((const __m128i *)depth);
+    __m128i d1 = _mm_loadu_si128((const __m128i *)(depth + 8));
+    return _mm_packs_epi16(
+            _mm_cmplt_epi16(_mm_xor_si128(d0, bias), value),
+            _mm_cmplt_epi16(_mm_xor_si128(d1, bias), value));
+}
+
+// Label the pixels x to x+15 of row y, returning their trimap labels and
+// setting unknown to a mask of the ones with unknown depth. Nothing is
+// below a near limit of 0, so label_depth_map() only pays for one more
+// compare.
+static inline __m128i label_16_pixels(const label_args &a, int y, int x,
+                                      __m128i *unknown)
+{
+    int i = y*a.width + x;
+    __m128i in_band = _mm_andnot_si128(depth_below(a.depth + i, a.near_limit),
+                                       depth_below(a.depth + i, a.far_limit));
+    __m128i fg = _mm_and_si128(in_band, _mm_set1_epi8(1));
+
+    *unknown = unknown_depth(a.depth + i);
+    __m128i label = _mm_or_si128(
+            _mm_andnot_si128(*unknown, fg),
+            _mm_and_si128(*unknown, _mm_set1_epi8(TRIMAP_U)));
+
+    _mm_storeu_si128((__m128i *)(a.foreground + i), fg);
+    _mm_storeu_si128((__m128i *)(a.trimap + i), label);
+    if (a.planes)
+        put_plane_bits(a, x, y,
+                       _mm_movemask_epi8(_mm_andnot_si128(*unknown, in_band)),
+                       _mm_movemask_epi8(*unknown), 16);
+    return label;
+}
+
+// Label 16 pixels at a time. Painting takes a byte shuffle, so it is left
+// to paint_pixel().
+static void label_roi_sse2(const label_args &a, int width,
+                           const image_roi &roi)
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int x = roi.x0;
+        for (; x + 16 <= roi.x1; x += 16)
+        {
+            __m128i unknown;
+            label_16_pixels(a, y, x, &unknown);
+            if (a.segmented)
+                for (int k = y*width + x; k < y*width + x + 16; k++)
+                    paint_pixel(a.rgb + 3*k, a.trimap[k], a.depth[k] == 0,
+                                a.segmented + 3*k, a.cmap + 3*k, a.colors);
+        }
+        label_pixels_scalar(a, y, x, roi.x1);
+    }
+}
+
+#endif // __SSE2__
+
+#ifdef HAVE_SSSE3_KERNEL
+
+// The 48 bytes of 16 rgb pixels are loaded as 3 vectors. For byte j of
+// vector v, pixel_of[v][j] is the pixel it belongs to, and channel_of[v][j]
+// its channel.
+static const unsigned char pixel_of[3][16] = {
+    { 0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5},
+    { 5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10},
+    {10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15}};
+static const unsigned char channel_of[3][16] = {
+    {0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0},
+    {1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1},
+    {2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2}};
+
+// The colors of the labels, colors[label][c] at byte 3*label + c, and the
+// same 3/4 as bright
+struct color_tables
+{
+    __m128i bright, dark;
+};
+
+static color_tables make_color_tables(const unsigned char colors[3][3])
+{
+    unsigned char bright[16] = {0}, dark[16] = {0};
+    for (int label = 0; label < 3; label++)
+        for (int c = 0; c < 3; c++)
+        {
+            bright[3*label + c] = colors[label][c];
+            dark[3*label + c] = colors[label][c]*3/4;
+        }
+
+    color_tables tables;
+    tables.bright = _mm_loadu_si128((const __m128i *)bright);
+    tables.dark = _mm_loadu_si128((const __m128i *)dark);
+    return tables;
+}
+
+// paint_pixel() for 16 pixels, given their trimap labels and a mask of the
+// ones with unknown depth
+__attribute__((target("ssse3")))
+static inline void paint_16_pixels(const unsigned char *rgb, __m128i label,
+                                   __m128i unknown, unsigned char *segmented,
+                                   unsigned char *cmap,
+                                   const color_tables &tables)
+{
+    __m128i keep = _mm_cmpeq_epi8(label, _mm_set1_epi8(TRIMAP_FG));
+
+    for (int v = 0; v < 3; v++)
+    {
+        __m128i spread = _mm_loadu_si128((const __m128i *)pixel_of[v]);
+        __m128i channel = _mm_loadu_si128((const __m128i *)channel_of[v]);
+
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(rgb + 16*v));
+        __m128i keep3 = _mm_shuffle_epi8(keep, spread);
+        _mm_storeu_si128((__m128i *)(segmented + 16*v),
+                         _mm_and_si128(pixels, keep3));
+
+        __m128i label3 = _mm_shuffle_epi8(label, spread);
+        __m128i index = _mm_add_epi8(_mm_add_epi8(label3, label3),
+                                     _mm_add_epi8(label3, channel));
+        __m128i unknown3 = _mm_shuffle_epi8(unknown, spread);
+        __m128i color = _mm_or_si128(
+                _mm_and_si128(unknown3, _mm_shuffle_epi8(tables.dark, index)),
+                _mm_andnot_si128(unknown3,
+                                 _mm_shuffle_epi8(tables.bright, index)));
+        _mm_storeu_si128((__m128i *)(cmap + 16*v), color);
+    }
+}
+
+// Label and paint 16 pixels at a time
+__attribute__((target("ssse3")))
+static void label_roi_ssse3(const label_args &a, int width,
+                            const image_roi &roi)
+{
+    color_tables tables;
+    if (a.segmented)
+        tables = make_color_tables(a.colors);
+
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int x = roi.x0;
+        for (; x + 16 <= roi.x1; x += 16)
+        {
+            int i = y*width + x;
+            __m128i unknown;
+            __m128i label = label_16_pixels(a, y, x, &unknown);
+            if (a.segmented)
+                paint_16_pixels(a.rgb + 3*i, label, unknown,
+                                a.segmented + 3*i, a.cmap + 3*i, tables);
+        }
+        label_pixels_scalar(a, y, x, roi.x1);
+    }
+}
+
+__attribute__((target("ssse3")))
+static void paint_roi_ssse3(const unsigned short *depth,
+                            const unsigned char *rgb,
+                            const unsigned char *trimap,
+                            int width, const image_roi &roi,
+                            unsigned char *segmented, unsigned char *cmap,
+                            const unsigned char colors[3][3])
+{
+    color_tables tables = make_color_tables(colors);
+
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int i = y*width + roi.x0, end = y*width + roi.x1;
+        for (; i + 16 <= end; i += 16)
+        {
+            __m128i label = _mm_loadu_si128((const __m128i *)(trimap + i));
+            paint_16_pixels(rgb + 3*i, label, unknown_depth(depth + i),
+                            segmented + 3*i, cmap + 3*i, tables);
+        }
+        for (; i < end; i++)
+            paint_pixel(rgb + 3*i, trimap[i], depth[i] == 0,
+                        segmented + 3*i, cmap + 3*i, colors);
+    }
+}
+
+#endif // HAVE_SSSE3_KERNEL
+
+#ifdef HAVE_AVX2_KERNEL
+
+// depth_below() for the 32 depths in d0 and d1. Packing works within the
+// 128 bit halves, so the mask has the 64 bit quarters in the order 0 2 1 3.
+__attribute__((target("avx2")))
+static inline __m256i depth_below_avx2(__m256i d0, __m256i d1,
+                                       const depth_limit &limit)
+{
+    if (limit.above_all)
+        return _mm256_set1_epi8(-1);
+
+    const __m256i bias = _mm256_set1_epi16((short)0x8000);
+    const __m256i value = _mm256_set1_epi16(limit.value);
+    return _mm256_packs_epi16(
+            _mm256_cmpgt_epi16(value, _mm256_xor_si256(d0, bias)),
+            _mm256_cmpgt_epi16(value, _mm256_xor_si256(d1, bias)));
+}
+
+// The same as label_roi_ssse3(), labelling 32 pixels at a time and
+// painting them as two halves of 16
+__attribute__((target("avx2")))
+static void label_roi_avx2(const label_args &a, int width,
+                           const image_roi &roi)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i undefined = _mm256_set1_epi8(TRIMAP_U);
+    color_tables tables;
+    if (a.segmented)
+        tables = make_color_tables(a.colors);
+
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int x = roi.x0;
+        for (; x + 32 <= roi.x1; x += 32)
+        {
+            int i = y*width + x;
+            __m256i d0 = _mm256_loadu_si256((const __m256i *)(a.depth + i));
+            __m256i d1 = _mm256_loadu_si256(
+                    (const __m256i *)(a.depth + i + 16));
+
+            __m256i in_band = _mm256_andnot_si256(
+                    depth_below_avx2(d0, d1, a.near_limit),
+                    depth_below_avx2(d0, d1, a.far_limit));
+            __m256i fg = _mm256_and_si256(in_band, one);
+            __m256i unknown = _mm256_packs_epi16(
+                    _mm256_cmpeq_epi16(d0, zero), _mm256_cmpeq_epi16(d1, zero));
+            __m256i label = _mm256_or_si256(
+                    _mm256_andnot_si256(unknown, fg),
+                    _mm256_and_si256(unknown, undefined));
+
+            // Back in pixel order
+            fg = _mm256_permute4x64_epi64(fg, 0xd8);
+            label = _mm256_permute4x64_epi64(label, 0xd8);
+            unknown = _mm256_permute4x64_epi64(unknown, 0xd8);
+
+            _mm256_storeu_si256((__m256i *)(a.foreground + i), fg);
+            _mm256_storeu_si256((__m256i *)(a.trimap + i), label);
+            if (a.planes)
+            {
+                in_band = _mm256_permute4x64_epi64(in_band, 0xd8);
+                put_plane_bits(a, x, y,
+                        (uint32_t)_mm256_movemask_epi8(
+                                _mm256_andnot_si256(unknown, in_band)),
+                        (uint32_t)_mm256_movemask_epi8(unknown), 32);
+            }
+
+            if (a.segmented)
+            {
+                paint_16_pixels(a.rgb + 3*i, _mm256_castsi256_si128(label),
+                                _mm256_castsi256_si128(unknown),
+                                a.segmented + 3*i, a.cmap + 3*i, tables);
+                paint_16_pixels(a.rgb + 3*(i + 16),
+                                _mm256_extracti128_si256(label, 1),
+                                _mm256_extracti128_si256(unknown, 1),
+                                a.segmented + 3*(i + 16), a.cmap + 3*(i + 16),
+                                tables);
+            }
+        }
+        if (x + 16 <= roi.x1)
+        {
+            int i = y*width + x;
+            __m128i unknown;
+            __m128i label = label_16_pixels(a, y, x, &unknown);
+            if (a.segmented)
+                paint_16_pixels(a.rgb + 3*i, label, unknown,
+                                a.segmented + 3*i, a.cmap + 3*i, tables);
+            x += 16;
+        }
+        label_pixels_scalar(a, y, x, roi.x1);
+    }
+}
+
+#endif // HAVE_AVX2_KERNEL
+
+void label_depth_map(const unsigned short *depth, const unsigned char *rgb,
+                     int width, const image_roi &roi, double threshold,
+                     bool *foreground, unsigned char *trimap,
+                     unsigned char *segmented, unsigned char *cmap,
+                     const unsigned char colors[3][3], trimap_planes *planes)
+{
+    label_depth_band(depth, rgb, width, roi, 0, threshold, foreground, trimap,
+                     segmented, cmap, colors, planes);
+}
+
+void label_depth_band(const unsigned short *depth, const unsigned char *rgb,
+                      int width, const image_roi &roi,
+                      double near_depth, double far_depth,
+                      bool *foreground, unsigned char *trimap,
+                      unsigned char *segmented, unsigned char *cmap,
+                      const unsigned char colors[3][3], trimap_planes *planes)
+{
+    bool paint = segmented && cmap;
+
+    label_args a;
+    a.depth = depth;
+    a.rgb = rgb;
+    a.width = width;
+    a.near_depth = near_depth;
+    a.far_depth = far_depth;
+    a.near_limit = make_depth_limit(near_depth);
+    a.far_limit = make_depth_limit(far_depth);
+    a.foreground = foreground;
+    a.trimap = trimap;
+    a.planes = planes;
+    a.segmented = paint ? segmented : 0;
+    a.cmap = paint ? cmap : 0;
+    a.colors = colors;
+
+#ifdef HAVE_AVX2_KERNEL
+    if (__builtin_cpu_supports("avx2"))
+    {
+        label_roi_avx2(a, width, roi);
+        return;
+    }
+#endif
+#ifdef HAVE_SSSE3_KERNEL
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        label_roi_ssse3(a, width, roi);
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    label_roi_sse2(a, width, roi);
+#else
+    for (int y = roi.y0; y < roi.y1; y++)
+        label_pixels_scalar(a, y, roi.x0, roi.x1);
+#endif
+}
+
+void paint_segmentation(const unsigned short *depth, const unsigned char *rgb,
+                        const unsigned char *trimap,
+                        int width, const image_roi &roi,
+                        unsigned char *segmented, unsigned char *cmap,
+                        const unsigned char colors[3][3])
+{
+#ifdef HAVE_SSSE3_KERNEL
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        paint_roi_ssse3(depth, rgb, trimap, width, roi, segmented, cmap,
+                        colors);
+        return;
+    }
+#endif
+
+    for (int y = roi.y0; y < roi.y1; y++)
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            int i = y*width + x;
+            paint_pixel(rgb + 3*i, trimap[i], depth[i] == 0,
+                        segmented + 3*i, cmap + 3*i, colors);
+        }
+}
@@ -0,0 +1,60 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef DEPTH_LABELLING_H
+#define DEPTH_LABELLING_H
+
+#include "bitmask.h"
+#include "roi.h"
+
+/*
+ * Threshold the depth of the pixels inside roi and build the trimap from
+ * the result, reading each pixel once:
+ *
+ *     foreground[i] = depth[i] < threshold
+ *     trimap[i] = depth[i] == 0 ? TRIMAP_U : foreground[i]
+ *
+ * If segmented and cmap are not NULL, the segmented image and the color
+ * coded segmentation are painted in the same pass, as paint_segmentation()
+ * would from the trimap. If planes is not NULL, the pixels inside roi of
+ * its foreground and unknown planes are set from the compare masks too,
+ * as trimap_planes::pack() would from the trimap.
+ */
+void label_depth_map(const unsigned short *depth, const unsigned char *rgb,
+                     int width, const image_roi &roi, double threshold,
+                     bool *foreground, unsigned char *trimap,
+                     unsigned char *segmented, unsigned char *cmap,
+                     const unsigned char colors[3][3],
+                     trimap_planes *planes = 0);
+
+/*
+ * label_depth_map() for a band of depths: the foreground is the pixels
+ * with near_depth <= depth[i] < far_depth.
+ */
+void label_depth_band(const unsigned short *depth, const unsigned char *rgb,
+                      int width, const image_roi &roi,
+                      double near_depth, double far_depth,
+                      bool *foreground, unsigned char *trimap,
+                      unsigned char *segmented, unsigned char *cmap,
+                      const unsigned char colors[3][3],
+                      trimap_planes *planes = 0);
+
+/*
+ * Paint the pixels inside roi of the segmented image, the rgb pixels of
+ * the foreground with the rest in black, and of the color coded
+ * segmentation, colors[trimap[i]], 3/4 as bright where the depth is
+ * unknown.
+ */
+void paint_segmentation(const unsigned short *depth, const unsigned char *rgb,
+                        const unsigned char *trimap,
+                        int width, const image_roi &roi,
+                        unsigned char *segmented, unsigned char *cmap,
+                        const unsigned char colors[3][3]);
+
+#endif // DEPTH_LABELLING_H
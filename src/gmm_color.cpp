@@ -15,6 +15,7 @@
 #include <math.h>
 #include "kmeans_color.h"
 #include "gmm_color.h"
+#include "pixel_partition.h"
 #include <opencv2/core/core.hpp>
 
 using namespace std;
@@ -32,6 +33,32 @@ void gmm_color(unsigned char *rgbImage, int npts,
                std::vector<double> &det_cov,			// determinants of covariance matrice
                unsigned char *cluster,
                unsigned char *trimap, unsigned char label)
+{
+	gmm_color(rgbImage, npts, linear_roi(npts), mean, cov, pi, inv_cov,
+	          det_cov, cluster, trimap, label);
+}
+
+void gmm_color(unsigned char *rgbImage, int width, const image_roi &roi,
+               std::vector<cv::Vec3d> &mean,
+               std::vector<cv::Matx33d> &cov,
+               std::vector<double> &pi,
+               std::vector<cv::Matx33d> &inv_cov,
+               std::vector<double> &det_cov,
+               unsigned char *cluster,
+               unsigned char *trimap, unsigned char label)
+{
+	pixel_partition pixels;
+	pixels.build(trimap, rgbImage, width, roi);
+	gmm_color(pixels, label, mean, cov, pi, inv_cov, det_cov, cluster);
+}
+
+void gmm_color(const pixel_partition &pixels, unsigned char label,
+               std::vector<cv::Vec3d> &mean,
+               std::vector<cv::Matx33d> &cov,
+               std::vector<double> &pi,
+               std::vector<cv::Matx33d> &inv_cov,
+               std::vector<double> &det_cov,
+               const unsigned char *cluster)
 {
     // !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
     //std::cout << "Warning: gmm_color not implemented!\n";
@@ -72,7 +99,7 @@ void gmm_color(unsigned char *rgbImage, int npts,
 /*
 	// pi
 	double total_count = 0;
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(trimap[i] == label){
 			total_count++;
 			pi[cluster[i]]++;
@@ -85,24 +112,28 @@ void gmm_color(unsigned char *rgbImage, int npts,
 	}
 */
 		
-	// pi & covariance
+	// pi & covariance, over the pixels of the label only
+	int npixels = pixels.size(label);
+	const int *index = pixels.indices(label);
+	const unsigned char *rgb[3] = {pixels.channel(label, 0),
+	                               pixels.channel(label, 1),
+	                               pixels.channel(label, 2)};
 	double total_count = 0;
 	double dist[3];
-	for(int i=0; i<npts; i++){
-		if(trimap[i] == label){
-			
-			// pi
-			total_count++;
-			pi[cluster[i]]++;
+	for(int i=0; i<npixels; i++){
+		int k = cluster[index[i]];
 
-			// covariance
-			count[cluster[i]]++;
-			for(int j=0; j<3; j++)
-				dist[j]= (double)rgbImage[i*3+j] - mean[cluster[i]][j];
-			for(int m=0; m<3; m++)
-				for(int n=0; n<3; n++)
-					sum[cluster[i]][m][n] += dist[m]*dist[n];
-		}
+		// pi
+		total_count++;
+		pi[k]++;
+
+		// covariance
+		count[k]++;
+		for(int j=0; j<3; j++)
+			dist[j]= (double)rgb[j][i] - mean[k][j];
+		for(int m=0; m<3; m++)
+			for(int n=0; n<3; n++)
+				sum[k][m][n] += dist[m]*dist[n];
 	}
 	
 	if(total_count == 0)
@@ -12,6 +12,9 @@
 
 #include <opencv2/core/core.hpp>
 
+#include "pixel_partition.h"
+#include "roi.h"
+
 /*
  * Model the color distribution of the foreground/background region with a
  * GMM.
@@ -38,4 +41,23 @@ void gmm_color(unsigned char *rgbImage, int npts,
                unsigned char *cluster,
                unsigned char *trimap, unsigned char label);
 
+// The same, only for the pixels inside roi of an image with the given width
+void gmm_color(unsigned char *rgbImage, int width, const image_roi &roi,
+               std::vector<cv::Vec3d> &mean,
+               std::vector<cv::Matx33d> &cov,
+               std::vector<double> &pi,
+               std::vector<cv::Matx33d> &inv_cov,
+               std::vector<double> &det_cov,
+               unsigned char *cluster,
+               unsigned char *trimap, unsigned char label);
+
+// The same, for the pixels of a partition with the given label
+void gmm_color(const pixel_partition &pixels, unsigned char label,
+               std::vector<cv::Vec3d> &mean,
+               std::vector<cv::Matx33d> &cov,
+               std::vector<double> &pi,
+               std::vector<cv::Matx33d> &inv_cov,
+               std::vector<double> &det_cov,
+               const unsigned char *cluster);
+
 #endif // GMM_COLOR_H
@@ -32,20 +32,58 @@ double gaussian(double x, double mu, double sigma)
 	// f(n) = (a * e)*exp(-(x-b)/(c))
 }
 
-void cal_sigma(unsigned short *depthimage,
+// The depth past mu1 where the foreground gaussian stops being the more
+// likely one, found by solving N(t;mu1,sigma1) = N(t;mu2,sigma2), a
+// quadratic in t once the logarithm of both sides is taken
+static double gaussian_boundary(double mu1, double sigma1,
+                                double mu2, double sigma2)
+{
+	// log N1(t) - log N2(t) = a*t^2 + b*t + c
+	double v1 = sigma1*sigma1, v2 = sigma2*sigma2;
+	double a = 1/(2*v2) - 1/(2*v1);
+	double b = mu1/v1 - mu2/v2;
+	double c = mu2*mu2/(2*v2) - mu1*mu1/(2*v1) + log(sigma2/sigma1);
+
+	if(a*mu1*mu1 + b*mu1 + c <= 0)
+		return mu1;
+
+	double t = mu2;
+	if(fabs(a) < 1e-12){
+		if(b != 0)
+			t = -c/b;
+	}
+	else{
+		double disc = b*b - 4*a*c;
+		if(disc >= 0){
+			// The smallest root past mu1. Without one the foreground
+			// gaussian is wider and stays on top, so split at mu2.
+			double r1 = (-b - sqrt(disc))/(2*a);
+			double r2 = (-b + sqrt(disc))/(2*a);
+			if(r1 > r2)
+				swap(r1, r2);
+			if(r1 > mu1)
+				t = r1;
+			else if(r2 > mu1)
+				t = r2;
+		}
+	}
+	return t;
+}
+
+void cal_sigma(const unsigned short *depthimage,
 				bool *foreground,
 				double *mu_f,	
 				double *mu_b,
 				double *sigma_f,
 				double *sigma_b,
-				int npts)
+				int width, const image_roi &roi)
 {
 	double count_f, count_b;
 	count_f = count_b = 0;
 	double sum_f, sum_b;
 	sum_f = sum_b = 0;
 
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimage[i] !=0){
 			if(foreground[i]){
 				count_f++;
@@ -68,13 +106,26 @@ void cal_sigma(unsigned short *depthimage,
 		*sigma_b = 0.1;
 }		
 				
-float gaussian_mixture_segmentation(unsigned short *depthimage,
+float gaussian_mixture_segmentation(const unsigned short *depthimage,
                                     int npts,
                                     float *gamma,
                                     bool *foreground,
                                     double *mu1, double *sigma1,
                                     double *mu2, double *sigma2,
                                     double *p)
+{
+	return gaussian_mixture_segmentation(depthimage, npts, linear_roi(npts),
+	                                     gamma, foreground,
+	                                     mu1, sigma1, mu2, sigma2, p);
+}
+
+float gaussian_mixture_segmentation(const unsigned short *depthimage,
+                                    int width, const image_roi &roi,
+                                    float *gamma,
+                                    bool *foreground,
+                                    double *mu1, double *sigma1,
+                                    double *mu2, double *sigma2,
+                                    double *p)
 {
     // !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
 
@@ -95,19 +146,19 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
 	is_changed = true;
 	pro_1 = pro_2 = 0.0;
 	
-	for(int i=0; i<npts; i++){
-		gamma[i] = 0.5;
+	for(roi_iterator i(roi, width); !i.done(); ++i){
+		gamma[2*i] = gamma[2*i+1] = 0.5;
 	}
 
 	// Search Minimum, Maximum in depthimage.
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimage[i] != 0){
 			min = max = depthimage[i];
 			break;
 		}
 	}
 
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimage[i] != 0){
 			if(depthimage[i] <= min)
 				min = depthimage[i];
@@ -119,7 +170,7 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
 	medium = (min + max) / 2;
 	
 	// Initialize group1 and group2
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimage[i] == 0)
 			continue;
 		else if(depthimage[i] < medium){
@@ -143,29 +194,29 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
 	pro_2 = count_b / (count_f + count_b);
 	
 	// standard deviation of each group
-	cal_sigma(depthimage, foreground, mu1, mu2, sigma1, sigma2, npts);
+	cal_sigma(depthimage, foreground, mu1, mu2, sigma1, sigma2, width, roi);
 
 	// loop until the 
 	while(is_changed){
 		// E-Step
 		double sum_gaussians = 0.0, gaussian_f, gaussian_b;
-		for(int i=0; i<npts; i++){
+		for(roi_iterator i(roi, width); !i.done(); ++i){
 			if(depthimage[i] != 0){
 				gaussian_f = gaussian(depthimage[i],*mu1,*sigma1) * pro_1;
 				gaussian_b = gaussian(depthimage[i],*mu2,*sigma2) * pro_2;
 				sum_gaussians = gaussian_f + gaussian_b;
-				gamma[1*npts + i] = gaussian_f / sum_gaussians;
-				gamma[0*npts + i] = gaussian_b / sum_gaussians;
+				gamma[2*i+1] = gaussian_f / sum_gaussians;
+				gamma[2*i+0] = gaussian_b / sum_gaussians;
 			}
 		}
 
 		// M-Step
 		for(int i=0; i<2; i++){
 			double sum_1 =0.0, sum_2 = 0.0;
-			for(int j=0; j<npts; j++){
+			for(roi_iterator j(roi, width); !j.done(); ++j){
 				if(depthimage[j] != 0){
-					sum_1 += gamma[i*npts+j] * depthimage[j];
-					sum_2 += gamma[i*npts+j];	
+					sum_1 += gamma[2*j+i] * depthimage[j];
+					sum_2 += gamma[2*j+i];	
 				}
 			}
 			if(i==1)
@@ -183,11 +234,11 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
 		}
 
 		// calcurate sigma
-		cal_sigma(depthimage, foreground, mu1, mu2, sigma1, sigma2, npts);
+		cal_sigma(depthimage, foreground, mu1, mu2, sigma1, sigma2, width, roi);
 
 		count_b = count_f = 0;
 		// re-devide foreground / background
-		for(int i=0; i<npts; i++){
+		for(roi_iterator i(roi, width); !i.done(); ++i){
 			if(depthimage[i] != 0){
 				if(depthimage[i] < *mu1){
 					foreground[i] = true;
@@ -217,13 +268,208 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
 		} 				
 	}
 	
-	double threshold = *mu1;
-
-	while(gaussian(threshold,*mu1,*sigma1) > gaussian(threshold,*mu2,*sigma2))
-		threshold += 0.01;
+	double threshold = gaussian_boundary(*mu1, *sigma1, *mu2, *sigma2);
 
 	*p = pro_1;
 
     return threshold; 
 }
 
+// cal_sigma() on the bins [first, last] of a depth histogram
+static void cal_sigma(const histogram &hist, int first, int last,
+                      const vector<bool> &foreground,
+                      double mu_f, double mu_b,
+                      double *sigma_f, double *sigma_b)
+{
+	double depth0 = hist.get_min(), binsize = hist.get_bin_size();
+	double count_f = 0, count_b = 0;
+	double sum_f = 0, sum_b = 0;
+
+	for(int b = first; b <= last; b++){
+		double depth = depth0 + b*binsize;
+		if(foreground[b]){
+			count_f += hist[b];
+			sum_f += hist[b]*(mu_f - depth)*(mu_f - depth);
+		}else{
+			count_b += hist[b];
+			sum_b += hist[b]*(mu_b - depth)*(mu_b - depth);
+		}
+	}
+
+	// The depths are only known to a bin, so a side that falls in a single
+	// bin still has the spread of a uniform depth across it
+	double min_sigma = binsize/sqrt(12.0);
+	*sigma_f = count_f != 0 ? max(sqrt(sum_f/count_f), min_sigma) : 0.1;
+	*sigma_b = count_b != 0 ? max(sqrt(sum_b/count_b), min_sigma) : 0.1;
+}
+
+// The threshold of the model passed in, for when the histogram can't be
+// split in two: that of the last frame if the model is valid, else 0
+static float previous_boundary(const double *mu1, const double *sigma1,
+                               const double *mu2, const double *sigma2)
+{
+	if(mu1 && sigma1 && mu2 && sigma2 &&
+	   *mu1 < *mu2 && *sigma1 > 0 && *sigma2 > 0)
+		return gaussian_boundary(*mu1, *sigma1, *mu2, *sigma2);
+	return 0.0;
+}
+
+// Label the bins [first, last] of a depth histogram with the gaussian
+// they are closer to, and count the pixels on each side
+static void divide_bins(const histogram &hist, int first, int last,
+                        double mu1, double sigma1, double mu2, double sigma2,
+                        vector<bool> &foreground,
+                        double *count_f, double *count_b)
+{
+	double depth0 = hist.get_min(), binsize = hist.get_bin_size();
+
+	*count_f = *count_b = 0;
+	for(int b = first; b <= last; b++){
+		double depth = depth0 + b*binsize;
+		if(depth < mu1)
+			foreground[b] = true;
+		else if(depth > mu2)
+			foreground[b] = false;
+		else
+			foreground[b] = gaussian(depth, mu1, sigma1) > gaussian(depth, mu2, sigma2);
+
+		if(foreground[b])
+			*count_f += hist[b];
+		else
+			*count_b += hist[b];
+	}
+}
+
+float gaussian_mixture_segmentation(const histogram &hist,
+                                    double *mu1, double *sigma1,
+                                    double *mu2, double *sigma2,
+                                    double *p, cluster_control *control)
+{
+	int nbins = hist.get_n_bins();
+	double depth0 = hist.get_min(), binsize = hist.get_bin_size();
+
+	int first = 0, last = nbins - 1;
+	while(first < nbins && hist[first] == 0)
+		first++;
+	while(last > first && hist[last] == 0)
+		last--;
+
+	// A single depth has no two sides. Neither has a split that leaves a
+	// side empty, which EM would turn into NaNs that never converge.
+	if(first == nbins || first == last)
+		return previous_boundary(mu1, sigma1, mu2, sigma2);
+
+	// The same steps as the pixel version, with every sum over the pixels
+	// turned into a sum over the bins weighted by their counts. The pixels
+	// in a bin all have the same depth, so they all get the same label.
+	vector<bool> foreground(nbins);
+	double m1, s1, m2, s2;
+	double pre_mu1 = mu1 ? *mu1 : 0, pre_mu2 = mu2 ? *mu2 : 0;
+	double count_f = 0, count_b = 0, sum_f = 0, sum_b = 0;
+	double pro_1, pro_2;
+
+	bool warm = control && control->warm_start &&
+	            mu1 && sigma1 && mu2 && sigma2 && p && *mu1 < *mu2 &&
+	            *sigma1 > 0 && *sigma2 > 0 && *p > 0 && *p < 1;
+	if(warm){
+		// Start from the model of the last frame, unless the depths moved
+		// so far it leaves a side empty
+		m1 = *mu1;
+		s1 = *sigma1;
+		m2 = *mu2;
+		s2 = *sigma2;
+		pro_1 = *p;
+		pro_2 = 1 - *p;
+		divide_bins(hist, first, last, m1, s1, m2, s2, foreground,
+		            &count_f, &count_b);
+		warm = count_f != 0 && count_b != 0;
+	}
+	if(!warm){
+		count_f = count_b = 0;
+		// Initialize group1 and group2
+		int min = (int)(depth0 + first*binsize), max = (int)(depth0 + last*binsize);
+		unsigned short medium = (min + max) / 2;
+		for(int b = first; b <= last; b++){
+			double depth = depth0 + b*binsize;
+			foreground[b] = depth < medium;
+			if(foreground[b]){
+				sum_f += hist[b]*depth;
+				count_f += hist[b];
+			}
+			else{
+				sum_b += hist[b]*depth;
+				count_b += hist[b];
+			}
+		}
+		if(count_f == 0 || count_b == 0)
+			return previous_boundary(mu1, sigma1, mu2, sigma2);
+
+		m1 = sum_f / count_f;
+		m2 = sum_b / count_b;
+		pro_1 = count_f / (count_f + count_b);
+		pro_2 = count_b / (count_f + count_b);
+
+		cal_sigma(hist, first, last, foreground, m1, m2, &s1, &s2);
+	}
+
+	bool converged;
+	cluster_control_start(control);
+	do{
+		// E and M steps
+		double sum_1f = 0, sum_2f = 0, sum_1b = 0, sum_2b = 0;
+		for(int b = first; b <= last; b++){
+			if(hist[b] == 0)
+				continue;
+			double depth = depth0 + b*binsize;
+			double gaussian_f = gaussian(depth, m1, s1) * pro_1;
+			double gaussian_b = gaussian(depth, m2, s2) * pro_2;
+			double gamma_f, gamma_b;
+			if(gaussian_f + gaussian_b > 0){
+				gamma_f = gaussian_f / (gaussian_f + gaussian_b);
+				gamma_b = gaussian_b / (gaussian_f + gaussian_b);
+			}
+			else{
+				// Far out on both tails, go with the side of the bin
+				gamma_f = foreground[b] ? 1 : 0;
+				gamma_b = 1 - gamma_f;
+			}
+			sum_1f += hist[b]*gamma_f*depth;
+			sum_2f += hist[b]*gamma_f;
+			sum_1b += hist[b]*gamma_b*depth;
+			sum_2b += hist[b]*gamma_b;
+		}
+		if(sum_2f == 0 || sum_2b == 0)
+			return previous_boundary(mu1, sigma1, mu2, sigma2);
+		m1 = sum_1f/sum_2f;
+		m2 = sum_1b/sum_2b;
+		if(m1 > m2)
+			swap(m1, m2);
+
+		cal_sigma(hist, first, last, foreground, m1, m2, &s1, &s2);
+
+		// re-devide foreground / background
+		divide_bins(hist, first, last, m1, s1, m2, s2, foreground,
+		            &count_f, &count_b);
+		if(count_f == 0 || count_b == 0)
+			return previous_boundary(mu1, sigma1, mu2, sigma2);
+		pro_1 = count_f / (count_f + count_b);
+		pro_2 = count_b / (count_f + count_b);
+
+		converged = pow(pre_mu1 - m1, 2) + pow(pre_mu2 - m2, 2) < 0.1;
+		pre_mu1 = m1;
+		pre_mu2 = m2;
+	}while(cluster_control_next(control, converged));
+
+	if(mu1)
+		*mu1 = m1;
+	if(sigma1)
+		*sigma1 = s1;
+	if(mu2)
+		*mu2 = m2;
+	if(sigma2)
+		*sigma2 = s2;
+	if(p)
+		*p = pro_1;
+
+	return gaussian_boundary(m1, s1, m2, s2);
+}
@@ -10,6 +10,10 @@
 #ifndef GAUSSIAN_MIXTURE_SEGMENTATION_H
 #define GAUSSIAN_MIXTURE_SEGMENTATION_H
 
+#include "cluster_control.h"
+#include "histogram.h"
+#include "roi.h"
+
 // Evaluates a gaussian distribution at point x with mean mu and standard
 // deviation sigma.
 double gaussian(double x, double mu, double sigma);
@@ -25,7 +29,7 @@ double gaussian(double x, double mu, double sigma);
  * Parameters:
  *
  *     - gamma:
- *           Pre-allocated array with the same size as depthimage (npts).
+ *           Pre-allocated array with twice the size of depthimage (2*npts).
  *           Used to store the responsibilites during the EM 'E' step.
  *     - foreground: Set to true for pixels on the foreground.
  *     - mu1, sigma1, mu2, sigma2:
@@ -33,7 +37,7 @@ double gaussian(double x, double mu, double sigma);
  *           deviation.
  *     - p: If not NULL, is set to the mixing coefficient.
  */ 
-float gaussian_mixture_segmentation(unsigned short *depthimage,
+float gaussian_mixture_segmentation(const unsigned short *depthimage,
                                     int npts,
                                     float *gamma,
                                     bool *foreground,
@@ -41,4 +45,30 @@ float gaussian_mixture_segmentation(unsigned short *depthimage,
                                     double *mu2 = 0, double *sigma2 = 0,
                                     double *p = 0);
 
+// The same, only for the pixels inside roi of a depth map with the given
+// width. gamma and foreground are not modified outside roi.
+float gaussian_mixture_segmentation(const unsigned short *depthimage,
+                                    int width, const image_roi &roi,
+                                    float *gamma,
+                                    bool *foreground,
+                                    double *mu1 = 0, double *sigma1 = 0,
+                                    double *mu2 = 0, double *sigma2 = 0,
+                                    double *p = 0);
+
+// The same, run on the depth histogram of the pixels instead of on the
+// pixels themselves, so each EM iteration only goes over the bins and no
+// responsibilities are stored. The depth of the pixels in a bin is taken
+// to be the start of the bin. The pixels are left for the caller to
+// threshold.
+//
+// If control is not NULL and asks for a warm start, valid parameters passed
+// in mu1, sigma1, mu2, sigma2 and p are used as the initial model instead
+// of splitting the depth range in half. The EM iterations are bounded by
+// the budget of control, and reported back in it.
+float gaussian_mixture_segmentation(const histogram &hist,
+                                    double *mu1 = 0, double *sigma1 = 0,
+                                    double *mu2 = 0, double *sigma2 = 0,
+                                    double *p = 0,
+                                    cluster_control *control = 0);
+
 #endif // GAUSSIAN_MIXTURE_SEGMENTATION_H
@@ -1,5 +1,5 @@
 /****************************************************************************
-* 
+*
 *  Computer Vision, Fall 2011
 *  New York University
 *
@@ -7,18 +7,112 @@
 *
 ****************************************************************************/
 
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "histogram.h"
 
-void compute_histogram(unsigned short *depthimage,
-                       int npts,
-                       histogram &hist,
-                       bool normalize)
+histogram::histogram(double min_value, double max_value, int nbins)
+    : hist(nbins), total(0), min_value(min_value), max_value(max_value),
+      sub(HISTOGRAM_SUB_HISTOGRAMS*(nbins + 1))
 {
-    hist.clear();
+    binsize = (max_value - min_value)/nbins;
+
+    offset = min_value;
+    scale = 1.0f/binsize;
+    if (scale < 1.0/binsize)
+        scale = nextafterf(scale, INFINITY);
+}
+
+void histogram::insert_image(const unsigned short *image, int width,
+                             const image_roi &roi)
+{
+    int nbins = hist.size();
+    uint32_t *s0 = &sub[0];
+    uint32_t *s1 = s0 + (nbins + 1);
+    uint32_t *s2 = s1 + (nbins + 1);
+    uint32_t *s3 = s2 + (nbins + 1);
+    memset(s0, 0, sub.size()*sizeof(uint32_t));
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i unknown = _mm_set1_epi32(nbins);
+    const __m128 voffset = _mm_set1_ps(offset);
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vlast = _mm_set1_ps(nbins - 1);
+    int bin[8];
+#endif
+
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        const unsigned short *p = image + y*width + roi.x0;
+        int n = roi.width();
+        int k = 0;
 
-    for (int i = 0; i < npts; i++)
-        hist.insert_point(depthimage[i]);
+#ifdef __SSE2__
+        // Compute the bins of 8 pixels at a time, with the pixels of
+        // unknown depth sent to the extra bin
+        for (; k + 8 <= n; k += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + k));
+            __m128i v32[2] = {_mm_unpacklo_epi16(v, zero),
+                              _mm_unpackhi_epi16(v, zero)};
 
-    if (normalize)
-        hist.normalize();
+            for (int h = 0; h < 2; h++)
+            {
+                __m128 f = _mm_cvtepi32_ps(v32[h]);
+                f = _mm_mul_ps(_mm_sub_ps(f, voffset), vscale);
+                f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), vlast);
+                __m128i b = _mm_cvttps_epi32(f);
+                __m128i is_unknown = _mm_cmpeq_epi32(v32[h], zero);
+                b = _mm_or_si128(_mm_andnot_si128(is_unknown, b),
+                                 _mm_and_si128(is_unknown, unknown));
+                _mm_storeu_si128((__m128i *)(bin + 4*h), b);
+            }
+
+            s0[bin[0]]++;
+            s1[bin[1]]++;
+            s2[bin[2]]++;
+            s3[bin[3]]++;
+            s0[bin[4]]++;
+            s1[bin[5]]++;
+            s2[bin[6]]++;
+            s3[bin[7]]++;
+        }
+#endif
+
+        for (; k < n; k++)
+        {
+            if (p[k] == 0)
+                continue;
+            sub[(k & 3)*(nbins + 1) + get_bin(p[k])]++;
+        }
+    }
+
+    // Merge the sub-histograms, leaving out the unknown depth bins
+    for (int i = 0; i < nbins; i++)
+    {
+        uint32_t count = s0[i] + s1[i] + s2[i] + s3[i];
+        hist[i] += count;
+        total += count;
+    }
+}
+
+void compute_histogram(const unsigned short *depthimage,
+                       int npts,
+                       histogram &hist)
+{
+    compute_histogram(depthimage, npts, linear_roi(npts), hist);
+}
+
+void compute_histogram(const unsigned short *depthimage,
+                       int width, const image_roi &roi,
+                       histogram &hist)
+{
+    hist.clear();
+    hist.insert_image(depthimage, width, roi);
 }
@@ -1,5 +1,5 @@
 /****************************************************************************
-* 
+*
 *  Computer Vision, Fall 2011
 *  New York University
 *
@@ -12,20 +12,39 @@
 
 #include <assert.h>
 #include <iostream>
+#include <stdint.h>
 #include <stdio.h>
 #include <vector>
 
+#include "roi.h"
+
+// The number of sub-histograms consecutive values are counted into, so
+// that runs of equal values don't wait on each other's increments.
+// histogram::insert_image() is unrolled for 4.
+#define HISTOGRAM_SUB_HISTOGRAMS 4
+
+// The largest depth the kinect reports, in millimeters. A histogram of
+// MAX_DEPTH + 1 bins of size 1 between 0 and MAX_DEPTH + 1 has a bin for
+// every depth value.
+#define MAX_DEPTH 10000
+
+/*
+ * A histogram counting values into nbins bins of equal size between
+ * min_value and max_value.
+ *
+ * Values outside the range are counted in the first or last bin. With
+ * bins of size 1 (e.g. histogram(0, 10000, 10000) for a depth map in
+ * millimeters) every integer value has its own bin, which gives the depth
+ * thresholding methods the full resolution of the depth map.
+ */
 class histogram
 {
     public:
         histogram(double min_value, double max_value, int nbins);
 
-        // Returns the value of a histogram bin
-        const double &operator()(unsigned int bin) const;
-        double &operator()(unsigned int bin);
-
-        const double & operator[](unsigned int bin) const;
-        double & operator[](unsigned int bin);
+        // Returns the count of a histogram bin
+        uint32_t operator()(unsigned int bin) const { return hist[bin]; }
+        uint32_t operator[](unsigned int bin) const { return hist[bin]; }
 
         void get_range(double *minv, double *maxv) const
         {
@@ -40,108 +59,90 @@ class histogram
 
         double get_bin_size() const { return binsize; }
 
+        // The bin v falls into
+        unsigned int get_bin(double v) const;
+
+        // The value at the center of a bin
+        double get_bin_center(unsigned int bin) const
+        {
+            return min_value + (bin + 0.5)*binsize;
+        }
+
+        // The number of values counted, and the fraction of them that fell
+        // into a bin
+        uint32_t get_total() const { return total; }
+        double get_probability(unsigned int bin) const
+        {
+            return total ? hist[bin]/(double)total : 0.0;
+        }
+
         // Increment the count of the bin where v falls into.
         // Insert into the first or last bin if the value is outside
         // the histogram range.
-        //
-        // !!!!!!!!!! Implement this method !!!!!!!!!!
-        //
         void insert_point(double v);
 
-        // Normalize the histogram in order to turn it into a
-        // probability distribution
-        //
-        // !!!!!!!!!! Implement this method !!!!!!!!!!
-        //
-        void normalize();
+        // Count the pixels inside roi of an image. Pixels with value 0
+        // (unknown depth) are not counted.
+        void insert_image(const unsigned short *image, int width,
+                          const image_roi &roi);
 
         // Clear the histogram by setting all its bins to zero
         void clear();
 
     private:
-        std::vector<double> hist;
+        std::vector<uint32_t> hist;
+        uint32_t total;
         double min_value, max_value;
         double binsize;
-};
 
-inline        
-histogram::histogram(double min_value, double max_value, int nbins)
-    : hist(nbins), min_value(min_value), max_value(max_value)
-{
-    binsize = (max_value - min_value)/nbins;
-    for (int i = 0; i < nbins; i++)
-        hist[i] = 0.0;
-}
-        
-inline
-double &histogram::operator()(unsigned int bin)
-{
-    return hist[bin];
-};
+        // The bin of v is (v - offset)*scale, truncated. scale is the
+        // reciprocal of the bin size rounded up, so integer values on a
+        // bin boundary don't fall into the bin below.
+        float offset, scale;
 
-inline
-const double &histogram::operator()(unsigned int bin) const
-{
-    return hist[bin];
+        // The sub-histograms of insert_image(), one after the other. Each
+        // one has an extra bin the pixels with value 0 are counted in.
+        std::vector<uint32_t> sub;
 };
 
-inline        
-double & histogram::operator[](unsigned int bin)
-{
-    return hist[bin];
-}
-
-inline        
-const double & histogram::operator[](unsigned int bin) const
-{
-    return hist[bin];
-}
-        
 inline
-void histogram::insert_point(double v)
+unsigned int histogram::get_bin(double v) const
 {
-    // !!!!!!!!!! Implement this method !!!!!!!!!!
-    //std::cout << "Warning: histogram::insert_point not implemented!\n";
-	if(v != 0){
-		int k = v / 50.0;
-		if(k < hist.size())
-			hist[k] ++;
-	}
+    float f = ((float)v - offset)*scale;
+    if (!(f > 0))
+        return 0;
+    if (f >= hist.size() - 1)
+        return hist.size() - 1;
+    return (unsigned int)f;
 }
 
 inline
-void histogram::normalize()
+void histogram::insert_point(double v)
 {
-    // !!!!!!!!!! Implement this method !!!!!!!!!!
-    //std::cout << "Warning: histogram::normalize not implemented!\n";
-	double sum;
-	sum = 0.0;
-	for(int i=0; i<get_n_bins(); i++){
-		sum += hist[i];
-	}
-	for(int i=0; i<get_n_bins(); i++){
-		hist[i] /= sum;
-	}
+    hist[get_bin(v)]++;
+    total++;
 }
 
 inline void histogram::clear()
 {
     for (unsigned int i = 0; i < hist.size(); i++)
         hist[i] = 0;
+    total = 0;
 }
 
 inline std::ostream &operator<<(std::ostream &os, const histogram &h)
 {
     int N = h.get_n_bins();
     double range_min, range_max;
-    
+
     range_min = h.get_min();
     range_max = range_min + h.get_bin_size();
     int MAX_BARS = 200;
     for (int i = 0; i < N; i++, range_min = range_max, range_max += h.get_bin_size())
     {
-        printf("[%8.2f, %8.2f] : %f ", range_min, range_max, h(i));
-        int nbars = (int)(h(i)*MAX_BARS);
+        printf("[%8.2f, %8.2f] : %f ", range_min, range_max,
+               h.get_probability(i));
+        int nbars = (int)(h.get_probability(i)*MAX_BARS);
         for (int j = 0; j < nbars; j++)
             printf("|");
         printf("\n");
@@ -150,18 +151,20 @@ inline std::ostream &operator<<(std::ostream &os, const histogram &h)
 }
 
 // Create the histogram of a depth map, with the parameters of the provided
-// histogram 'hist' created beforehand.
+// histogram 'hist' created beforehand. Pixels with unknown depth are not
+// counted.
 //
-//     depthimage: the kinect depth image 
+//     depthimage: the kinect depth image
 //     npts: the number of pixels in the depth map
 //
-// If normalize is true, normalize the histogram entries so that they add up
-// to one.
-//
-void compute_histogram(unsigned short *depthimage,
+void compute_histogram(const unsigned short *depthimage,
                        int npts,
-                       histogram &hist,
-                       bool normalize = false);
+                       histogram &hist);
+
+// The same, for the pixels inside roi of a depth map width pixels wide
+void compute_histogram(const unsigned short *depthimage,
+                       int width, const image_roi &roi,
+                       histogram &hist);
 
 #endif // HISTOGRAM_H
 
@@ -0,0 +1,332 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <algorithm>
+#include <string.h>
+
+#include "huffman_code.h"
+
+using namespace std;
+
+#define STREAMS 4
+
+static inline uint64_t load_u64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Decode up to three symbols of a stream with a lookup in the table
+static inline void decode_step(const uint32_t *table, uint64_t &bits,
+                               uint64_t &pos, unsigned char *&out)
+{
+    uint32_t e = table[bits & ((1 << HUFFMAN_TABLE_BITS) - 1)];
+    memcpy(out, &e, sizeof(e));
+    out += e >> 30;
+    unsigned int used = (e >> 24) & 0x3f;
+    bits >>= used;
+    pos += used;
+}
+
+// Code lengths of a Huffman code for the symbols with nonzero counts
+static int huffman_lengths(const unsigned int *counts, unsigned char *length)
+{
+    vector< pair<unsigned int, int> > leaves;
+    for (int s = 0; s < 256; s++)
+        if (counts[s])
+            leaves.push_back(make_pair(counts[s], s));
+    sort(leaves.begin(), leaves.end());
+
+    // The leaves are sorted and the inner nodes are made in order of weight,
+    // so the two lightest nodes are at the front of one of the two queues
+    int n = leaves.size();
+    vector<unsigned long long> weight(2*n - 1);
+    vector<int> parent(2*n - 1), depth(2*n - 1);
+    for (int i = 0; i < n; i++)
+        weight[i] = leaves[i].first;
+
+    int leaf = 0, inner = n;
+    for (int k = n; k < 2*n - 1; k++)
+    {
+        int child[2];
+        for (int j = 0; j < 2; j++)
+        {
+            if (leaf < n && (inner == k || weight[leaf] <= weight[inner]))
+                child[j] = leaf++;
+            else
+                child[j] = inner++;
+        }
+        weight[k] = weight[child[0]] + weight[child[1]];
+        parent[child[0]] = parent[child[1]] = k;
+    }
+
+    // Parents come after their children
+    int longest = 0;
+    depth[2*n - 2] = 0;
+    for (int k = 2*n - 3; k >= 0; k--)
+        depth[k] = depth[parent[k]] + 1;
+    for (int i = 0; i < n; i++)
+    {
+        length[leaves[i].second] = depth[i];
+        longest = max(longest, depth[i]);
+    }
+    return longest;
+}
+
+huffman_code::huffman_code()
+    : single(1 << HUFFMAN_MAX_BITS), multi(1 << HUFFMAN_TABLE_BITS)
+{
+    memset(length, 0, sizeof(length));
+    memset(code, 0, sizeof(code));
+}
+
+void huffman_code::build(const unsigned int counts[256])
+{
+    memset(length, 0, sizeof(length));
+
+    int nsymbols = 0;
+    for (int s = 0; s < 256; s++)
+        if (counts[s])
+            nsymbols++;
+
+    if (nsymbols == 1)
+    {
+        // A code needs two symbols, pair it with an unused one
+        for (int s = 0; s < 256; s++)
+            if (counts[s])
+                length[s] = length[s ^ 1] = 1;
+    }
+    else if (nsymbols > 1)
+    {
+        // Flatten the counts until the code is short enough
+        unsigned int c[256];
+        memcpy(c, counts, sizeof(c));
+        while (huffman_lengths(c, length) > HUFFMAN_MAX_BITS)
+            for (int s = 0; s < 256; s++)
+                c[s] = (c[s] + 1)/2;
+    }
+
+    make_tables();
+}
+
+void huffman_code::write(vector<unsigned char> &out) const
+{
+    for (int s = 0; s < 256; s += 2)
+        out.push_back(length[s] | length[s + 1] << 4);
+}
+
+bool huffman_code::read(const unsigned char *data, size_t size)
+{
+    if (size < HUFFMAN_LENGTHS_SIZE)
+        return false;
+
+    // The code must be complete, so every pattern decodes, or empty
+    unsigned int kraft = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        length[s] = (data[s/2] >> 4*(s & 1)) & 0xf;
+        if (length[s] > HUFFMAN_MAX_BITS)
+            return false;
+        if (length[s])
+            kraft += 1 << (HUFFMAN_MAX_BITS - length[s]);
+    }
+    if (kraft != 0 && kraft != 1u << HUFFMAN_MAX_BITS)
+        return false;
+
+    make_tables();
+    return true;
+}
+
+void huffman_code::make_tables()
+{
+    // Canonical codes, reversed since the streams are read from the least
+    // significant bit
+    int count[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int s = 0; s < 256; s++)
+        count[length[s]]++;
+    count[0] = 0;
+    fill(single.begin(), single.end(), 0);
+
+    unsigned int next[HUFFMAN_MAX_BITS + 1];
+    unsigned int c = 0;
+    for (int l = 1; l <= HUFFMAN_MAX_BITS; l++)
+    {
+        c = (c + count[l - 1]) << 1;
+        next[l] = c;
+    }
+
+    for (int s = 0; s < 256; s++)
+    {
+        int l = length[s];
+        if (l == 0)
+            continue;
+        unsigned int v = next[l]++, r = 0;
+        for (int i = 0; i < l; i++)
+            r |= ((v >> i) & 1) << (l - 1 - i);
+        code[s] = r;
+
+        for (unsigned int p = r; p < 1u << HUFFMAN_MAX_BITS; p += 1u << l)
+            single[p] = s | l << 8;
+    }
+
+    for (unsigned int p = 0; p < 1u << HUFFMAN_TABLE_BITS; p++)
+    {
+        uint32_t entry = 0;
+        unsigned int used = 0, n = 0;
+        while (n < 3)
+        {
+            unsigned short e = single[(p >> used) & ((1 << HUFFMAN_MAX_BITS) - 1)];
+            unsigned int l = e >> 8;
+            if (l == 0 || used + l > HUFFMAN_TABLE_BITS)
+                break;
+            entry |= (e & 0xff) << 8*n;
+            used += l;
+            n++;
+        }
+        multi[p] = entry | used << 24 | n << 30;
+    }
+}
+
+void huffman_code::encode(const unsigned char *symbols, int n,
+                          vector<unsigned char> &out) const
+{
+    size_t header = out.size();
+    out.resize(header + STREAMS*sizeof(uint32_t));
+
+    int quarter = (n + STREAMS - 1)/STREAMS;
+    for (int k = 0; k < STREAMS; k++)
+    {
+        int begin = min(n, k*quarter), end = min(n, (k + 1)*quarter);
+
+        // Room for the longest codes, and for the last 8 byte store
+        size_t start = out.size();
+        out.resize(start + (size_t)(end - begin)*HUFFMAN_MAX_BITS/8 + 16);
+        unsigned char *p = &out[start];
+
+        uint64_t acc = 0;
+        int nacc = 0;
+        for (int i = begin; i < end; i++)
+        {
+            acc |= (uint64_t)code[symbols[i]] << nacc;
+            nacc += length[symbols[i]];
+            if (nacc >= 32)
+            {
+                memcpy(p, &acc, sizeof(acc));
+                p += 4;
+                acc >>= 32;
+                nacc -= 32;
+            }
+        }
+        for (; nacc > 0; nacc -= 8)
+        {
+            *p++ = acc & 0xff;
+            acc >>= 8;
+        }
+
+        uint32_t size = p - &out[start];
+        out.resize(start + size);
+        memcpy(&out[header + k*sizeof(uint32_t)], &size, sizeof(size));
+    }
+}
+
+const unsigned char *huffman_code::decode(const unsigned char *data,
+                                          const unsigned char *end,
+                                          unsigned char *symbols, int n) const
+{
+    if (end - data < (ptrdiff_t)(STREAMS*sizeof(uint32_t)))
+        return 0;
+
+    // Every pattern decodes with a complete code, none with an empty one
+    if (n > 0 && multi[0] >> 30 == 0)
+        return 0;
+
+    int quarter = (n + STREAMS - 1)/STREAMS;
+    const unsigned char *stream[STREAMS];
+    size_t size[STREAMS];
+    uint64_t pos[STREAMS];
+    unsigned char *out[STREAMS], *out_end[STREAMS];
+    const unsigned char *p = data + STREAMS*sizeof(uint32_t);
+    for (int k = 0; k < STREAMS; k++)
+    {
+        uint32_t s;
+        memcpy(&s, data + k*sizeof(uint32_t), sizeof(s));
+        if ((size_t)(end - p) < s)
+            return 0;
+
+        stream[k] = p;
+        size[k] = s;
+        pos[k] = 0;
+        out[k] = symbols + min(n, k*quarter);
+        out_end[k] = symbols + min(n, (k + 1)*quarter);
+        p += s;
+    }
+
+    // Four lookups take at most 48 bits and give at most 12 symbols, with
+    // the last store running 3 bytes past them. The state of the streams
+    // is kept in separate variables so that it stays in registers.
+    const uint32_t *table = &multi[0];
+    unsigned char *out0 = out[0], *out1 = out[1], *out2 = out[2],
+                  *out3 = out[3];
+    uint64_t pos0 = 0, pos1 = 0, pos2 = 0, pos3 = 0;
+    while (out_end[0] - out0 >= 16 && (pos0 >> 3) + 8 <= size[0] &&
+           out_end[1] - out1 >= 16 && (pos1 >> 3) + 8 <= size[1] &&
+           out_end[2] - out2 >= 16 && (pos2 >> 3) + 8 <= size[2] &&
+           out_end[3] - out3 >= 16 && (pos3 >> 3) + 8 <= size[3])
+    {
+        uint64_t bits0 = load_u64(stream[0] + (pos0 >> 3)) >> (pos0 & 7);
+        uint64_t bits1 = load_u64(stream[1] + (pos1 >> 3)) >> (pos1 & 7);
+        uint64_t bits2 = load_u64(stream[2] + (pos2 >> 3)) >> (pos2 & 7);
+        uint64_t bits3 = load_u64(stream[3] + (pos3 >> 3)) >> (pos3 & 7);
+        for (int j = 0; j < 4; j++)
+        {
+            decode_step(table, bits0, pos0, out0);
+            decode_step(table, bits1, pos1, out1);
+            decode_step(table, bits2, pos2, out2);
+            decode_step(table, bits3, pos3, out3);
+        }
+    }
+    out[0] = out0;
+    out[1] = out1;
+    out[2] = out2;
+    out[3] = out3;
+    pos[0] = pos0;
+    pos[1] = pos1;
+    pos[2] = pos2;
+    pos[3] = pos3;
+
+    // The ends of the streams, one symbol at a time
+    for (int k = 0; k < STREAMS; k++)
+    {
+        while (out[k] < out_end[k])
+        {
+            size_t byte = pos[k] >> 3;
+            uint64_t bits;
+            if (byte + 8 <= size[k])
+                bits = load_u64(stream[k] + byte);
+            else
+            {
+                bits = 0;
+                for (size_t i = byte; i < size[k]; i++)
+                    bits |= (uint64_t)stream[k][i] << 8*(i - byte);
+            }
+            bits >>= pos[k] & 7;
+
+            unsigned short e = single[bits & ((1 << HUFFMAN_MAX_BITS) - 1)];
+            *out[k]++ = e & 0xff;
+            pos[k] += e >> 8;
+        }
+
+        // Each stream must end in its last byte
+        if ((pos[k] + 7) >> 3 != size[k])
+            return 0;
+    }
+
+    return p;
+}
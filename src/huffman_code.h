@@ -0,0 +1,70 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef HUFFMAN_CODE_H
+#define HUFFMAN_CODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The longest code, and the bits the decoder looks at at a time
+#define HUFFMAN_MAX_BITS 11
+#define HUFFMAN_TABLE_BITS 12
+
+// The bytes taken by the code lengths of a code
+#define HUFFMAN_LENGTHS_SIZE 128
+
+/*
+ * A canonical Huffman code for byte symbols.
+ *
+ * A block of symbols is coded as four bit streams with a quarter of the
+ * symbols each, preceded by their sizes as four uint32_t, so the decoder
+ * can follow four independent chains of table lookups at once. Its table
+ * is indexed by the next HUFFMAN_TABLE_BITS bits of a stream and decodes
+ * up to three short codes per lookup.
+ */
+class huffman_code
+{
+    public:
+        huffman_code();
+
+        // Build the code for symbols with the given counts
+        void build(const unsigned int counts[256]);
+
+        // Append the code lengths to out, and read them back. read returns
+        // false if they don't make up a valid code.
+        void write(std::vector<unsigned char> &out) const;
+        bool read(const unsigned char *data, size_t size);
+
+        // Code n symbols, appending the block to out
+        void encode(const unsigned char *symbols, int n,
+                    std::vector<unsigned char> &out) const;
+
+        // Decode a block of n symbols starting at data. Returns the end of
+        // the block, or 0 if the data is corrupt.
+        const unsigned char *decode(const unsigned char *data,
+                                    const unsigned char *end,
+                                    unsigned char *symbols, int n) const;
+
+    private:
+        void make_tables();
+
+        unsigned char length[256];
+        unsigned short code[256];
+
+        // The symbol and length of the code at the start of each pattern of
+        // HUFFMAN_MAX_BITS bits, and for each pattern of HUFFMAN_TABLE_BITS
+        // bits up to three symbols in the low bytes, the bits they take in
+        // bits 24-29 and their number in bits 30-31
+        std::vector<unsigned short> single;
+        std::vector<uint32_t> multi;
+};
+
+#endif // HUFFMAN_CODE_H
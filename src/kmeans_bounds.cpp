@@ -0,0 +1,22 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include "kmeans_bounds.h"
+
+void kmeans_bounds::init(int npts)
+{
+    cluster.assign(npts, 0);
+    upper.assign(npts, 0);
+    lower.assign(npts, 0);
+    color.assign(3*npts, 0);
+    run.assign(npts, 0);
+    runs = 0;
+    centroids.clear();
+    distances = 0;
+}
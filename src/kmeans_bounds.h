@@ -0,0 +1,51 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef KMEANS_BOUNDS_H
+#define KMEANS_BOUNDS_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*
+ * What Hamerly's k-means in color space knows about the pixels of an
+ * image, kept from one frame to the next.
+ *
+ * For each pixel clustered in the last run we keep its cluster, an upper
+ * bound on the distance of its color to the centroid of that cluster and
+ * a lower bound on the distance to every other centroid, together with
+ * the color and the centroids they were computed for. By the triangle
+ * inequality the bounds still hold for the next frame once they are
+ * loosened by how far the color and the centroids moved, so a pixel that
+ * kept its color is only looked at again if a centroid came close.
+ */
+struct kmeans_bounds
+{
+    kmeans_bounds() : runs(0), distances(0) {}
+
+    // Forget all bounds, for images of npts pixels
+    void init(int npts);
+
+    std::vector<unsigned char> cluster;
+    std::vector<float> upper, lower;
+    std::vector<unsigned char> color;
+
+    // The run each pixel was last clustered in, and the number of runs
+    std::vector<unsigned int> run;
+    unsigned int runs;
+
+    // The centroids at the end of the last run
+    std::vector<cv::Vec3d> centroids;
+
+    // How many distances to a centroid the last run computed
+    int distances;
+};
+
+#endif // KMEANS_BOUNDS_H
@@ -7,11 +7,14 @@
 *
 ****************************************************************************/
 
+#include <float.h>
 #include <iostream>
+#include <math.h>
 #include <stdio.h>
 #include <vector>
 #include "mincut_segmentation.h"
 #include "kmeans_color.h"
+#include "pixel_partition.h"
 #include <opencv2/core/core.hpp>
 
 #ifdef __APPLE__
@@ -29,6 +32,7 @@
 #include "histogram.h"
 #include "KinectInterface.h"
 #include "kmeans_segmentation.h"
+#include "nearest_centroid.h"
 #include "threshold.h"
 
 using namespace std;
@@ -37,10 +41,41 @@ double distance(unsigned char* rgbImage, int i, cv::Vec3d x){
 	return pow(rgbImage[i*3]-x[0],2)+pow(rgbImage[i*3+1]-x[1],2)+pow(rgbImage[i*3+2]-x[2],2);
 }
 
+// The most any channel of any centroid moved
+static double centroid_shift(const std::vector<cv::Vec3d> &pre_centroids,
+                             const std::vector<cv::Vec3d> &centroids){
+	double shift = 0;
+	for(size_t i=0; i<centroids.size(); i++)
+		for(int j=0; j<3; j++)
+			shift = std::max(shift, fabs(pre_centroids[i][j] - centroids[i][j]));
+	return shift;
+}
+
 void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
                    std::vector<cv::Vec3d> &centroids,
                    unsigned char *cluster,
                    unsigned char *mask, unsigned char label)
+{
+	k_means_color(rgbImage, npts, linear_roi(npts), nclusters,
+	              centroids, cluster, mask, label);
+}
+
+void k_means_color(unsigned char *rgbImage, int width, const image_roi &roi,
+                   int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   unsigned char *mask, unsigned char label)
+{
+	pixel_partition pixels;
+	pixels.build(mask, rgbImage, width, roi);
+	k_means_color(pixels, label, nclusters, centroids, cluster);
+}
+
+void k_means_color(const pixel_partition &pixels, unsigned char label,
+                   int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control)
 {
 /*
  * Compute k-means in color space for the pixels in trimap with the
@@ -65,6 +100,13 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 	
     //std::cout << "Warning: k_means_color not implemented!\n";
 
+	// The pixels of the label, and their colors
+	int npixels = pixels.size(label);
+	const int *index_of = pixels.indices(label);
+	const unsigned char *rgb[3] = {pixels.channel(label, 0),
+	                               pixels.channel(label, 1),
+	                               pixels.channel(label, 2)};
+
 // mean : centroids : 각각의 클러스터에서 각각의 색(rgb)에 대한 평균값을 입력하는 곳
 
 	// Initialization
@@ -74,6 +116,8 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 	pre_centroids.resize(nclusters);
 	cv::Vec3d sum[nclusters];	
 	double count[nclusters];
+	uint32_t pixel_sum[nclusters][3];
+	uint32_t pixel_count[nclusters];
 
 	for (int i=0; i<3; i++){
 		rgb_min[i] = 255;
@@ -81,17 +125,15 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 	}
 
 	// centroids is empty
-	if(centroids.size() != nclusters){
+	if(centroids.size() != nclusters || (control && !control->warm_start)){
 		centroids.resize(nclusters);
-		for(int i=0; i<npts; i++){
+		for(int i=0; i<npixels; i++){
 			// Searching depth_min / depth_max value
-			if(mask[i] == label){
-				for(int j=0; j<3; j++){
-					if(rgbImage[i*3+j] < rgb_min[j])
-						rgb_min[j] = rgbImage[i*3+j];
-					if(rgbImage[i*3+j] > rgb_max[j])
-						rgb_max[j] = rgbImage[i*3+j];
-				}
+			for(int j=0; j<3; j++){
+				if(rgb[j][i] < rgb_min[j])
+					rgb_min[j] = rgb[j][i];
+				if(rgb[j][i] > rgb_max[j])
+					rgb_max[j] = rgb[j][i];
 			}
 		}
 	
@@ -103,8 +145,7 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 	} 
 
 	// Centroid Estimate
-	int index;
-	double distance_min, distance_comp;
+	cluster_control_start(control);
 	while(is_change){
 		
 		// Initialization
@@ -115,23 +156,17 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 				pre_centroids[i][j] = centroids[i][j];
 		}
 				
-		for(int i=0; i<npts; i++){
-			if(mask[i] == label){	
-				distance_min = distance(rgbImage, i, centroids[0]);
-				index = 0;
-
-				for(int t=0; t<nclusters; t++){
-					distance_comp = distance(rgbImage, i, centroids[t]);
-					if(distance_min > distance_comp){
-						index = t;
-						distance_min = distance_comp;
-					}
-				}
-				cluster[i] = index;
-				count[index] ++;
-				for(int k=0; k<3; k++)
-					sum[index][k] += rgbImage[i*3+k];
-			}
+		// Assign the pixels and sum up their colors in one pass
+		for(int i=0; i<nclusters; i++){
+			pixel_sum[i][0] = pixel_sum[i][1] = pixel_sum[i][2] = 0;
+			pixel_count[i] = 0;
+		}
+		nearest_centroids(rgb, npixels, &centroids[0], nclusters,
+		                  index_of, cluster, pixel_sum, pixel_count);
+		for(int i=0; i<nclusters; i++){
+			count[i] = pixel_count[i];
+			for(int k=0; k<3; k++)
+				sum[i][k] = pixel_sum[i][k];
 		}
 		
 		// New Centroid
@@ -154,30 +189,317 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
 //
 		// 소수점에서 않맞아서 계속 비교하므로 차이가 1보다 작으면 통과시키자.
 		// Compare pre vs cur  => for loop interrup
-		double diff;
-		bool check = true;
+		// A budget can stop it earlier, with the centroids so far
+		double shift = centroid_shift(pre_centroids, centroids);
+		is_change = cluster_control_next(control, shift <= 1, shift);
+	}
+}
+
+void k_means_color(color_histogram &bins, const pixel_partition &pixels,
+                   unsigned char label, int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control)
+{
+	// One pass over the pixels; the iterations only go through the bins
+	bins.build(pixels, label);
+	int nbins = bins.size();
+
+	std::vector<cv::Vec3d> mean(nbins);
+	for(int b=0; b<nbins; b++)
+		mean[b] = bins.mean(b);
+
+	// Initial centroids, spread between the lowest and highest colors
+	if(centroids.size() != nclusters || (control && !control->warm_start)){
+		centroids.resize(nclusters);
+		for(int i=0; i<nclusters; i++)
+			for(int j=0; j<3; j++)
+				centroids[i][j] = i*(bins.high()[j]-bins.low()[j])/nclusters + bins.low()[j];
+	}
+
+	std::vector<unsigned char> bin_cluster(nbins);
+	std::vector<cv::Vec3d> pre_centroids(nclusters);
+	std::vector<cv::Vec3d> sum(nclusters);
+	std::vector<double> count(nclusters);
+
+	bool is_change = true;
+	cluster_control_start(control);
+	while(is_change){
 		for(int i=0; i<nclusters; i++){
+			sum[i] = 0;
+			count[i] = 0;
+			pre_centroids[i] = centroids[i];
+		}
 
-			for(int j=0; j<3; j++){
-				diff = pre_centroids[i][j] - centroids[i][j];
-				if(diff>1 || diff<-1){
-					check = false;
-					break;
+		// Each bin weighs as much as its pixels
+		for(int b=0; b<nbins; b++){
+			int index = 0;
+			double distance_min = 0;
+			for(int t=0; t<nclusters; t++){
+				cv::Vec3d d = mean[b] - centroids[t];
+				double distance_comp = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+				if(t == 0 || distance_min > distance_comp){
+					index = t;
+					distance_min = distance_comp;
 				}
 			}
-			if(!check)
-				break;
-			if(i==nclusters-1 && check)
-				is_change = false;
-/*
-			if(pre_centroids[i] != centroids[i]){
-				is_change = true;
-				break;
-			} else{
-				is_change = false;
-				break;
+			bin_cluster[b] = index;
+			count[index] += bins.count(b);
+			sum[index] += bins.sum(b);
+		}
+
+		// New Centroid
+		for(int i=0; i<nclusters; i++)
+			if(count[i] != 0)
+				for(int t=0; t<3; t++)
+					centroids[i][t] = sum[i][t] / count[i];
+
+		// Stop when no centroid moved more than 1 in any channel, or out
+		// of budget
+		double shift = centroid_shift(pre_centroids, centroids);
+		is_change = cluster_control_next(control, shift <= 1, shift);
+	}
+
+	// Each pixel goes to the cluster of its bin
+	if(nbins > 0)
+		bins.lookup(&bin_cluster[0], pixels.indices(label), cluster);
+}
+
+// The nearest centroid to a color, its distance, and the distance to the
+// second nearest one
+static int nearest_two(const double *x, const std::vector<cv::Vec3d> &centroids,
+                       double *first, double *second)
+{
+	int nclusters = centroids.size();
+	int index = 0;
+	double d1 = HUGE_VAL, d2 = HUGE_VAL;
+	for(int t=0; t<nclusters; t++){
+		double dr = x[0]-centroids[t][0], dg = x[1]-centroids[t][1], db = x[2]-centroids[t][2];
+		double d = dr*dr + dg*dg + db*db;
+		if(d < d1){
+			d2 = d1;
+			d1 = d;
+			index = t;
+		}
+		else if(d < d2)
+			d2 = d;
+	}
+	*first = sqrt(d1);
+	*second = d2 == HUGE_VAL ? FLT_MAX : sqrt(d2);
+	return index;
+}
+
+// How far each centroid moved, and the two largest moves: a lower bound
+// drops by the largest move of the centroids other than its own
+static void centroid_drift(const std::vector<cv::Vec3d> &from,
+                           const std::vector<cv::Vec3d> &to,
+                           std::vector<double> &drift,
+                           int *largest, double *d1, double *d2)
+{
+	*largest = 0;
+	*d1 = *d2 = 0;
+	for(int t=0; t<(int)to.size(); t++){
+		cv::Vec3d d = to[t] - from[t];
+		drift[t] = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+		if(drift[t] > *d1){
+			*d2 = *d1;
+			*d1 = drift[t];
+			*largest = t;
+		}
+		else if(drift[t] > *d2)
+			*d2 = drift[t];
+	}
+}
+
+// Half the distance of each centroid to the nearest other one: a color
+// nearer than that to its centroid cannot be nearer to another
+static void half_gaps(const std::vector<cv::Vec3d> &centroids,
+                      std::vector<double> &s)
+{
+	int nclusters = centroids.size();
+	for(int t=0; t<nclusters; t++){
+		s[t] = HUGE_VAL;
+		for(int j=0; j<nclusters; j++){
+			if(j == t)
+				continue;
+			cv::Vec3d d = centroids[t] - centroids[j];
+			s[t] = std::min(s[t], 0.5*sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]));
+		}
+	}
+}
+
+// The bounds are kept as floats, rounded away from the side they bound
+// by more than the rounding error of a float
+#define BOUND_SLACK (1.0/(1 << 20))
+
+static inline float round_up(double x){
+	return (float)(x + fabs(x)*BOUND_SLACK);
+}
+
+static inline float round_down(double x){
+	return (float)(x - fabs(x)*BOUND_SLACK);
+}
+
+// Hamerly's test for a color assigned to cluster k with bounds u and l:
+// returns its nearest centroid, only computing the distances the bounds
+// cannot rule out
+static inline int hamerly_step(const double *x,
+                               const std::vector<cv::Vec3d> &centroids,
+                               const std::vector<double> &s, int k,
+                               float &u, float &l, int &distances)
+{
+	double m = std::max(s[k], (double)l);
+	if(u <= m)
+		return k;
+
+	// Tighten the upper bound, and only if that is not enough look at all
+	// the centroids
+	double dr = x[0]-centroids[k][0], dg = x[1]-centroids[k][1], db = x[2]-centroids[k][2];
+	double d = sqrt(dr*dr + dg*dg + db*db);
+	distances++;
+	u = round_up(d);
+	if(d <= m)
+		return k;
+
+	double first, second;
+	int nearest = nearest_two(x, centroids, &first, &second);
+	distances += centroids.size();
+	u = round_up(first);
+	l = round_down(second);
+	return nearest;
+}
+
+void k_means_color(kmeans_bounds &bounds, const pixel_partition &pixels,
+                   unsigned char label, int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control)
+{
+	int npixels = pixels.size(label);
+	const int *index_of = pixels.indices(label);
+	const unsigned char *rgb[3] = {pixels.channel(label, 0),
+	                               pixels.channel(label, 1),
+	                               pixels.channel(label, 2)};
+
+	// Initial centroids, spread between the lowest and highest colors
+	if(centroids.size() != nclusters || (control && !control->warm_start)){
+		double rgb_min[3] = {255, 255, 255}, rgb_max[3] = {0, 0, 0};
+		for(int i=0; i<npixels; i++)
+			for(int j=0; j<3; j++){
+				rgb_min[j] = std::min(rgb_min[j], (double)rgb[j][i]);
+				rgb_max[j] = std::max(rgb_max[j], (double)rgb[j][i]);
 			}
-*/
+		centroids.resize(nclusters);
+		for(int i=0; i<nclusters; i++)
+			for(int j=0; j<3; j++)
+				centroids[i][j] = i*(rgb_max[j]-rgb_min[j])/nclusters + rgb_min[j];
+	}
+	cluster_control_start(control);
+	if(npixels == 0){
+		cluster_control_next(control, true);
+		return;
+	}
+
+	// The bounds of the pixels clustered in the last run hold for the
+	// centroids they were left at; loosen them by how far the centroids
+	// moved since
+	bool carried = bounds.centroids.size() == nclusters;
+	std::vector<double> drift(nclusters);
+	int largest = 0;
+	double d1 = 0, d2 = 0;
+	if(carried)
+		centroid_drift(bounds.centroids, centroids, drift, &largest, &d1, &d2);
+
+	std::vector<double> s(nclusters);
+	half_gaps(centroids, s);
+
+	unsigned char *assigned = &bounds.cluster[0];
+	float *upper = &bounds.upper[0], *lower = &bounds.lower[0];
+	unsigned char *last_color = &bounds.color[0];
+	unsigned int *last_run = &bounds.run[0];
+	unsigned int run = bounds.runs + 1;
+
+	std::vector<cv::Vec3d> sum(nclusters);
+	std::vector<double> count(nclusters);
+	int distances = 0;
+
+	// The first assignment
+	for(int i=0; i<npixels; i++){
+		int p = index_of[i];
+		double x[3] = {rgb[0][i], rgb[1][i], rgb[2][i]};
+		unsigned char *y = last_color + 3*p;
+
+		int k;
+		if(carried && last_run[p] == bounds.runs){
+			// The color moved as much as the centroids could have
+			double moved = 0;
+			if(y[0] != rgb[0][i] || y[1] != rgb[1][i] || y[2] != rgb[2][i])
+				moved = sqrt(pow(x[0]-y[0],2)+pow(x[1]-y[1],2)+pow(x[2]-y[2],2));
+
+			k = assigned[p];
+			upper[p] = round_up(upper[p] + moved + drift[k]);
+			lower[p] = round_down(lower[p] - moved - (k == largest ? d2 : d1));
+			k = hamerly_step(x, centroids, s, k, upper[p], lower[p], distances);
+		}
+		else{
+			double first, second;
+			k = nearest_two(x, centroids, &first, &second);
+			distances += nclusters;
+			upper[p] = round_up(first);
+			lower[p] = round_down(second);
 		}
+
+		assigned[p] = cluster[p] = k;
+		for(int j=0; j<3; j++)
+			y[j] = rgb[j][i];
+		last_run[p] = run;
+
+		count[k]++;
+		for(int j=0; j<3; j++)
+			sum[k][j] += x[j];
 	}
+
+	std::vector<cv::Vec3d> pre_centroids(nclusters);
+	while(true){
+		// New Centroid
+		pre_centroids = centroids;
+		for(int i=0; i<nclusters; i++)
+			if(count[i] != 0)
+				for(int t=0; t<3; t++)
+					centroids[i][t] = sum[i][t] / count[i];
+
+		// Stop when no centroid moved more than 1 in any channel, or out
+		// of budget
+		double shift = centroid_shift(pre_centroids, centroids);
+		if(!cluster_control_next(control, shift <= 1, shift))
+			break;
+
+		// The bounds follow the centroids, and only the pixels they do not
+		// pin down are looked at
+		centroid_drift(pre_centroids, centroids, drift, &largest, &d1, &d2);
+		half_gaps(centroids, s);
+		for(int i=0; i<npixels; i++){
+			int p = index_of[i];
+			int k = assigned[p];
+			upper[p] = round_up(upper[p] + drift[k]);
+			lower[p] = round_down(lower[p] - (k == largest ? d2 : d1));
+
+			double x[3] = {rgb[0][i], rgb[1][i], rgb[2][i]};
+			int nearest = hamerly_step(x, centroids, s, k, upper[p], lower[p], distances);
+			if(nearest != k){
+				count[k]--;
+				count[nearest]++;
+				for(int j=0; j<3; j++){
+					sum[k][j] -= x[j];
+					sum[nearest][j] += x[j];
+				}
+				assigned[p] = cluster[p] = nearest;
+			}
+		}
+	}
+
+	// The bounds are for the centroids of the last assignment
+	bounds.runs = run;
+	bounds.centroids = pre_centroids;
+	bounds.distances = distances;
 }
@@ -12,6 +12,12 @@
 
 #include <opencv2/core/core.hpp>
 
+#include "cluster_control.h"
+#include "color_histogram.h"
+#include "kmeans_bounds.h"
+#include "pixel_partition.h"
+#include "roi.h"
+
 /*
  * Compute k-means in color space for the pixels in trimap with the
  * given label.
@@ -35,4 +41,43 @@ void k_means_color(unsigned char *rgbImage, int npts, int nclusters,
                    unsigned char *cluster,
                    unsigned char *trimap = 0, unsigned char label = 1);
 
+// The same, only for the pixels inside roi of an image with the given width
+void k_means_color(unsigned char *rgbImage, int width, const image_roi &roi,
+                   int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   unsigned char *trimap, unsigned char label);
+
+// The same, for the pixels of a partition with the given label.
+//
+// If control is not NULL, the centroids passed in are only used to start
+// from if it asks for a warm start, and the iterations are bounded by its
+// budget and reported back in it, with the largest move of a centroid
+// channel in the last one. At least one iteration runs, so every pixel
+// gets a cluster.
+void k_means_color(const pixel_partition &pixels, unsigned char label,
+                   int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control = 0);
+
+// The same, iterating on the bins of a color histogram of the pixels
+// instead of on the pixels, weighted by their counts. Each bin goes to the
+// cluster nearest to the mean color of its pixels. bins is rebuilt.
+void k_means_color(color_histogram &bins, const pixel_partition &pixels,
+                   unsigned char label, int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control = 0);
+
+// The same, on the pixels, with Hamerly's bounds to skip the distances to
+// the centroids that cannot be the nearest. The bounds of the pixels are
+// carried over from the last call, so the pixels that kept their color
+// are mostly skipped when the centroids start where they ended.
+void k_means_color(kmeans_bounds &bounds, const pixel_partition &pixels,
+                   unsigned char label, int nclusters,
+                   std::vector<cv::Vec3d> &centroids,
+                   unsigned char *cluster,
+                   cluster_control *control = 0);
+
 #endif // KMEANS_COLOR_H
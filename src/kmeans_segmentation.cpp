@@ -14,11 +14,20 @@
 
 using namespace std;
 
-float k_means_segmentation(unsigned short *depthimage,
+float k_means_segmentation(const unsigned short *depthimage,
                            int npts,
                            bool *foreground,
                            double *centroid_fg, double *centroid_bg)
 {
+	return k_means_segmentation(depthimage, npts, linear_roi(npts),
+	                            foreground, centroid_fg, centroid_bg);
+}
+
+float k_means_segmentation(const unsigned short *depthimage,
+                           int width, const image_roi &roi,
+                           bool *foreground,
+                           double *centroid_fg, double *centroid_bg)
+{
 
         // Segments a depth map with k-means (k = 2) clustering. The result is
         // stored in foreground, which is a pre-allocated array assumed to be 
@@ -33,11 +42,11 @@ float k_means_segmentation(unsigned short *depthimage,
     // !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
 	unsigned short depth_min, depth_max;
 	unsigned short cur_centroid_fg, cur_centroid_bg, pre_centroid_fg, pre_centroid_bg;
-	for(int i=0; i<npts; i++)
+	for(roi_iterator i(roi, width); !i.done(); ++i)
 		if(depthimage[i] != 0)
 			depth_min = depth_max = depthimage[i];
 
-	for(int i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimage[i] == 0)
 			continue;
 		else{
@@ -65,7 +74,7 @@ float k_means_segmentation(unsigned short *depthimage,
 		pre_centroid_bg = cur_centroid_bg;
 
 
-		for(int i=0; i<npts; i++){
+		for(roi_iterator i(roi, width); !i.done(); ++i){
 			if(depthimage[i] != 0){	
 				comp1 = pow(cur_centroid_fg-depthimage[i],2);
 				comp2 = pow(cur_centroid_bg-depthimage[i],2);
@@ -77,7 +86,7 @@ float k_means_segmentation(unsigned short *depthimage,
 			}	
 		}
 
-		for(int i=0; i<npts; i++){
+		for(roi_iterator i(roi, width); !i.done(); ++i){
 			if(depthimage[i] != 0){
 				if(foreground[i]){
 					sum_fg += depthimage[i];
@@ -115,3 +124,74 @@ float k_means_segmentation(unsigned short *depthimage,
 	else
 		return 0.0;
 }
+
+float k_means_segmentation(const histogram &hist,
+                           double *centroid_fg, double *centroid_bg,
+                           cluster_control *control)
+{
+	int nbins = hist.get_n_bins();
+	double depth0 = hist.get_min(), binsize = hist.get_bin_size();
+
+	// Start from the smallest and largest depths, as the pixel version
+	int first = 0, last = nbins - 1;
+	while(first < nbins && hist[first] == 0)
+		first++;
+	while(last > first && hist[last] == 0)
+		last--;
+	if(first == nbins)
+		return 0.0;
+
+	unsigned short cur_centroid_fg = (unsigned short)(depth0 + first*binsize);
+	unsigned short cur_centroid_bg = (unsigned short)(depth0 + last*binsize);
+	unsigned short pre_centroid_fg, pre_centroid_bg;
+
+	// Or from the centroids of the last frame
+	if(control && control->warm_start && centroid_fg && centroid_bg &&
+	   *centroid_fg > 0 && *centroid_fg <= *centroid_bg &&
+	   *centroid_bg <= depth0 + last*binsize){
+		cur_centroid_fg = (unsigned short)*centroid_fg;
+		cur_centroid_bg = (unsigned short)*centroid_bg;
+	}
+
+	cluster_control_start(control);
+	do{
+		pre_centroid_fg = cur_centroid_fg;
+		pre_centroid_bg = cur_centroid_bg;
+
+		double sum_fg = 0.0, sum_bg = 0.0;
+		double count_fg = 0, count_bg = 0;
+		for(int b = first; b <= last; b++){
+			if(hist[b] == 0)
+				continue;
+
+			double depth = depth0 + b*binsize;
+			double comp1 = (cur_centroid_fg - depth)*(cur_centroid_fg - depth);
+			double comp2 = (cur_centroid_bg - depth)*(cur_centroid_bg - depth);
+			if(comp1 <= comp2){
+				sum_fg += hist[b]*depth;
+				count_fg += hist[b];
+			}
+			else{
+				sum_bg += hist[b]*depth;
+				count_bg += hist[b];
+			}
+		}
+
+		if(count_fg != 0)
+			cur_centroid_fg = (unsigned short)(sum_fg / count_fg);
+		if(count_bg != 0)
+			cur_centroid_bg = (unsigned short)(sum_bg / count_bg);
+	}while(cluster_control_next(control, pre_centroid_fg == cur_centroid_fg &&
+	                                     pre_centroid_bg == cur_centroid_bg));
+
+	if (centroid_fg)
+		*centroid_fg = cur_centroid_fg;
+
+	if (centroid_bg)
+		*centroid_bg = cur_centroid_bg;
+
+	if(centroid_fg && centroid_bg)
+		return (cur_centroid_fg + cur_centroid_bg)/2;
+	else
+		return 0.0;
+}
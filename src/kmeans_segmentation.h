@@ -10,6 +10,10 @@
 #ifndef K_MEANS_SEGMENTATION_H
 #define K_MEANS_SEGMENTATION_H
 
+#include "cluster_control.h"
+#include "histogram.h"
+#include "roi.h"
+
 /**
  * Segments a depth map with k-means (k = 2) clustering. The result is
  * stored in foreground, which is a pre-allocated array assumed to be 
@@ -23,9 +27,31 @@
  *
  * !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
  */
-float k_means_segmentation(unsigned short *depthimage,
+float k_means_segmentation(const unsigned short *depthimage,
                            int npts,
                            bool *foreground,
                            double *centroid1 = 0, double *centroid2 = 0);
 
+// The same, only for the pixels inside roi of a depth map with the given
+// width. foreground is not modified outside roi.
+float k_means_segmentation(const unsigned short *depthimage,
+                           int width, const image_roi &roi,
+                           bool *foreground,
+                           double *centroid1 = 0, double *centroid2 = 0);
+
+// The same k-means, run on the depth histogram of the pixels instead of on
+// the pixels themselves, so each iteration only goes over the bins. The
+// depth of the pixels in a bin is taken to be the start of the bin, so
+// with a bin per depth value (see MAX_DEPTH) this finds the same threshold
+// and centroids as the pixel version. The pixels are left for the caller
+// to threshold.
+//
+// If control is not NULL and asks for a warm start, valid centroids passed
+// in centroid1 and centroid2 are used as the initial centroids instead of
+// the smallest and largest depths. The iterations are bounded by the budget
+// of control, and reported back in it.
+float k_means_segmentation(const histogram &hist,
+                           double *centroid1 = 0, double *centroid2 = 0,
+                           cluster_control *control = 0);
+
 #endif // K_MEANS_SEGMENTATION_H
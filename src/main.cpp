@@ -7,8 +7,10 @@
 *
 ****************************************************************************/
 
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -21,19 +23,30 @@
 
 #include <opencv2/core/core.hpp>
 
+#include "BackgroundModel.h"
 #include "CrossSections.h"
+#include "depth_labelling.h"
 #include "FitEllipse.h"
 #include "kmeans_color.h"
 #include "gmm_color.h"
 #include "gmm_segmentation.h"
 #include "histogram.h"
+#include "CaptureThread.h"
+#include "ChangeDetector.h"
+#include "connected_components.h"
+#include "DepthProjection.h"
 #include "KinectInterface.h"
+#include "PipelineStats.h"
+#include "SessionFile.h"
 #include "kmeans_segmentation.h"
+#include "otsu_segmentation.h"
 #include "threshold.h"
 #include "mincut_segmentation.h"
 #include "PlanePointCloudIntersect.h"
 #include "AngularSkeleton.h"
 #include "Skeleton.h"
+#include "pyramid.h"
+#include "roi.h"
 
 #ifndef M_PI
 #define M_PI 3.1415926535
@@ -47,6 +60,9 @@ enum
     MENU_ID_MANUAL_THRESHOLDING,
     MENU_ID_KMEANS_THRESHOLDING,
     MENU_ID_GMM_THRESHOLDING,
+    MENU_ID_OTSU_THRESHOLDING,
+    MENU_ID_BACKGROUND_THRESHOLDING,
+    MENU_ID_SKELETON_THRESHOLDING,
     
     MENU_ID_SEGMENTED_IMAGE,
     MENU_ID_COLOR_CODED,
@@ -54,16 +70,27 @@ enum
     MENU_ID_COLOR_CLUSTERS,
 
     MENU_ID_SEGMENTATION_THRESHOLD,
-    MENU_ID_SEGMENTATION_MINCUT
+    MENU_ID_SEGMENTATION_MINCUT,
+
+    MENU_ID_FULL_RESOLUTION,
+    MENU_ID_HALF_RESOLUTION,
+    MENU_ID_QUARTER_RESOLUTION
 };
 
 enum
 {
     THRESHOLD_MANUAL,
     THRESHOLD_KMEANS,
-    THRESHOLD_GMM
+    THRESHOLD_GMM,
+    THRESHOLD_OTSU,
+    THRESHOLD_BACKGROUND,
+    THRESHOLD_SKELETON
 };
 
+// The names of the thresholding methods on the command line
+const char *threshold_names[] = {"manual", "kmeans", "gmm", "otsu",
+                                 "background", "skeleton"};
+
 enum
 {
     SEGMENTATION_THRESHOLD,
@@ -73,13 +100,36 @@ enum
 int threshold_method = THRESHOLD_KMEANS;
 int segmentation_method = SEGMENTATION_THRESHOLD;
 
+// The thresholding method skeleton thresholding falls back to for a user
+// without a skeleton: manual, kmeans, gmm or otsu
+int skeleton_fallback = THRESHOLD_KMEANS;
+
 // Glut window ids
 int mainWindow, histogramWindow;
 
 // The current window size
 int windowWidth = 640, windowHeight = 480;
 
-KinectInterface *kinectIface;
+// Where the frames come from: the kinect, or a recorded session
+FrameSource *frameSource;
+
+// The thread grabbing the kinect frames, if frameSource is one
+CaptureThread *captureThread;
+
+// How long idle() waits for the capture thread to grab a frame, in
+// milliseconds. It is about a frame of the kinect, so the window keeps
+// handling its events while the kinect is slow.
+#define IDLE_WAIT_MS 33
+
+// If not NULL, the frames we process are recorded to this session
+SessionRecorder *recorder;
+
+// Command line options
+const char *replay_filename = 0;
+const char *record_filename = 0;
+bool compress_recording = false;
+bool headless = false;
+bool capture_thread = true;
 
 // Depth image size
 int imageWidth = 480;
@@ -88,25 +138,22 @@ int imageHeight = 640;
 // The total number of pixels
 int npts;
 
-unsigned short *depthImage;     // we keep our own copy of the depth image
-const XnUInt8 *rgbImage;        // this is just a pointer to OpenNI's rgb image
+// The frame we are processing. We hold references to the source's buffers
+// so they stay alive until we are done with them, and work on them in place.
+FrameRef depthFrame, rgbFrame;
+const unsigned short *depthImage;
+const unsigned char *rgbImage;
 
-// The points of the depth image linearized after the segmentation
-std::vector<cv::Vec3d> point_cloud;
+// The latency and the dropped frames of the pipeline
+PipelineStats pipelineStats;
 
-// The user sleketon
-std::vector<cv::Vec3d> joints;
-std::vector<cv::Vec2d> joints_projected;
+// Converts the depth pixels to real world points
+DepthProjection depthProjection;
 
-std::vector<cv::Vec2d> cross_sections[NUM_CS];
+// The depth of the background of every pixel, for background thresholding
+BackgroundModel backgroundModel;
 
 #define NUM_CS_ORIENTATIONS 4
-bool cs_orientation_filled[NUM_CS_ORIENTATIONS];
-   
-// The planes defining each body cross section
-cv::Vec3d N[NUM_CS], O[NUM_CS], X[NUM_CS], Y[NUM_CS];
-
-int posecount = 0;
 
 struct ellipse
 {
@@ -115,39 +162,211 @@ struct ellipse
     double theta;
 };
 
-// The best fitting ellipse of each section
-ellipse ellipses[NUM_CS];
+// The settings a segmentation depends on. A user is segmented from scratch
+// when they change.
+struct segmentation_settings
+{
+    int threshold_method, segmentation_method, pyramid_level;
+    int n_color_clusters, gamma, filter;
+    float threshold;
+    bool isolate;
+
+    bool operator==(const segmentation_settings &s) const
+    {
+        return threshold_method == s.threshold_method &&
+               segmentation_method == s.segmentation_method &&
+               pyramid_level == s.pyramid_level &&
+               n_color_clusters == s.n_color_clusters &&
+               gamma == s.gamma && filter == s.filter &&
+               threshold == s.threshold && isolate == s.isolate;
+    }
+};
+
+// How far around the skeleton of a user its region of interest goes, in
+// millimeters. The joints are inside the body, and the head and the hands
+// reach past them.
+#define USER_ROI_MARGIN 300
+
+// How far from the projected torso joint the blob of a user is looked for,
+// in pixels at full resolution, when the joint falls on a hole
+#define USER_BLOB_SEED_RADIUS 16
+
+// How far in front of and behind the joints of a user the depth band of
+// skeleton thresholding goes, in millimeters. The joints are inside the
+// body, and the hands and feet reach past them.
+#define SKELETON_BAND_MARGIN 250
+
+// How many frames a user the tracker lost is kept for, so its state is
+// still there if the tracker finds it again after a glitch
+#define USER_GRACE_FRAMES 30
+
+// Everything we keep for each user we are measuring
+struct user_state
+{
+    // The OpenNI user id, 0 for the whole image when nobody is tracked
+    unsigned int id;
+
+    // The user sleketon, projected on the image, and projected with y
+    // flipped for drawing it in OpenGL
+    std::vector<cv::Vec3d> joints;
+    std::vector<cv::Vec2d> joints_image;
+    std::vector<cv::Vec2d> joints_projected;
+
+    // The frames since the tracker last saw the user
+    int missing_frames;
+
+    // The part of the image the user is segmented in. Everything outside
+    // prev_roi, the roi of the last frame, is already labelled background.
+    image_roi roi, prev_roi;
+
+    // foreground/background segmentation
+    bool *foreground;
+    unsigned char *trimap;
+    float *prob_foreground;
+
+    unsigned char *segmentedImage;
+    unsigned char *segmentationCmap;    // the segmentation color map
+    unsigned char *clusterCmap;
+
+    // The color space GMMs
+    std::vector<cv::Vec3d> mean[2];
+    std::vector<cv::Matx33d> cov[2];
+    std::vector<double> pi[2];
+    std::vector<cv::Matx33d> inv_cov[2];
+    std::vector<double> det_cov[2];
+
+    unsigned char *cluster;
+
+    // The segmentation of the shrunk frame in pyramid mode, and its
+    // boundary band
+    bool *small_foreground;
+    unsigned char *small_trimap;
+    unsigned char *small_cluster;
+    unsigned char *small_band;
+
+    // The pixels with near_threshold <= depth < threshold are foreground
+    float near_threshold, threshold;
+
+    // The depth histogram of the roi, with a bin per millimeter
+    histogram *depth_hist;
+
+    // Whether the user was segmented already, and with which settings
+    bool segmented;
+    segmentation_settings settings;
+
+    // The parts of the frame that changed since the user was segmented
+    ChangeDetector changes;
+
+    // The foreground of the trimap packed, and its connected components
+    trimap_planes planes;
+    component_labeller blobs;
+
+    // The pixels of the roi split by trimap label, for the color stages
+    pixel_partition pixels;
+
+    // The colors of the pixels of a label binned, for k-means
+    color_histogram color_bins;
+
+    // The k-means bounds of the pixels of each label, from the last frame
+    kmeans_bounds color_bounds[2];
+
+    // For k-means segmentation, mu1 and mu2 are the cluster centroids, and
+    // for Otsu the mean depth on each side of the threshold.
+    // For gaussian mixture, mu and sigma are the gaussian distribution mean
+    // and standard deviation. p is the mixing coefficient.
+    double mu1, sigma1, mu2, sigma2, p;
+
+    // The points of the depth image linearized after the segmentation
+    std::vector<cv::Vec3d> point_cloud;
+
+    std::vector<cv::Vec2d> cross_sections[NUM_CS];
+    bool cs_orientation_filled[NUM_CS_ORIENTATIONS];
+
+    // The planes defining each body cross section
+    cv::Vec3d N[NUM_CS], O[NUM_CS], X[NUM_CS], Y[NUM_CS];
+
+    int posecount;
+
+    // The best fitting ellipse of each section
+    ellipse ellipses[NUM_CS];
+};
+
+// The users in the current frame. If nobody is being tracked, there is a
+// single user with id 0 covering the whole image.
+std::vector<user_state *> users;
 
-// foreground/background segmentation
-bool *foreground;
-unsigned char *trimap;
-float *prob_foreground;
+// The users that are not in the current frame, for at most
+// USER_GRACE_FRAMES frames
+std::vector<user_state *> lost_users;
 
-unsigned char *segmentedImage;
-unsigned char *segmentationCmap;        // the segmentation color map
-unsigned char *clusterCmap;
+// The user whose segmentation and measurements we display
+unsigned int display_user = 0;
 
+// Only the bin size is used, as the step of the manual threshold. The
+// thresholding methods histogram the roi of each user on their own.
 histogram *hist;
 
-// The color space GMMs
-std::vector<cv::Vec3d> mean[2];
-std::vector<cv::Matx33d> cov[2];
-std::vector<double> pi[2];
-std::vector<cv::Matx33d> inv_cov[2];
-std::vector<double> det_cov[2];
 int n_color_clusters = 4;
 
-unsigned char *cluster;
-
+// Run the depth thresholding methods on the depth histogram of the users
+// instead of on their pixels
+bool histogram_thresholding = true;
+
+// Run k-means in color space on a histogram of the colors of the pixels
+// instead of on the pixels
+bool histogram_clustering = true;
+
+// When clustering the pixels, skip the distances Hamerly's bounds rule out
+bool bounded_clustering = false;
+
+// The depth clustering of a user starts from the model of its last frame,
+// and runs for at most max_cluster_iterations iterations and
+// max_cluster_time seconds (0 for no limit)
+bool warm_start = true;
+int max_cluster_iterations = 20;
+double max_cluster_time = 0;
+
+// How many times the depth of a user was clustered, and the iterations
+// that took in total
+int depth_clusterings, depth_cluster_iterations;
+
+// The color k-means of both labels of a user share a budget of at most
+// max_color_iterations iterations each and max_color_time seconds per
+// frame (0 for no limit). Out of budget, they keep the centroids so far.
+int max_color_iterations = 0;
+double max_color_time = 0;
+
+// How many labels were clustered in color, the iterations and
+// microseconds that took in total, and how many ran out of budget
+int color_clusterings, color_cluster_iterations, color_cluster_stops;
+long long color_cluster_usec;
+
+// Pyramid mode: segment the frame shrunk by 2^pyramid_level, and only
+// relabel a thin band around the boundary at full resolution
+#define MAX_PYRAMID_LEVEL 2
+int pyramid_level = 0;
+
+// The shrunk frame, and the level it was shrunk to
+int smallLevel, smallWidth, smallHeight;
+unsigned short *depthSmall;
+unsigned char *rgbSmall;
+
+// The manual threshold
 float threshold = 3000;
 int user_gamma = 50;
 int user_filter = 1;
 int user_epsilon = 5;
 
-// For k-means segmentation, mu1 and mu2 are the cluster centroids.
-// For gaussian mixture, mu and sigma are the gaussian distribution mean
-// and standard deviation. p is the mixing coefficient.
-double mu1, sigma1, mu2, sigma2, p;
+// Static scene detection: only segment again the parts of a user that
+// changed since the last time, and skip the frame if nothing did
+bool detect_static_scene = true;
+
+// How many times a user was segmented in full, in part, or skipped
+int frames_segmented, frames_resegmented, frames_skipped;
+
+// Only keep the foreground connected to the torso of each user, dropping
+// the furniture and the other people closer than the threshold
+bool isolate_user_blob = true;
 
 enum
 {
@@ -162,6 +381,12 @@ enum
 // the original rgb image).
 int display_image = 0;
 
+// The segmentation color map colors of the background, the foreground and
+// the pixels with undefined depth
+const unsigned char segmentation_colors[3][3] = {{0, 0, 255},
+                                                 {255, 0, 0},
+                                                 {255, 255, 0}};
+
 // The texture ids for the 4 possible images we display on the left pane
 GLuint texture[4];
 
@@ -175,7 +400,7 @@ void menuSelected(int id);
 void selectDisplay(int id);
 
 void DrawKinectData();
-void updateKinectData();
+bool updateKinectData();
 
 void initGL(void)
 {
@@ -207,190 +432,639 @@ void initTextures()
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
+
+    // The image rows are tightly packed, whatever the image width is
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 }
 
-void initKinect()
+void initFrameSource()
 {
-    kinectIface = new KinectInterface();
+    if (replay_filename)
+    {
+        SessionPlayer *player = new SessionPlayer();
+        if (!player->open(replay_filename))
+            exit(-1);
+        cout << "Replaying " << player->getFrameCount() << " frames from "
+             << replay_filename << endl;
+        frameSource = player;
+    }
+    else if (capture_thread)
+    {
+        // Grab the kinect frames on their own thread, so a slow frame
+        // doesn't make us drop the next ones
+        captureThread = new CaptureThread(new KinectInterface());
+        if (!captureThread->start())
+        {
+            cerr << "Could not get a frame from the kinect\n";
+            exit(-1);
+        }
+        frameSource = captureThread;
+    }
+    else
+        frameSource = new KinectInterface();
 
-    xn::DepthGenerator &depthGenerator = kinectIface->getDepthGenerator();
-    xn::DepthMetaData depthMD;
-    depthGenerator.GetMetaData(depthMD);
-    
-    imageWidth = depthMD.XRes();
-    imageHeight = depthMD.YRes();
+    imageWidth = frameSource->getWidth();
+    imageHeight = frameSource->getHeight();
+
+    // Recorded sessions store the field of view, so this works the same
+    // way when replaying
+    double hfov, vfov;
+    frameSource->getFieldOfView(&hfov, &vfov);
+    depthProjection.init(imageWidth, imageHeight, hfov, vfov);
+
+    if (record_filename)
+    {
+        recorder = new SessionRecorder();
+        if (!recorder->open(record_filename, *frameSource,
+                            compress_recording))
+            exit(-1);
+    }
 }
 
 void initArrays()
 {
     npts = imageWidth*imageHeight;
 
-    depthImage = new unsigned short[npts];
-    foreground = new bool[npts];
-    prob_foreground = new float[2*npts];
-    segmentationCmap = new unsigned char[3*npts];
-    segmentedImage = new unsigned char[3*npts];
-    
-    clusterCmap = new unsigned char[3*npts];
-    cluster = new unsigned char[npts];
-    trimap = new unsigned char[npts];
+    // Big enough for the first pyramid level
+    int nsmall = pyramid_size(imageWidth, 1)*pyramid_size(imageHeight, 1);
+    depthSmall = new unsigned short[nsmall];
+    rgbSmall = new unsigned char[3*nsmall];
+}
 
-    for (int i = 0; i < NUM_CS_ORIENTATIONS; i++)
-        cs_orientation_filled[i] = false;
+user_state *newUser(unsigned int id)
+{
+    // Value initialized, so the measurements start out zeroed
+    user_state *user = new user_state();
+    user->id = id;
+    user->roi = full_roi(imageWidth, imageHeight);
+    user->prev_roi = user->roi;
+    user->threshold = threshold;
+    user->changes.init(imageWidth, imageHeight);
+    if (bounded_clustering)
+    {
+        user->color_bounds[0].init(npts);
+        user->color_bounds[1].init(npts);
+    }
+    user->depth_hist = new histogram(0, MAX_DEPTH + 1, MAX_DEPTH + 1);
+
+    user->foreground = new bool[npts];
+    // The gmm responsibilities are only stored when thresholding the pixels
+    user->prob_foreground = histogram_thresholding ? 0 : new float[2*npts];
+    user->segmentationCmap = new unsigned char[3*npts];
+    user->segmentedImage = new unsigned char[3*npts];
+
+    user->clusterCmap = new unsigned char[3*npts];
+    user->cluster = new unsigned char[npts];
+    user->trimap = new unsigned char[npts];
+
+    int nsmall = pyramid_size(imageWidth, 1)*pyramid_size(imageHeight, 1);
+    user->small_foreground = new bool[nsmall];
+    user->small_trimap = new unsigned char[nsmall];
+    user->small_cluster = new unsigned char[nsmall];
+    user->small_band = new unsigned char[nsmall];
+
+    return user;
+}
+
+void deleteUser(user_state *user)
+{
+    delete [] user->foreground;
+    delete [] user->prob_foreground;
+    delete [] user->segmentationCmap;
+    delete [] user->segmentedImage;
+    delete [] user->clusterCmap;
+    delete [] user->cluster;
+    delete [] user->trimap;
+    delete [] user->small_foreground;
+    delete [] user->small_trimap;
+    delete [] user->small_cluster;
+    delete [] user->small_band;
+    delete user->depth_hist;
+    delete user;
+}
+
+user_state *findUser(unsigned int id)
+{
+    for (unsigned int i = 0; i < users.size(); i++)
+        if (users[i]->id == id)
+            return users[i];
+    for (unsigned int i = 0; i < lost_users.size(); i++)
+        if (lost_users[i]->id == id)
+            return lost_users[i];
+    return 0;
+}
+
+user_state *displayedUser()
+{
+    if (users.empty())
+        return 0;
+    return users[display_user % users.size()];
+}
+
+// The part of the image around the skeleton of a user. The margin is
+// scaled with the distance of the user to the camera.
+image_roi userROI(const UserSkeleton &skeleton)
+{
+    // Joints the tracker lost are at the origin, and do not project
+    double z = 0;
+    std::vector<cv::Vec2d> points;
+    for (unsigned int i = 0; i < skeleton.joints.size(); i++)
+    {
+        if (skeleton.joints[i][2] <= 0)
+            continue;
+        z += skeleton.joints[i][2];
+        points.push_back(skeleton.joints_projected[i]);
+    }
+    if (points.empty())
+        return full_roi(imageWidth, imageHeight);
+    z /= points.size();
+
+    int margin = (int)depthProjection.toPixels(USER_ROI_MARGIN, z);
+    return bounding_roi(&points[0], points.size(), margin,
+                        imageWidth, imageHeight);
 }
 
-void updateSegmentation()
+// Match the users of the current frame with the ones we are already
+// measuring, so each user keeps its own segmentation and cross sections.
+// The users that are gone are dropped once they have been missing for
+// USER_GRACE_FRAMES frames.
+void updateUsers()
 {
-    if (threshold_method == THRESHOLD_KMEANS)
+    std::vector<UserSkeleton> &skeletons = frameSource->getUsers();
+    std::vector<user_state *> current;
+
+    for (unsigned int s = 0; s < skeletons.size(); s++)
     {
-        threshold = k_means_segmentation(depthImage,
-                        npts, foreground, &mu1, &mu2);
+        user_state *user = findUser(skeletons[s].id);
+        if (!user)
+        {
+            user = newUser(skeletons[s].id);
+            cout << "Measuring user " << user->id << endl;
+        }
+
+        user->missing_frames = 0;
+        user->joints = skeletons[s].joints;
+        user->joints_image = skeletons[s].joints_projected;
+        user->joints_projected = skeletons[s].joints_projected;
+        for (unsigned int i = 0; i < user->joints_projected.size(); i++)
+            user->joints_projected[i][1] = imageHeight - user->joints_projected[i][1];
+        user->roi = userROI(skeletons[s]);
+
+        current.push_back(user);
     }
-    else if (threshold_method == THRESHOLD_GMM)
+
+    // Keep segmenting the whole image when there is no skeleton
+    if (current.empty())
     {
-		threshold = gaussian_mixture_segmentation(depthImage, npts,
-                        prob_foreground, foreground,
-                        &mu1, &sigma1, &mu2, &sigma2, &p);
+        user_state *user = findUser(0);
+        if (!user)
+            user = newUser(0);
+        user->missing_frames = 0;
+        user->joints.clear();
+        user->joints_image.clear();
+        user->joints_projected.clear();
+        current.push_back(user);
     }
-    
-   threshold_depth_map(depthImage, npts, threshold, foreground);
 
-   // Build the trimap
-   for (int i = 0; i < npts; i++)
-       if (depthImage[i] == 0)
-           trimap[i] = TRIMAP_U;
-       else
-           trimap[i] = foreground[i];
+    std::vector<user_state *> lost;
+    for (unsigned int i = 0; i < users.size() + lost_users.size(); i++)
+    {
+        user_state *user = i < users.size() ? users[i]
+                                            : lost_users[i - users.size()];
+        if (std::find(current.begin(), current.end(), user) != current.end())
+            continue;
+        if (++user->missing_frames > USER_GRACE_FRAMES)
+            deleteUser(user);
+        else
+            lost.push_back(user);
+    }
+
+    users.swap(current);
+    lost_users.swap(lost);
+}
+
+// Relabel as background the foreground pixels inside roi that are not
+// connected to the torso of the user, on an image shrunk by 2^level. The
+// blobs are found in user.planes, which labelDepth() leaves holding the
+// trimap. The display images are painted too if segmented and cmap are
+// not NULL. Returns the bounding box of the pixels relabelled.
+image_roi isolateUser(user_state &user, int imageWidth, int level,
+                      const image_roi &roi, bool *foreground,
+                      unsigned char *trimap, unsigned char *segmented,
+                      unsigned char *cmap)
+{
+    image_roi none = {0, 0, 0, 0};
+    if (!isolate_user_blob || (int)user.joints_image.size() <= SKEL_TORSO)
+        return none;
+
+    const cv::Vec2d &torso = user.joints_image[SKEL_TORSO];
+    return isolate_blob(user.blobs, user.planes.foreground, imageWidth, roi,
+                        (int)torso[0] >> level, (int)torso[1] >> level,
+                        USER_BLOB_SEED_RADIUS >> level, foreground, trimap,
+                        segmented, cmap, segmentation_colors);
+}
+
+// Label the pixels inside roi as foreground or background by their depth,
+// against the background model or the depth threshold of the user, and
+// build the trimap, in bytes and in user.planes. The display images are
+// painted too if segmented and cmap are not NULL.
+void labelDepth(user_state &user, const unsigned short *depthImage,
+                const unsigned char *rgbImage, int imageWidth, int imageHeight,
+                const image_roi &roi, bool *foreground, unsigned char *trimap,
+                unsigned char *segmented, unsigned char *cmap)
+{
+    if (user.planes.foreground.get_width() != imageWidth ||
+        user.planes.foreground.get_height() != imageHeight)
+        user.planes.resize(imageWidth, imageHeight);
+
+    if (threshold_method == THRESHOLD_BACKGROUND)
+    {
+        backgroundModel.label(depthImage, roi, foreground, trimap,
+                              &user.planes);
+        if (segmented && cmap)
+            paint_segmentation(depthImage, rgbImage, trimap, imageWidth, roi,
+                               segmented, cmap, segmentation_colors);
+    }
+    else
+        label_depth_band(depthImage, rgbImage, imageWidth, roi,
+                         user.near_threshold, user.threshold, foreground,
+                         trimap, segmented, cmap, segmentation_colors,
+                         &user.planes);
+}
+
+// The depth band the skeleton of a user spans, grown by
+// SKELETON_BAND_MARGIN. False if the user has no skeleton.
+bool skeletonDepthBand(const user_state &user, float *near_depth,
+                       float *far_depth)
+{
+    double zmin = 0, zmax = 0;
+    for (unsigned int i = 0; i < user.joints.size(); i++)
+    {
+        // Joints the tracker lost are at the origin
+        double z = user.joints[i][2];
+        if (z <= 0)
+            continue;
+        if (zmax == 0 || z < zmin)
+            zmin = z;
+        zmax = std::max(zmax, z);
+    }
+    if (zmax == 0)
+        return false;
+
+    *near_depth = std::max(zmin - SKELETON_BAND_MARGIN, 0.0);
+    *far_depth = zmax + SKELETON_BAND_MARGIN;
+    return true;
+}
+
+// Run the segmentation stages of a user on the pixels inside roi of a
+// width x height depth map and rgb image, shrunk by 2^level. The color
+// models of the user carry over from frame to frame. If segmented and cmap
+// are not NULL, the display images are painted from the thresholded depth.
+void segmentImage(user_state &user, const unsigned short *depthImage,
+                  const unsigned char *rgbImage, int imageWidth,
+                  int imageHeight, int level, const image_roi &roi,
+                  bool *foreground,
+                  unsigned char *trimap, unsigned char *cluster,
+                  unsigned char *segmented, unsigned char *cmap)
+{
+    // Only the skeleton band has a near threshold. Without a skeleton it
+    // falls back to skeleton_fallback.
+    int method = threshold_method;
+    user.near_threshold = 0;
+    if (method == THRESHOLD_SKELETON &&
+        !skeletonDepthBand(user, &user.near_threshold, &user.threshold))
+        method = skeleton_fallback;
+
+    // The thresholding methods share the depth histogram of the roi
+    if (method == THRESHOLD_OTSU ||
+        (histogram_thresholding && (method == THRESHOLD_KMEANS ||
+                                    method == THRESHOLD_GMM)))
+        compute_histogram(depthImage, imageWidth, roi, *user.depth_hist);
+
+    cluster_control control = make_cluster_control(warm_start,
+                                                   max_cluster_iterations,
+                                                   max_cluster_time);
+
+    if (method == THRESHOLD_MANUAL)
+        user.threshold = threshold;
+    else if (method == THRESHOLD_KMEANS)
+    {
+        if (histogram_thresholding)
+            user.threshold = k_means_segmentation(*user.depth_hist,
+                                        &user.mu1, &user.mu2, &control);
+        else
+            user.threshold = k_means_segmentation(depthImage,
+                        imageWidth, roi, foreground, &user.mu1, &user.mu2);
+    }
+    else if (method == THRESHOLD_GMM)
+    {
+        if (histogram_thresholding)
+            user.threshold = gaussian_mixture_segmentation(*user.depth_hist,
+                        &user.mu1, &user.sigma1, &user.mu2, &user.sigma2,
+                        &user.p, &control);
+        else
+            user.threshold = gaussian_mixture_segmentation(depthImage,
+                        imageWidth, roi, user.prob_foreground, foreground,
+                        &user.mu1, &user.sigma1, &user.mu2, &user.sigma2,
+                        &user.p);
+    }
+    else if (method == THRESHOLD_OTSU)
+    {
+        user.threshold = otsu_segmentation(*user.depth_hist,
+                                           &user.mu1, &user.mu2);
+    }
+
+    if (control.iterations > 0)
+    {
+        __sync_fetch_and_add(&depth_clusterings, 1);
+        __sync_fetch_and_add(&depth_cluster_iterations, control.iterations);
+    }
+    
+   // Threshold the depth and build the trimap in one pass
+   labelDepth(user, depthImage, rgbImage, imageWidth, imageHeight, roi,
+              foreground, trimap, segmented, cmap);
+
+   // Drop the foreground that is not part of the user, before it goes
+   // into the color models
+   isolateUser(user, imageWidth, level, roi, foreground, trimap, segmented,
+               cmap);
+
+   // The trimap is done: the color stages only go through the pixels of
+   // the label they work on
+   user.pixels.build(trimap, rgbImage, imageWidth, roi);
    
    // Cluster the foreground and background pixels in color space     
+   double color_start = getTime();
    for (int a = 0; a < 2; a++)
    {
+       // What the first label left of the budget goes to the second
+       cluster_control color = make_cluster_control(true,
+                                                    max_color_iterations);
+       if (max_color_time > 0)
+           color.max_time = std::max(max_color_time -
+                                     (getTime() - color_start), 1e-6);
+
        // Run k-means to initialize the gaussian mixture estimation
-       k_means_color((unsigned char *)rgbImage, npts,
-               n_color_clusters, mean[a], cluster, trimap, a);
+       if (histogram_clustering)
+           k_means_color(user.color_bins, user.pixels, a, n_color_clusters,
+                         user.mean[a], cluster, &color);
+       else if (bounded_clustering)
+           k_means_color(user.color_bounds[a], user.pixels, a,
+                         n_color_clusters, user.mean[a], cluster, &color);
+       else
+           k_means_color(user.pixels, a, n_color_clusters, user.mean[a],
+                         cluster, &color);
 
-       if (mean[a].size() != cov[a].size())
+       __sync_fetch_and_add(&color_clusterings, 1);
+       __sync_fetch_and_add(&color_cluster_iterations, color.iterations);
+       __sync_fetch_and_add(&color_cluster_usec,
+                            (long long)(color.elapsed*1e6));
+       if (!color.converged)
+           __sync_fetch_and_add(&color_cluster_stops, 1);
+
+       if (user.mean[a].size() != user.cov[a].size())
        {
-           cov[a].resize(n_color_clusters);
-           inv_cov[a].resize(n_color_clusters);
-           det_cov[a].resize(n_color_clusters);
-           pi[a].resize(n_color_clusters);
+           user.cov[a].resize(n_color_clusters);
+           user.inv_cov[a].resize(n_color_clusters);
+           user.det_cov[a].resize(n_color_clusters);
+           user.pi[a].resize(n_color_clusters);
        }
 
        // Estimate the GMM
-       gmm_color((unsigned char *)rgbImage, npts,
-               mean[a], cov[a], pi[a], inv_cov[a], det_cov[a],
-               cluster, trimap, a);
+       gmm_color(user.pixels, a, user.mean[a], user.cov[a], user.pi[a],
+               user.inv_cov[a], user.det_cov[a], cluster);
    }
 
    // Assign each pixel to a component of the gaussian mixture
-   assign_gmm_component((unsigned char *)rgbImage, npts, foreground, 	 				mean, cov, pi, inv_cov, det_cov, cluster);
+   assign_gmm_component(user.pixels, foreground,
+                        user.mean, user.cov, user.pi, user.inv_cov,
+                        user.det_cov, cluster);
 
     // Refine the segmentation by thresholding with mincut
     if (segmentation_method == SEGMENTATION_MINCUT)
     {
         mincut_segmentation((unsigned char *)rgbImage, imageWidth, imageHeight,
-                            trimap, foreground, cluster, n_color_clusters,
-                            mean, cov, pi, inv_cov, det_cov, user_gamma, user_filter);
+                            roi, user.pixels, trimap, foreground, cluster,
+                            n_color_clusters, user.mean, user.cov, user.pi,
+                            user.inv_cov, user.det_cov, user_gamma,
+                            user_filter);
 
         // Update the trimap using the mincut result, since there are no more
-        // pixels with undefined depth
-        for (int i = 0; i < npts; i++)
+        // pixels with undefined depth. The planes follow, for the partial
+        // labelling of the next frames.
+        for (roi_iterator i(roi, imageWidth); !i.done(); ++i)
             trimap[i] = foreground[i];
+        user.planes.pack(trimap, roi);
     }
+}
+
+// Label again the pixels inside roi at full resolution, keeping the
+// threshold and the color models of the last frame. Returns the part of
+// the user roi that was labelled, which grows past roi if the changes
+// disconnected some of the foreground from the user.
+image_roi resegmentImage(user_state &user, const image_roi &roi,
+                         unsigned char *segmented, unsigned char *cmap)
+{
+    labelDepth(user, depthImage, rgbImage, imageWidth, imageHeight, roi,
+               user.foreground, user.trimap, segmented, cmap);
+
+    // The connections of the changed pixels go through the whole user. The
+    // planes outside roi still hold the trimap of the last frame.
+    image_roi relabelled = isolateUser(user, imageWidth, 0, user.roi,
+                                       user.foreground, user.trimap,
+                                       segmented, cmap);
+
+    if (user.mean[0].empty() || user.mean[1].empty())
+        return roi_union(roi, relabelled);
 
-    // Create the segmented image by painting in black the pixels with
-    // either an invalid depth or in the background
-    const XnUInt8 *pImage = rgbImage;
-    unsigned char *pSegmented = segmentedImage;
-    unsigned char *pTrimap = trimap;
-    for (int i = 0; i < npts; i++, pImage+=3, pSegmented+=3, pTrimap++)
+    user.pixels.build(user.trimap, rgbImage, imageWidth, roi);
+    assign_gmm_component(user.pixels, user.foreground,
+                         user.mean, user.cov, user.pi, user.inv_cov,
+                         user.det_cov, user.cluster);
+
+    if (segmentation_method == SEGMENTATION_MINCUT)
     {
-        if (*pTrimap == 1)
-        {
-            pSegmented[0] = pImage[0];
-            pSegmented[1] = pImage[1];
-            pSegmented[2] = pImage[2];
-        }
-        else
+        mincut_segmentation((unsigned char *)rgbImage, imageWidth, imageHeight,
+                            roi, user.pixels, user.trimap, user.foreground,
+                            user.cluster,
+                            n_color_clusters, user.mean, user.cov, user.pi,
+                            user.inv_cov, user.det_cov, user_gamma,
+                            user_filter);
+
+        for (roi_iterator i(roi, imageWidth); !i.done(); ++i)
+            user.trimap[i] = user.foreground[i];
+        user.planes.pack(user.trimap, roi);
+    }
+    return roi_union(roi, relabelled);
+}
+
+segmentation_settings currentSettings()
+{
+    segmentation_settings s;
+    s.threshold_method = threshold_method;
+    s.segmentation_method = segmentation_method;
+    s.pyramid_level = smallLevel;
+    s.n_color_clusters = n_color_clusters;
+    s.gamma = user_gamma;
+    s.filter = user_filter;
+    s.threshold = threshold;
+    s.isolate = isolate_user_blob;
+    return s;
+}
+
+void updateSegmentation(user_state &user)
+{
+    bool *foreground = user.foreground;
+    unsigned char *trimap = user.trimap;
+    unsigned char *cluster = user.cluster;
+
+    // Only the pixels inside the roi of the user are segmented, and of
+    // those only the ones inside solve need to be labelled again
+    image_roi &roi = user.roi;
+    image_roi solve = roi;
+    bool partial = false;
+
+    segmentation_settings settings = currentSettings();
+    if (detect_static_scene && user.segmented && settings == user.settings)
+    {
+        // The skeleton jitters even when the user stands still, so keep
+        // the last roi unless the new one grows out of it or shrinks a lot
+        if (user.prev_roi.contains(roi) &&
+            2*roi.area() > user.prev_roi.area())
+            roi = user.prev_roi;
+
+        image_roi changed = user.changes.findChanges(depthImage, rgbImage,
+                                        roi_union(roi, user.prev_roi));
+        if (roi == user.prev_roi)
         {
-            pSegmented[0] = 0;
-            pSegmented[1] = 0;
-            pSegmented[2] = 0;
+            if (changed.empty())
+            {
+                // Nothing moved: the segmentation, the models and the
+                // point cloud of the last frame still hold
+                __sync_fetch_and_add(&frames_skipped, 1);
+                return;
+            }
+
+            // Small changes are labelled again with the models we have.
+            // In pyramid mode the whole roi is segmented again anyway.
+            if (smallLevel == 0 && 2*changed.area() < roi.area())
+            {
+                solve = roi_intersection(changed, roi);
+                partial = true;
+            }
         }
     }
 
-    // Color code the segmentation
-    unsigned char colors[3][3] = {{0, 0, 255},
-                                  {255, 0, 0},
-                                  {255, 255, 0}};
-    unsigned char *pSegCmap = segmentationCmap;
-    for (int i = 0; i < npts; i++, pSegCmap += 3)
+    // Label the pixels that left the roi as background
+    const bool bg = false;
+    const unsigned char bg_trimap = TRIMAP_BG;
+    const unsigned char black[3] = {0, 0, 0};
+    fill_roi_difference(foreground, imageWidth, 1, user.prev_roi, roi, &bg);
+    fill_roi_difference(trimap, imageWidth, 1, user.prev_roi, roi, &bg_trimap);
+    fill_roi_difference(user.segmentedImage, imageWidth, 3, user.prev_roi, roi,
+                        black);
+    fill_roi_difference(user.segmentationCmap, imageWidth, 3, user.prev_roi,
+                        roi, segmentation_colors[TRIMAP_BG]);
+    fill_roi_difference(user.clusterCmap, imageWidth, 3, user.prev_roi, roi,
+                        black);
+    user.prev_roi = roi;
+
+    if (roi.empty())
     {
-        for (int j = 0; j < 3; j++)
-            pSegCmap[j] = colors[trimap[i]][j];
+        user.point_cloud.clear();
+        user.segmented = false;
+        return;
+    }
 
-        // Make the color darker if it came from a depth = 0 region
-        if (depthImage[i] == 0)
-            for (int j = 0; j < 3; j++)
-                pSegCmap[j] *= 3.0/4;
+    // When thresholding at full resolution, the labels of the depth pass
+    // are final, so the display images are painted in the same pass
+    bool paint = segmentation_method == SEGMENTATION_THRESHOLD &&
+                 (partial || smallLevel == 0);
+    unsigned char *segmented = paint ? user.segmentedImage : 0;
+    unsigned char *cmap = paint ? user.segmentationCmap : 0;
+
+    if (partial)
+        solve = resegmentImage(user, solve, segmented, cmap);
+    else if (smallLevel == 0)
+        segmentImage(user, depthImage, rgbImage, imageWidth, imageHeight, 0,
+                     roi, foreground, trimap, cluster, segmented, cmap);
+    else
+    {
+        // Segment the shrunk frame, scale the result up, and label again
+        // the pixels around the boundary from the full resolution frame
+        image_roi small_roi = pyramid_down_roi(roi, smallLevel,
+                                               smallWidth, smallHeight);
+        segmentImage(user, depthSmall, rgbSmall, smallWidth, smallHeight,
+                     smallLevel, small_roi, user.small_foreground,
+                     user.small_trimap, user.small_cluster, 0, 0);
+
+        pyramid_boundary_band(user.small_foreground, smallWidth, small_roi,
+                              user.small_band);
+        pyramid_up_segmentation(user.small_foreground, user.small_trimap,
+                                user.small_cluster, smallWidth, smallHeight,
+                                smallLevel, imageWidth, roi,
+                                foreground, trimap, cluster);
+        pyramid_refine_band(depthImage, rgbImage, imageWidth, roi, smallLevel,
+                            user.small_band, smallWidth, smallHeight,
+                            user.near_threshold, user.threshold,
+                            segmentation_method == SEGMENTATION_MINCUT,
+                            user.mean, user.inv_cov, user.pi, user.det_cov,
+                            foreground, trimap, cluster);
     }
-    
+
+    user.changes.accept(depthImage, rgbImage, solve);
+    user.segmented = true;
+    user.settings = settings;
+    __sync_fetch_and_add(partial ? &frames_resegmented : &frames_segmented, 1);
+
+    // Paint the segmented image and the color coded segmentation, unless
+    // the labelling pass already did
+    if (!paint)
+        paint_segmentation(depthImage, rgbImage, trimap, imageWidth, solve,
+                           user.segmentedImage, user.segmentationCmap,
+                           segmentation_colors);
+
     // Create the color clusters image by coloring each cluster with the
     // color of the cluster centroid
-    pImage = rgbImage;
-    unsigned char *pClusterCmap = clusterCmap;
-    for (int i = 0; i < npts; i++, pImage+=3, pClusterCmap+=3)
+    for (roi_iterator i(solve, imageWidth); !i.done(); ++i)
     {
+        unsigned char *pClusterCmap = user.clusterCmap + 3*i;
         // Compute the color of each pixel as the weighted average of
         // cluster centroids, weighted by the probability that it belongs
         // to each cluster
         cv::Vec3d rgb;
         if (trimap[i] == TRIMAP_U)
             rgb = cv::Vec3d(255,255,0);
-        else if (mean[0].size() == 0)// || foreground[i] == 0)
+        else if (user.mean[0].size() == 0)// || foreground[i] == 0)
             rgb = cv::Vec3d(0,0,0);
         else
-            rgb = mean[foreground[i]][cluster[i]];
+            rgb = user.mean[foreground[i]][cluster[i]];
 
         pClusterCmap[0] = (unsigned char)rgb(0);
         pClusterCmap[1] = (unsigned char)rgb(1);
         pClusterCmap[2] = (unsigned char)rgb(2);
     }
 
-    // Collect the points selected by the segmentation
-    unsigned short *pDepth = depthImage;
-    pTrimap = trimap;
-    point_cloud.clear();
-    xn::DepthGenerator &depthGenerator = kinectIface->getDepthGenerator();
-    for (int y = 0; y < imageHeight; y++)
-    {
-        for (int x = 0; x < imageWidth; x++, pDepth++, pTrimap++)
-        {
-            if (*pTrimap == TRIMAP_FG && *pDepth)
-            {
-                XnPoint3D P;
-                P.X = x;
-                P.Y = y;
-                P.Z = *pDepth;
-                depthGenerator.ConvertProjectiveToRealWorld(1, &P, &P);
-                point_cloud.push_back(cv::Vec3d(P.X, P.Y, P.Z));
-            }
-        }
-    }
+    // Collect the points of the user selected by the segmentation
+    depthProjection.toPointCloud(depthImage, trimap, TRIMAP_FG, user.roi,
+                                 user.point_cloud);
+}
 
-    // Upload the new segmented image textures
+// Upload the segmented image textures of the user we are displaying.
+// OpenGL may only be called from the main thread.
+void uploadSegmentationTextures(user_state &user)
+{
     glBindTexture(GL_TEXTURE_2D, texture[TEXTURE_ID_COLOR_CODED_IMAGE]);
-    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, 640, 480, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, segmentationCmap);
+    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, user.segmentationCmap);
     
     glBindTexture(GL_TEXTURE_2D, texture[TEXTURE_ID_SEGMENTED_IMAGE]);
-    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, 640, 480, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, segmentedImage);
+    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, user.segmentedImage);
     
     glBindTexture(GL_TEXTURE_2D, texture[TEXTURE_ID_COLOR_CLUSTERS]);
-    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, 640, 480, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, clusterCmap);
+    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, user.clusterCmap);
 }
 
 bool too_far(cv::Vec2d v)
@@ -405,15 +1079,15 @@ void RotationToEuler(cv::Matx33d &R, double *yaw, double *pitch, double *roll)
     *roll = atan2(R(2,1), R(2,2));
 }
 
-void computeSkeletonAngularRepresentation()
+void computeSkeletonAngularRepresentation(user_state &user)
 {
-   if (joints.size() == 0)
+   if (user.joints.size() == 0)
         return;
 
    // Transform the 19 3D joint positions into 16 angles
    std::vector<double> angles;
    cv::Vec3d axis[3];
-   computeSkeletonAngularRepresentation(joints, angles, axis);
+   computeSkeletonAngularRepresentation(user.joints, angles, axis);
    
    // Print the skeleton angular representatioin for debugging
    //printf("Skeleton Angular Representation:\n");
@@ -436,8 +1110,8 @@ void computeSkeletonAngularRepresentation()
    {
        if (matchAngularPose(angles, poses[i]))
        {
-            posecount++;
-            printf("%s\n", poses_names[i]);
+            user.posecount++;
+            printf("User %u: %s\n", user.id, poses_names[i]);
             bin = poses_bin[i];
             match = true;
             break;
@@ -445,31 +1119,32 @@ void computeSkeletonAngularRepresentation()
    }
    if (!match)
    {
-        posecount = 0;
+        user.posecount = 0;
         return;
    }
 
-   if (posecount < 10 || cs_orientation_filled[bin])
+   if (user.posecount < 10 || user.cs_orientation_filled[bin])
         return;
    
-   cs_orientation_filled[bin] = true;
+   user.cs_orientation_filled[bin] = true;
 
    // Compute the planes where we will "cut" the body for measurement
-   ComputeCrossSections(joints, axis, O, N, X, Y);
+   ComputeCrossSections(user.joints, axis, user.O, user.N, user.X, user.Y);
     
    // Intersect each plane with the point cloud
    for (int i = 0; i < NUM_CS; i++)
    {
         std::vector<cv::Vec2d> new_points;
-        PlanePointCloudIntersect(point_cloud, O[i], N[i], X[i], Y[i], new_points, user_epsilon);
+        PlanePointCloudIntersect(user.point_cloud, user.O[i], user.N[i], user.X[i], user.Y[i], new_points, user_epsilon);
 
-        cross_sections[i].insert(cross_sections[i].end(), new_points.begin(), new_points.end());
+        user.cross_sections[i].insert(user.cross_sections[i].end(), new_points.begin(), new_points.end());
    }
 
    // Fit ellipses to the cross sections
+   ellipse *ellipses = user.ellipses;
    for (int i = 0; i < NUM_CS; i++)
    {
-        FitEllipse(cross_sections[i], &ellipses[i].sx, &ellipses[i].sy, &ellipses[i].theta, &ellipses[i].center);
+        FitEllipse(user.cross_sections[i], &ellipses[i].sx, &ellipses[i].sy, &ellipses[i].theta, &ellipses[i].center);
         //printf("ellipse[%d]:\n", i);
         //printf("sx[%d] = %lf\n", i, ellipses[i].sx);
         //printf("sy[%d] = %lf\n", i, ellipses[i].sy);
@@ -480,7 +1155,7 @@ void computeSkeletonAngularRepresentation()
 
 void display()
 {
-    if (!kinectIface)
+    if (!frameSource)
         return;
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -524,8 +1199,12 @@ double length(ellipse &e)
 
 void display_cross_sections()
 {
-    if (!hist)
+    user_state *user = displayedUser();
+    if (!hist || !user)
         return;
+
+    std::vector<cv::Vec2d> *cross_sections = user->cross_sections;
+    ellipse *ellipses = user->ellipses;
             
     glViewport(0, 0, windowWidth/2, windowHeight);
 
@@ -635,16 +1314,24 @@ void DrawKinectData()
     glTexCoord2d(0.0,0.0); glVertex2d(0.0,1.0);
     glEnd();
 
-    // Draw the projected joints
+    // Draw the projected joints of every user, the one we are displaying
+    // in red
     glDisable(GL_TEXTURE_2D);
     glPointSize(10);
 
     glPushMatrix();
     glScalef(1.0/imageWidth, 1.0/imageHeight, 1.0);
-    glColor3f(1.0, 0.0, 0.0);
     glBegin(GL_POINTS);
-    for (unsigned int i = 0; i < joints_projected.size(); i++)
-        glVertex2d(joints_projected[i][0], joints_projected[i][1]);
+    for (unsigned int u = 0; u < users.size(); u++)
+    {
+        std::vector<cv::Vec2d> &joints_projected = users[u]->joints_projected;
+        if (users[u] == displayedUser())
+            glColor3f(1.0, 0.0, 0.0);
+        else
+            glColor3f(0.0, 1.0, 0.0);
+        for (unsigned int i = 0; i < joints_projected.size(); i++)
+            glVertex2d(joints_projected[i][0], joints_projected[i][1]);
+    }
     glEnd();
     glPopMatrix();
 
@@ -682,6 +1369,15 @@ void click(int x, int y)
 {
 }
 
+// Whether the manual threshold is used, directly or as the fallback of
+// skeleton thresholding
+bool manualThreshold()
+{
+    return threshold_method == THRESHOLD_MANUAL ||
+           (threshold_method == THRESHOLD_SKELETON &&
+            skeleton_fallback == THRESHOLD_MANUAL);
+}
+
 void keyboard(unsigned char key, int x, int y)
 {
 	int matrix;
@@ -690,13 +1386,16 @@ void keyboard(unsigned char key, int x, int y)
         case 27: // ESC
         case 'q':
         case 'Q':
+            // Finish the session file so it gets its frame index
+            if (recorder)
+                recorder->close();
             exit(0);
         case '+':
-            if (threshold_method == THRESHOLD_MANUAL)
+            if (manualThreshold())
                 threshold += hist->get_bin_size(); // mm
             break;
         case '-':
-            if (threshold_method == THRESHOLD_MANUAL)
+            if (manualThreshold())
                 threshold -= hist->get_bin_size(); // mm
             break;
 		case 'G':
@@ -727,6 +1426,41 @@ void keyboard(unsigned char key, int x, int y)
 				user_epsilon--;
 			cout << "epsilon : " << user_epsilon << endl;
 			break;
+        case 'p':
+        case 'P':
+            pyramid_level = (pyramid_level + 1) % (MAX_PYRAMID_LEVEL + 1);
+            cout << "segmenting at 1/" << (1 << pyramid_level)
+                 << " resolution" << endl;
+            break;
+        case 'u':
+        case 'U':
+            // Display the next user
+            display_user++;
+            if (displayedUser())
+                cout << "displaying user " << displayedUser()->id << endl;
+            break;
+        case 'l':
+        case 'L':
+            pipelineStats.print(stdout);
+            break;
+        case 'b':
+        case 'B':
+            isolate_user_blob = !isolate_user_blob;
+            cout << "user blob isolation "
+                 << (isolate_user_blob ? "on" : "off") << endl;
+            break;
+        case 'r':
+        case 'R':
+            // Learn the background from scratch
+            backgroundModel.init(imageWidth, imageHeight);
+            cout << "background model reset" << endl;
+            break;
+        case 's':
+        case 'S':
+            detect_static_scene = !detect_static_scene;
+            cout << "static scene detection "
+                 << (detect_static_scene ? "on" : "off") << endl;
+            break;
     }
 }
 
@@ -743,6 +1477,15 @@ void menuSelected(int id)
         case MENU_ID_GMM_THRESHOLDING:
             threshold_method = THRESHOLD_GMM;
             break;
+        case MENU_ID_OTSU_THRESHOLDING:
+            threshold_method = THRESHOLD_OTSU;
+            break;
+        case MENU_ID_BACKGROUND_THRESHOLDING:
+            threshold_method = THRESHOLD_BACKGROUND;
+            break;
+        case MENU_ID_SKELETON_THRESHOLDING:
+            threshold_method = THRESHOLD_SKELETON;
+            break;
     }
 }
 
@@ -756,51 +1499,154 @@ void selectSegmentation(int id)
     segmentation_method = id - MENU_ID_SEGMENTATION_THRESHOLD;
 }
 
-void updateKinectData()
+void selectResolution(int id)
 {
-    kinectIface->updateKinectData();
-
-    xn::DepthGenerator &depthGenerator = kinectIface->getDepthGenerator();
-    xn::ImageGenerator &imageGenerator = kinectIface->getImageGenerator();
+    pyramid_level = id - MENU_ID_FULL_RESOLUTION;
+}
 
-    joints = kinectIface->getJoints();
-    joints_projected = kinectIface->getProjectedJoints();
-    for (unsigned int i = 0; i < joints_projected.size(); i++)
-        joints_projected[i][1] = imageHeight - joints_projected[i][1];
+// Grab the next frame from the frame source. Returns false if there are
+// no more frames, or, when capturing on a separate thread, if no new frame
+// arrived since the last call.
+bool updateKinectData()
+{
+    if (!frameSource->update())
+        return false;
 
-    xn::DepthMetaData depthMD;
-    xn::ImageMetaData imageMD;
+    pipelineStats.frameStarted(frameSource->getFrameID(),
+                               frameSource->getCaptureTime());
 
-    depthGenerator.GetMetaData(depthMD);
-    imageGenerator.GetMetaData(imageMD);
+    if (recorder)
+        recorder->writeFrame(*frameSource);
 
-    // Get the RGB image 
-    rgbImage = imageMD.Data();
+    updateUsers();
 
-    // Copy the depth map form OpenNI to our own image
-    unsigned short *pDepthImage = depthImage;
-    const XnDepthPixel *pDepth = depthMD.Data();
-    for (XnUInt y = 0; y < depthMD.YRes(); ++y)
-    {
-        for (XnUInt x = 0; x < depthMD.XRes(); ++x, ++pDepth, ++pDepthImage)
-            *pDepthImage = *pDepth;
-    }
+    // Get the depth and RGB images, without copying them
+    depthFrame = frameSource->getDepthBuffer();
+    rgbFrame = frameSource->getRGBBuffer();
+    depthImage = (const unsigned short *)depthFrame.getData();
+    rgbImage = (const unsigned char *)rgbFrame.getData();
 
-    compute_histogram(depthImage, npts, *hist, true);
+    if (headless)
+        return true;
 
     // Upload the new rgb image texture
     glBindTexture(GL_TEXTURE_2D, texture[TEXTURE_ID_FULL_IMAGE]);
-    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, 640, 480, 0, GL_RGB,
+    glTexImage2D(GL_TEXTURE_2D,  0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB,
                  GL_UNSIGNED_BYTE, rgbImage);
+
+    return true;
+}
+
+// Segment and measure all the users of the current frame. Each user has
+// its own state, so the users are processed in parallel.
+void processUsers()
+{
+    int nusers = users.size();
+
+    // The background is learned from every frame, before the users are
+    // labelled against it
+    if (threshold_method == THRESHOLD_BACKGROUND)
+    {
+        if (backgroundModel.getWidth() != imageWidth ||
+            backgroundModel.getHeight() != imageHeight)
+            backgroundModel.init(imageWidth, imageHeight);
+        backgroundModel.update(depthImage);
+    }
+
+    // Shrink the frame once for all users. The background model is kept at
+    // full resolution, and labelling against it costs less than shrinking.
+    smallLevel = threshold_method == THRESHOLD_BACKGROUND ? 0 : pyramid_level;
+    if (smallLevel > 0)
+    {
+        smallWidth = pyramid_size(imageWidth, smallLevel);
+        smallHeight = pyramid_size(imageHeight, smallLevel);
+        pyramid_down_depth(depthImage, imageWidth, imageHeight, smallLevel,
+                           depthSmall);
+        pyramid_down_rgb(rgbImage, imageWidth, imageHeight, smallLevel,
+                         rgbSmall);
+    }
+
+    #pragma omp parallel for schedule(dynamic) if (nusers > 1)
+    for (int i = 0; i < nusers; i++)
+    {
+        updateSegmentation(*users[i]);
+        computeSkeletonAngularRepresentation(*users[i]);
+    }
+
+    // The measurements of the frame are done
+    pipelineStats.frameFinished();
+
+    if (!headless)
+        uploadSegmentationTextures(*displayedUser());
+}
+
+// Process every frame of the source as fast as possible, without opening
+// any window, and report the throughput
+void runHeadless()
+{
+    int nframes = 0;
+    double start = getTime();
+
+    while (updateKinectData())
+    {
+        processUsers();
+        nframes++;
+    }
+
+    double elapsed = getTime() - start;
+    printf("Processed %d frames in %.3lf s (%.2lf fps)\n",
+           nframes, elapsed, elapsed > 0 ? nframes/elapsed : 0.0);
+    printf("Users segmented: %d in full, %d in part, %d skipped\n",
+           frames_segmented, frames_resegmented, frames_skipped);
+    pipelineStats.print(stdout);
+    if (depth_clusterings > 0)
+        printf("Depth clustering: %.2lf iterations per user frame\n",
+               depth_cluster_iterations/(double)depth_clusterings);
+    if (color_clusterings > 0)
+        printf("Color clustering: %.2lf iterations and %.3lf ms per label, "
+               "%d of %d stopped by the budget\n",
+               color_cluster_iterations/(double)color_clusterings,
+               color_cluster_usec/1000.0/color_clusterings,
+               color_cluster_stops, color_clusterings);
+}
+
+// Give up on a kinect that stopped sending frames, keeping what was
+// recorded so far
+void kinectFailed()
+{
+    cerr << "The kinect stopped sending frames\n";
+    if (recorder)
+        recorder->close();
+    exit(-1);
 }
 
 void idle()
 {
-    if (kinectIface)
+    if (frameSource)
     {
-        updateKinectData();
-        updateSegmentation();
-        computeSkeletonAngularRepresentation();
+        // Sleep until the capture thread has a new frame, instead of
+        // spinning on update()
+        if (captureThread && !captureThread->waitForFrame(IDLE_WAIT_MS))
+        {
+            if (captureThread->hasFailed())
+                kinectFailed();
+            return;
+        }
+
+        // Nothing to do until there is a new frame. A recorded session
+        // that is over keeps showing the last one, and there is nothing
+        // left to wait for. The kinect read on this thread only fails
+        // when the device does.
+        if (!updateKinectData())
+        {
+            if (replay_filename)
+                glutIdleFunc(0);
+            else if (!captureThread)
+                kinectFailed();
+            return;
+        }
+
+        processUsers();
         
         glutSetWindow(histogramWindow);
         glutPostRedisplay();
@@ -810,8 +1656,127 @@ void idle()
     }
 }
 
+// The thresholding method with the given name on the command line, or -1
+int thresholdMethod(const char *name)
+{
+    int n = sizeof(threshold_names)/sizeof(threshold_names[0]);
+    for (int method = 0; method < n; method++)
+        if (!strcmp(name, threshold_names[method]))
+            return method;
+    return -1;
+}
+
+void usage(const char *program)
+{
+    cerr << "Usage: " << program << " [options]\n"
+         << "    --replay <file>    process a recorded session instead of the kinect\n"
+         << "    --record <file>    record the processed frames to a session file\n"
+         << "    --compress         compress the recorded depth and rgb images\n"
+         << "    --headless         process all frames without opening a window\n"
+         << "    --single-thread    grab the kinect frames on the processing thread\n"
+         << "    --pyramid <level>  segment at 1/2^level resolution (0, 1 or 2)\n"
+         << "    --no-static        segment every frame in full, even if nothing moved\n"
+         << "    --all-blobs        keep all the foreground, not only the blob of each user\n"
+         << "    --pixel-thresholding  threshold the depth from the pixels instead of the histogram\n"
+         << "    --pixel-clustering    cluster the colors of the pixels instead of their histogram\n"
+         << "    --bounded-clustering  cluster the colors of the pixels, keeping Hamerly's bounds\n"
+         << "    --threshold <method>  manual, kmeans (default), gmm, otsu,\n"
+         << "                          background or skeleton\n"
+         << "    --skeleton-fallback <method>  the threshold of users without a\n"
+         << "                          skeleton: manual, kmeans (default), gmm or otsu\n"
+         << "    --cold-start       cluster the depth of every frame from scratch\n"
+         << "    --max-iterations <n>  bound the depth clustering iterations (0: no limit)\n"
+         << "    --time-budget <ms>    bound the depth clustering time (0: no limit)\n"
+         << "    --color-iterations <n>  bound the color k-means iterations (0: no limit)\n"
+         << "    --color-budget <ms>     bound the color k-means time per user frame (0: no limit)\n";
+    exit(-1);
+}
+
+void parseCommandLine(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--replay") && i+1 < argc)
+            replay_filename = argv[++i];
+        else if (!strcmp(argv[i], "--record") && i+1 < argc)
+            record_filename = argv[++i];
+        else if (!strcmp(argv[i], "--compress"))
+            compress_recording = true;
+        else if (!strcmp(argv[i], "--headless"))
+            headless = true;
+        else if (!strcmp(argv[i], "--single-thread"))
+            capture_thread = false;
+        else if (!strcmp(argv[i], "--no-static"))
+            detect_static_scene = false;
+        else if (!strcmp(argv[i], "--all-blobs"))
+            isolate_user_blob = false;
+        else if (!strcmp(argv[i], "--pixel-thresholding"))
+            histogram_thresholding = false;
+        else if (!strcmp(argv[i], "--pixel-clustering"))
+            histogram_clustering = false;
+        else if (!strcmp(argv[i], "--bounded-clustering"))
+        {
+            histogram_clustering = false;
+            bounded_clustering = true;
+        }
+        else if (!strcmp(argv[i], "--cold-start"))
+            warm_start = false;
+        else if (!strcmp(argv[i], "--max-iterations") && i+1 < argc)
+            max_cluster_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--time-budget") && i+1 < argc)
+            max_cluster_time = atof(argv[++i])/1000;
+        else if (!strcmp(argv[i], "--color-iterations") && i+1 < argc)
+            max_color_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--color-budget") && i+1 < argc)
+            max_color_time = atof(argv[++i])/1000;
+        else if (!strcmp(argv[i], "--threshold") && i+1 < argc)
+        {
+            threshold_method = thresholdMethod(argv[++i]);
+            if (threshold_method < 0)
+                usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--skeleton-fallback") && i+1 < argc)
+        {
+            // The fallback thresholds the depth of the user, so it can't be
+            // the background model or the skeleton again
+            skeleton_fallback = thresholdMethod(argv[++i]);
+            if (skeleton_fallback < 0 ||
+                skeleton_fallback == THRESHOLD_BACKGROUND ||
+                skeleton_fallback == THRESHOLD_SKELETON)
+                usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--pyramid") && i+1 < argc)
+        {
+            pyramid_level = atoi(argv[++i]);
+            if (pyramid_level < 0 || pyramid_level > MAX_PYRAMID_LEVEL)
+                usage(argv[0]);
+        }
+        else
+            usage(argv[0]);
+    }
+}
+
 int main(int argc, char *argv[])
 {
+    parseCommandLine(argc, argv);
+
+    // Create a histogram between 0 and 5 meters, with 100 bins
+    hist = new histogram(0, 5000, 100);
+
+    if (headless)
+    {
+        if (!replay_filename)
+        {
+            cerr << "--headless requires --replay\n";
+            return -1;
+        }
+        initFrameSource();
+        initArrays();
+        runHeadless();
+        delete recorder;
+        return 0;
+    }
+
     glutInit(&argc, argv);
     glutInitWindowSize(2*windowWidth, windowHeight);
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
@@ -823,12 +1788,9 @@ int main(int argc, char *argv[])
     glutKeyboardFunc(keyboard);	// How react about keyboard input
     glutIdleFunc(idle);			// what do in idle state
     
-    // Create a histogram between 0 and 5 meters, with 100 bins
-    hist = new histogram(0, 5000, 100);
-    
     initGL();
     initTextures();
-    initKinect();
+    initFrameSource();
     initArrays();
     updateKinectData();
     
@@ -852,11 +1814,21 @@ int main(int argc, char *argv[])
                      MENU_ID_SEGMENTATION_MINCUT);
     glutCreateMenu(selectSegmentation);
 
+    int resolution_menu = glutCreateMenu(selectResolution);
+    glutAddMenuEntry("Full Resolution", MENU_ID_FULL_RESOLUTION);
+    glutAddMenuEntry("Half Resolution", MENU_ID_HALF_RESOLUTION);
+    glutAddMenuEntry("Quarter Resolution", MENU_ID_QUARTER_RESOLUTION);
+
     glutCreateMenu(menuSelected);
     glutAddMenuEntry("Manual Thresholding", MENU_ID_MANUAL_THRESHOLDING);
     glutAddMenuEntry("K-Means Thresholding", MENU_ID_KMEANS_THRESHOLDING);
     glutAddMenuEntry("Gaussian Mixture Thresholding", MENU_ID_GMM_THRESHOLDING);
+    glutAddMenuEntry("Otsu Thresholding", MENU_ID_OTSU_THRESHOLDING);
+    glutAddMenuEntry("Background Thresholding",
+                     MENU_ID_BACKGROUND_THRESHOLDING);
+    glutAddMenuEntry("Skeleton Depth Band", MENU_ID_SKELETON_THRESHOLDING);
     glutAddSubMenu("Segmentation Method", submenu);
+    glutAddSubMenu("Segmentation Resolution", resolution_menu);
     glutAttachMenu(GLUT_RIGHT_BUTTON);
 
     initGL();
@@ -18,6 +18,8 @@
 #include "gmm_color.h"
 
 #include "mincut_segmentation.h"
+#include "bitmask.h"
+#include "pixel_partition.h"
 #include <graph.h>
 
 #include "KinectInterface.h"
@@ -67,6 +69,16 @@ double cal_energy(unsigned char *rgbImage, int i, cv::Vec3d mean, cv::Matx33d in
 	return (dist_t*inv_cov*dist)(0,0)/2.0 + log_pi_det;
 }
 
+// cal_energy() of a color
+static inline double color_energy(const cv::Vec3d &color, const cv::Vec3d &mean,
+                                  const cv::Matx33d &inv_cov, double log_pi_det)
+{
+	cv::Matx13d dist_t(color[0]-mean[0], color[1]-mean[1], color[2]-mean[2]);
+	cv::Matx31d dist(color[0]-mean[0], color[1]-mean[1], color[2]-mean[2]);
+
+	return (dist_t*inv_cov*dist)(0,0)/2.0 + log_pi_det;
+}
+
 void assign_gmm_component(unsigned char *rgbImage, int npts,
                           bool *alpha,						// foreground / background[npts]
                           std::vector<cv::Vec3d> mean[2],			// mean
@@ -75,11 +87,25 @@ void assign_gmm_component(unsigned char *rgbImage, int npts,
                           std::vector<cv::Matx33d> inv_cov[2],			// inverse of the covariance matrix
                           std::vector<double> det_cov[2],			// determinant of the covariance matrix
                           unsigned char *component)				// save here
+{
+	assign_gmm_component(rgbImage, npts, linear_roi(npts), alpha,
+	                     mean, cov, pi, inv_cov, det_cov, component);
+}
+
+void assign_gmm_component(unsigned char *rgbImage,
+                          int width, const image_roi &roi,
+                          bool *alpha,
+                          std::vector<cv::Vec3d> mean[2],
+                          std::vector<cv::Matx33d> cov[2],
+                          std::vector<double> pi[2],
+                          std::vector<cv::Matx33d> inv_cov[2],
+                          std::vector<double> det_cov[2],
+                          unsigned char *component)
 {        
     // !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
     //std::cout << "Warning: assign_gmm_component not implemented!\n";
 	double energy_min, energy_temp;
-	int i, j;
+	int j;
 
 	// -log(pi) + (1/2)log(det) = log(pi^(-1))(det^(1/2))
 	double log_pi_det[2][4];
@@ -88,7 +114,7 @@ void assign_gmm_component(unsigned char *rgbImage, int npts,
 			log_pi_det[i][j] = log(sqrt(det_cov[i][j]) / pi[i][j]);	
 
 	// Energy compare
-	for(i=0; i<npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		energy_min = cal_energy(rgbImage, i, mean[alpha[i]][0], 
 								inv_cov[alpha[i]][0], log_pi_det[alpha[i]][0]);
 		component[i] = 0;
@@ -106,6 +132,52 @@ void assign_gmm_component(unsigned char *rgbImage, int npts,
 	}
 }
 
+void assign_gmm_component(const pixel_partition &pixels,
+                          const bool *alpha,
+                          std::vector<cv::Vec3d> mean[2],
+                          std::vector<cv::Matx33d> cov[2],
+                          std::vector<double> pi[2],
+                          std::vector<cv::Matx33d> inv_cov[2],
+                          std::vector<double> det_cov[2],
+                          unsigned char *component)
+{
+	// -log(pi) + (1/2)log(det) = log(pi^(-1))(det^(1/2))
+	std::vector<double> log_pi_det[2];
+	for(int a=0; a<2; a++){
+		log_pi_det[a].resize(mean[a].size());
+		for(unsigned int k=0; k<mean[a].size(); k++)
+			log_pi_det[a][k] = log(sqrt(det_cov[a][k]) / pi[a][k]);
+	}
+
+	// The foreground and background pixels take the GMM of their label,
+	// the undefined ones the GMM alpha gives them
+	for(int label=0; label<3; label++){
+		int npixels = pixels.size(label);
+		const int *index = pixels.indices(label);
+		const unsigned char *rgb[3] = {pixels.channel(label, 0),
+		                               pixels.channel(label, 1),
+		                               pixels.channel(label, 2)};
+
+		for(int i=0; i<npixels; i++){
+			int a = label == TRIMAP_U ? alpha[index[i]] : label;
+			cv::Vec3d color(rgb[0][i], rgb[1][i], rgb[2][i]);
+
+			double energy_min = color_energy(color, mean[a][0], inv_cov[a][0],
+			                                 log_pi_det[a][0]);
+			int best = 0;
+			for(unsigned int k=1; k<mean[a].size(); k++){
+				double energy = color_energy(color, mean[a][k], inv_cov[a][k],
+				                             log_pi_det[a][k]);
+				if(energy < energy_min){
+					best = k;
+					energy_min = energy;
+				}
+			}
+			component[index[i]] = best;
+		}
+	}
+}
+
 /**
  * Segments a depth map with mincut. The result is stored in alpha, which is
  * assumed to be pre-allocated and big enough to hold the result.
@@ -158,6 +230,45 @@ void mincut_segmentation(unsigned char *rgbImage,
                          std::vector<cv::Matx33d> inv_cov[2],
                          std::vector<double> det_cov[2],
 						int gamma, int user_filter)
+{
+	mincut_segmentation(rgbImage, width, height, full_roi(width, height),
+	                    trimap, alpha, component, K,
+	                    mean, cov, pi, inv_cov, det_cov, gamma, user_filter);
+}
+
+void mincut_segmentation(unsigned char *rgbImage,
+                         int width, int height, const image_roi &roi,
+                         unsigned char *trimap,
+                         bool *alpha,
+                         unsigned char *component,
+                         int K,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> det_cov[2],
+                         int gamma, int user_filter)
+{
+	pixel_partition pixels;
+	pixels.build(trimap, rgbImage, width, roi);
+	mincut_segmentation(rgbImage, width, height, roi, pixels, trimap, alpha,
+	                    component, K, mean, cov, pi, inv_cov, det_cov, gamma,
+	                    user_filter);
+}
+
+void mincut_segmentation(unsigned char *rgbImage,
+                         int width, int height, const image_roi &roi,
+                         const pixel_partition &pixels,
+                         unsigned char *trimap,
+                         bool *alpha,
+                         unsigned char *component,
+                         int K,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> det_cov[2],
+                         int gamma, int user_filter)
 {
 	// Calculation about beta
 	double beta = 0;
@@ -165,14 +276,14 @@ void mincut_segmentation(unsigned char *rgbImage,
 	double dist_sum;
 	double count = 0;
 
-	for(int i=0; i<width; i++){
-		for(int j=0; j<height; j++){
+	for(int i=roi.x0; i<roi.x1; i++){
+		for(int j=roi.y0; j<roi.y1; j++){
 			index = i + j*width;
 			for(int m_i=-1; m_i<2; m_i++){
 				for(int m_j=-1; m_j<2; m_j++){
 					if(m_i !=0 && m_j != 0)
 						if(m_i == 0 || m_j == 0)
-							if(m_i+i>=0 && m_i+i<width && m_j+j>=0 && m_j+j<height){
+							if(m_i+i>=roi.x0 && m_i+i<roi.x1 && m_j+j>=roi.y0 && m_j+j<roi.y1){
 								index_temp = (m_i+i) + (m_j+j)*width;
 								beta += distance(rgbImage, index, index_temp);
 								count++;
@@ -184,14 +295,17 @@ void mincut_segmentation(unsigned char *rgbImage,
 	beta /= count;
 
 	// Initialization
-	Graph::node_id nodes[width*height];
+	// One node per pixel of the roi, indexed by node = (i-x0) + (j-y0)*nodes_width.
+	// On the heap, since this may run on a thread with a small stack.
+	int nodes_width = roi.width();
+	std::vector<Graph::node_id> nodes(roi.width()*roi.height());
 	Graph *graph = new Graph();	
 	double energy_min[2];
 	double energy, energy_temp;
 	double weight;
-	for(int i=0; i<width; i++)
-		for(int j=0; j<height; j++)
-			nodes[i+j*width] = graph->add_node();
+	int node;
+	for(int k=0; k<(int)nodes.size(); k++)
+		nodes[k] = graph->add_node();
 
 	// -log(pi) + (1/2)log(det) = log(pi^(-1))(det^(1/2))
 	double log_pi_det[2][4];
@@ -200,95 +314,79 @@ void mincut_segmentation(unsigned char *rgbImage,
 			log_pi_det[i][j] = log(sqrt(det_cov[i][j]) / pi[i][j]);
 	
 
-	for(int i=0; i<width; i++){
-		for(int j=0; j<height; j++){
-			index = i + j*width;
-			if(trimap[index] == TRIMAP_BG)
-				graph->set_tweights(nodes[index], 10000000, 0);
-			else if(trimap[index] == TRIMAP_FG)
-				graph->set_tweights(nodes[index], 0, 10000000);
-			else{
-				for(int k=0; k<2; k++){
-					energy_min[k] = cal_energy(rgbImage, index, mean[k][0], inv_cov[k][0], log_pi_det[k][0]);
-					for(int t=1; t<mean[k].size(); t++){
-						energy_temp = cal_energy(rgbImage, index, mean[k][t], inv_cov[k][t], log_pi_det[k][t]);
-						if(energy_temp < energy_min[k])
-							energy_min[k] = energy_temp;
-					}
-				}
-				graph->set_tweights(nodes[index], energy_min[0], energy_min[1]);
-				for(int m_i=-1; m_i<2; m_i++){
-					for(int m_j=-1; m_j<2; m_j++){
-						if(m_i !=0 && m_j != 0)
-							// if(m_i == 0 || m_j == 0)
-								if(m_i+i>=0 && m_i+i<width && m_j+j>=0 && m_j+j<height){
-									index_temp = (m_i+i) + (m_j+j)*width;
-									weight = cal_weight(rgbImage, index, index_temp, gamma, beta);
-									graph->add_edge(nodes[index], nodes[index_temp], weight, weight);
-								}
-					}
-				}
+	// the pixels already labelled are tied to their terminal
+	for(int label=0; label<2; label++){
+		const int *labelled = pixels.indices(label);
+		for(int p=0; p<pixels.size(label); p++){
+			index = labelled[p];
+			node = (index%width-roi.x0) + (index/width-roi.y0)*nodes_width;
+			if(label == TRIMAP_BG)
+				graph->set_tweights(nodes[node], 10000000, 0);
+			else
+				graph->set_tweights(nodes[node], 0, 10000000);
+		}
+	}
+
+	const int *undefined = pixels.indices(TRIMAP_U);
+	for(int p=0; p<pixels.size(TRIMAP_U); p++){
+		index = undefined[p];
+		int i = index%width, j = index/width;
+		node = (i-roi.x0) + (j-roi.y0)*nodes_width;
+		for(int k=0; k<2; k++){
+			energy_min[k] = cal_energy(rgbImage, index, mean[k][0], inv_cov[k][0], log_pi_det[k][0]);
+			for(int t=1; t<mean[k].size(); t++){
+				energy_temp = cal_energy(rgbImage, index, mean[k][t], inv_cov[k][t], log_pi_det[k][t]);
+				if(energy_temp < energy_min[k])
+					energy_min[k] = energy_temp;
+			}
+		}
+		graph->set_tweights(nodes[node], energy_min[0], energy_min[1]);
+		for(int m_i=-1; m_i<2; m_i++){
+			for(int m_j=-1; m_j<2; m_j++){
+				if(m_i !=0 && m_j != 0)
+					// if(m_i == 0 || m_j == 0)
+						if(m_i+i>=roi.x0 && m_i+i<roi.x1 && m_j+j>=roi.y0 && m_j+j<roi.y1){
+							index_temp = (m_i+i) + (m_j+j)*width;
+							weight = cal_weight(rgbImage, index, index_temp, gamma, beta);
+							graph->add_edge(nodes[node], nodes[node + m_i + m_j*nodes_width], weight, weight);
+						}
 			}
 		}
 	}
 	
 	Graph::flowtype flow = graph->maxflow();
 	int bf;
-	for(int i=0; i<width; i++){
-		for(int j=0; j<height; j++){
-			if(trimap[i+j*width] == TRIMAP_U){
-				index = i+j*width;
-
-				if(graph->what_segment(nodes[index]) == Graph::SOURCE){
-					alpha[index] = true;
-					bf = 1;
-				} else{
-					alpha[index] = false;
-					bf = 0;
-				}
-				energy = cal_energy(rgbImage, index, mean[bf][0], 
-									inv_cov[bf][0], log_pi_det[bf][0]);
-				component[index] = 0;
-				for(int k=1; k<mean[bf].size(); k++){
-					energy_temp = cal_energy(rgbImage, index, mean[bf][k], 
-											inv_cov[bf][k], log_pi_det[bf][k]);
-					if(energy_temp < energy){
-						energy = energy_temp;
-						component[index] = k;
-					}
-				}
-				
+	for(int p=0; p<pixels.size(TRIMAP_U); p++){
+		index = undefined[p];
+		node = (index%width-roi.x0) + (index/width-roi.y0)*nodes_width;
+
+		if(graph->what_segment(nodes[node]) == Graph::SOURCE){
+			alpha[index] = true;
+			bf = 1;
+		} else{
+			alpha[index] = false;
+			bf = 0;
+		}
+		energy = cal_energy(rgbImage, index, mean[bf][0], 
+							inv_cov[bf][0], log_pi_det[bf][0]);
+		component[index] = 0;
+		for(int k=1; k<mean[bf].size(); k++){
+			energy_temp = cal_energy(rgbImage, index, mean[bf][k], 
+									inv_cov[bf][k], log_pi_det[bf][k]);
+			if(energy_temp < energy){
+				energy = energy_temp;
+				component[index] = k;
 			}
 		}
 	}
 
 	// filtering
-	// using 5 X 5 and if background is more than foreground, this middle point will be backpoint.
-	int count_filt_b=0, count_filt_f=0;
-	int index_filt;
-	for(int i=user_filter; i<width-user_filter; i++){
-		for(int j=user_filter; j<height-user_filter; j++){
-			count_filt_b = count_filt_f = 0;
-			index_filt = i + j*width;
-			for(int m=-user_filter; m<=user_filter; m++){
-				for(int n=-user_filter; n<=user_filter; n++){
-					//if(index_filt+m>=0 && index_filt+m<width && index_filt+n*width>=0 && index_filt+n*width<height){
-						if(alpha[index_filt + m + n*width])
-							count_filt_f++;
-						else
-							count_filt_b++;
-					//}
-				}
-			}
-			if(count_filt_f > count_filt_b)
-				alpha[index_filt] = true;
-			else if(count_filt_f < count_filt_b)
-				alpha[index_filt] = false;
-			else
-				cout << "같음" << endl;
-		}
-	}
-					
+	// each pixel takes the majority label of the (2*user_filter+1)^2 window around it,
+	// counted on the labels before filtering, 64 pixels at a time on the packed mask.
+	bit_mask mask(width, height), filtered(width, height);
+	mask.pack(alpha, roi);
+	majority_filter(mask, roi, user_filter, filtered);
+	filtered.unpack(alpha, roi);
 
 	delete graph;
 }
@@ -11,6 +11,9 @@
 #define MINCUT_SEGMENTATION_H
 
 #include <opencv2/core/core.hpp>
+
+#include "pixel_partition.h"
+#include "roi.h"
 /*
  * Assign each pixel to the GMM components with highest probability.
  *
@@ -44,6 +47,29 @@ void assign_gmm_component(unsigned char *rgbImage, int npts,
                           std::vector<double> det_cov[2],
                           unsigned char *component);
 
+// The same, only for the pixels inside roi of an image with the given width
+void assign_gmm_component(unsigned char *rgbImage,
+                          int width, const image_roi &roi,
+                          bool *alpha,
+                          std::vector<cv::Vec3d> mean[2],
+                          std::vector<cv::Matx33d> cov[2],
+                          std::vector<double> pi[2],
+                          std::vector<cv::Matx33d> inv_cov[2],
+                          std::vector<double> det_cov[2],
+                          unsigned char *component);
+
+// The same, for the pixels of a partition of the trimap. The pixels labelled
+// foreground or background take the GMM of their label, which is the one
+// alpha gives them too, and the undefined ones the GMM alpha gives them.
+void assign_gmm_component(const pixel_partition &pixels,
+                          const bool *alpha,
+                          std::vector<cv::Vec3d> mean[2],
+                          std::vector<cv::Matx33d> cov[2],
+                          std::vector<double> pi[2],
+                          std::vector<cv::Matx33d> inv_cov[2],
+                          std::vector<double> det_cov[2],
+                          unsigned char *component);
+
 enum
 {
     TRIMAP_BG,
@@ -92,4 +118,35 @@ void mincut_segmentation(unsigned char *rgbImage,
                          std::vector<double> det_cov[2],
 			int gamma, int user_filter);
 
+// The same, only for the pixels inside roi. The graph only has nodes for
+// the pixels inside roi, and alpha and component are not modified outside
+// it.
+void mincut_segmentation(unsigned char *rgbImage,
+                         int width, int height, const image_roi &roi,
+                         unsigned char *trimap,
+                         bool *alpha,
+                         unsigned char *component,
+                         int K,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> det_cov[2],
+                         int gamma, int user_filter);
+
+// The same, with the pixels inside roi already split by their trimap label
+void mincut_segmentation(unsigned char *rgbImage,
+                         int width, int height, const image_roi &roi,
+                         const pixel_partition &pixels,
+                         unsigned char *trimap,
+                         bool *alpha,
+                         unsigned char *component,
+                         int K,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> det_cov[2],
+                         int gamma, int user_filter);
+
 #endif // MINCUT_SEGMENTATION_H
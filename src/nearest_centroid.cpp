@@ -0,0 +1,336 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "nearest_centroid.h"
+
+// The AVX2 kernel is compiled for AVX2 on its own, and only called when
+// the processor has it, so the rest of the program still runs without
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#define SCALE (1 << NEAREST_CENTROID_FRACTION_BITS)
+
+// How many vector steps the 16 bit sums hold: 128 colors of at most 255
+#define FLUSH_STEPS 128
+
+// The centroids in fixed point
+static void quantize(const cv::Vec3d *centroids, int ncentroids, int *q)
+{
+    for (int t = 0; t < ncentroids; t++)
+        for (int c = 0; c < 3; c++)
+        {
+            int v = (int)floor(centroids[t][c]*SCALE + 0.5);
+            q[3*t + c] = std::min(std::max(v, 0), 255*SCALE);
+        }
+}
+
+static void nearest_centroids_scalar(const unsigned char *const rgb[3],
+                                     int begin, int end, const int *q,
+                                     int ncentroids, const int *index,
+                                     unsigned char *assignment,
+                                     uint32_t sums[][3], uint32_t *counts)
+{
+    for (int i = begin; i < end; i++)
+    {
+        int r = rgb[0][i]*SCALE, g = rgb[1][i]*SCALE, b = rgb[2][i]*SCALE;
+
+        int best = 0, best_distance = INT_MAX;
+        for (int t = 0; t < ncentroids; t++)
+        {
+            int dr = r - q[3*t], dg = g - q[3*t + 1], db = b - q[3*t + 2];
+            int distance = dr*dr + dg*dg + db*db;
+            if (distance < best_distance)
+            {
+                best = t;
+                best_distance = distance;
+            }
+        }
+
+        assignment[index[i]] = best;
+        counts[best]++;
+        for (int c = 0; c < 3; c++)
+            sums[best][c] += rgb[c][i];
+    }
+}
+
+#ifdef __SSE2__
+
+static inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// The squared distances of 8 fixed point colors to a centroid, as two
+// vectors of 4 32 bit distances
+static inline void distances(__m128i r, __m128i g, __m128i b, __m128i cr,
+                             __m128i cg, __m128i cb, __m128i *lo, __m128i *hi)
+{
+    __m128i dr = _mm_sub_epi16(r, cr);
+    __m128i dg = _mm_sub_epi16(g, cg);
+    __m128i db = _mm_sub_epi16(b, cb);
+    __m128i zero = _mm_setzero_si128();
+
+    __m128i rg = _mm_unpacklo_epi16(dr, dg);
+    __m128i b0 = _mm_unpacklo_epi16(db, zero);
+    *lo = _mm_add_epi32(_mm_madd_epi16(rg, rg), _mm_madd_epi16(b0, b0));
+    rg = _mm_unpackhi_epi16(dr, dg);
+    b0 = _mm_unpackhi_epi16(db, zero);
+    *hi = _mm_add_epi32(_mm_madd_epi16(rg, rg), _mm_madd_epi16(b0, b0));
+}
+
+// Assign 8 pixels at a time, returning how many were assigned
+static int nearest_centroids_sse2(const unsigned char *const rgb[3],
+                                  int npixels, const int *q, int ncentroids,
+                                  const int *index, unsigned char *assignment,
+                                  uint32_t sums[][3], uint32_t *counts)
+{
+    __m128i centroid[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][3];
+    __m128i sum16[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][4];
+    __m128i sum32[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][4];
+    for (int t = 0; t < ncentroids; t++)
+        for (int c = 0; c < 4; c++)
+        {
+            if (c < 3)
+                centroid[t][c] = _mm_set1_epi16(q[3*t + c]);
+            sum16[t][c] = sum32[t][c] = _mm_setzero_si128();
+        }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    short best[8];
+    int steps = 0;
+    int i = 0;
+
+    for (; i + 8 <= npixels; i += 8)
+    {
+        __m128i color[3];
+        for (int c = 0; c < 3; c++)
+            color[c] = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i *)(rgb[c] + i)), zero);
+        __m128i r = _mm_slli_epi16(color[0], NEAREST_CENTROID_FRACTION_BITS);
+        __m128i g = _mm_slli_epi16(color[1], NEAREST_CENTROID_FRACTION_BITS);
+        __m128i b = _mm_slli_epi16(color[2], NEAREST_CENTROID_FRACTION_BITS);
+
+        __m128i best_lo = _mm_set1_epi32(INT_MAX), best_hi = best_lo;
+        __m128i index_lo = zero, index_hi = zero;
+        for (int t = 0; t < ncentroids; t++)
+        {
+            __m128i lo, hi;
+            distances(r, g, b, centroid[t][0], centroid[t][1],
+                      centroid[t][2], &lo, &hi);
+
+            __m128i nearer_lo = _mm_cmplt_epi32(lo, best_lo);
+            __m128i nearer_hi = _mm_cmplt_epi32(hi, best_hi);
+            __m128i vt = _mm_set1_epi32(t);
+            best_lo = select(nearer_lo, lo, best_lo);
+            best_hi = select(nearer_hi, hi, best_hi);
+            index_lo = select(nearer_lo, vt, index_lo);
+            index_hi = select(nearer_hi, vt, index_hi);
+        }
+
+        __m128i nearest = _mm_packs_epi32(index_lo, index_hi);
+        _mm_storeu_si128((__m128i *)best, nearest);
+        for (int j = 0; j < 8; j++)
+            assignment[index[i + j]] = best[j];
+
+        // Add the colors to the sums of their centroids
+        for (int t = 0; t < ncentroids; t++)
+        {
+            __m128i mine = _mm_cmpeq_epi16(nearest, _mm_set1_epi16(t));
+            for (int c = 0; c < 3; c++)
+                sum16[t][c] = _mm_add_epi16(sum16[t][c],
+                                            _mm_and_si128(mine, color[c]));
+            sum16[t][3] = _mm_sub_epi16(sum16[t][3], mine);
+        }
+
+        if (++steps == FLUSH_STEPS || i + 16 > npixels)
+        {
+            for (int t = 0; t < ncentroids; t++)
+                for (int c = 0; c < 4; c++)
+                {
+                    sum32[t][c] = _mm_add_epi32(sum32[t][c],
+                                        _mm_madd_epi16(sum16[t][c], ones));
+                    sum16[t][c] = zero;
+                }
+            steps = 0;
+        }
+    }
+
+    for (int t = 0; t < ncentroids; t++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            uint32_t lane[4];
+            _mm_storeu_si128((__m128i *)lane, sum32[t][c]);
+            uint32_t total = lane[0] + lane[1] + lane[2] + lane[3];
+            if (c < 3)
+                sums[t][c] += total;
+            else
+                counts[t] += total;
+        }
+    }
+    return i;
+}
+
+#endif // __SSE2__
+
+#ifdef HAVE_AVX2_KERNEL
+
+// The same as nearest_centroids_sse2(), 16 pixels at a time. The 16 bit
+// vectors unpack within their 128 bit halves, and packing the indices back
+// puts the pixels in order again.
+__attribute__((target("avx2")))
+static int nearest_centroids_avx2(const unsigned char *const rgb[3],
+                                  int npixels, const int *q, int ncentroids,
+                                  const int *index, unsigned char *assignment,
+                                  uint32_t sums[][3], uint32_t *counts)
+{
+    __m256i centroid[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][3];
+    __m256i sum16[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][4];
+    __m256i sum32[NEAREST_CENTROID_MAX_SIMD_CLUSTERS][4];
+    for (int t = 0; t < ncentroids; t++)
+        for (int c = 0; c < 4; c++)
+        {
+            if (c < 3)
+                centroid[t][c] = _mm256_set1_epi16(q[3*t + c]);
+            sum16[t][c] = sum32[t][c] = _mm256_setzero_si256();
+        }
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    short best[16];
+    int steps = 0;
+    int i = 0;
+
+    for (; i + 16 <= npixels; i += 16)
+    {
+        __m256i color[3];
+        for (int c = 0; c < 3; c++)
+            color[c] = _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((const __m128i *)(rgb[c] + i)));
+        __m256i r = _mm256_slli_epi16(color[0], NEAREST_CENTROID_FRACTION_BITS);
+        __m256i g = _mm256_slli_epi16(color[1], NEAREST_CENTROID_FRACTION_BITS);
+        __m256i b = _mm256_slli_epi16(color[2], NEAREST_CENTROID_FRACTION_BITS);
+
+        __m256i best_lo = _mm256_set1_epi32(INT_MAX), best_hi = best_lo;
+        __m256i index_lo = zero, index_hi = zero;
+        for (int t = 0; t < ncentroids; t++)
+        {
+            __m256i dr = _mm256_sub_epi16(r, centroid[t][0]);
+            __m256i dg = _mm256_sub_epi16(g, centroid[t][1]);
+            __m256i db = _mm256_sub_epi16(b, centroid[t][2]);
+
+            __m256i rg = _mm256_unpacklo_epi16(dr, dg);
+            __m256i b0 = _mm256_unpacklo_epi16(db, zero);
+            __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(rg, rg),
+                                          _mm256_madd_epi16(b0, b0));
+            rg = _mm256_unpackhi_epi16(dr, dg);
+            b0 = _mm256_unpackhi_epi16(db, zero);
+            __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(rg, rg),
+                                          _mm256_madd_epi16(b0, b0));
+
+            __m256i nearer_lo = _mm256_cmpgt_epi32(best_lo, lo);
+            __m256i nearer_hi = _mm256_cmpgt_epi32(best_hi, hi);
+            __m256i vt = _mm256_set1_epi32(t);
+            best_lo = _mm256_blendv_epi8(best_lo, lo, nearer_lo);
+            best_hi = _mm256_blendv_epi8(best_hi, hi, nearer_hi);
+            index_lo = _mm256_blendv_epi8(index_lo, vt, nearer_lo);
+            index_hi = _mm256_blendv_epi8(index_hi, vt, nearer_hi);
+        }
+
+        __m256i nearest = _mm256_packs_epi32(index_lo, index_hi);
+        _mm256_storeu_si256((__m256i *)best, nearest);
+        for (int j = 0; j < 16; j++)
+            assignment[index[i + j]] = best[j];
+
+        for (int t = 0; t < ncentroids; t++)
+        {
+            __m256i mine = _mm256_cmpeq_epi16(nearest, _mm256_set1_epi16(t));
+            for (int c = 0; c < 3; c++)
+                sum16[t][c] = _mm256_add_epi16(sum16[t][c],
+                                        _mm256_and_si256(mine, color[c]));
+            sum16[t][3] = _mm256_sub_epi16(sum16[t][3], mine);
+        }
+
+        if (++steps == FLUSH_STEPS || i + 32 > npixels)
+        {
+            for (int t = 0; t < ncentroids; t++)
+                for (int c = 0; c < 4; c++)
+                {
+                    sum32[t][c] = _mm256_add_epi32(sum32[t][c],
+                                        _mm256_madd_epi16(sum16[t][c], ones));
+                    sum16[t][c] = zero;
+                }
+            steps = 0;
+        }
+    }
+
+    for (int t = 0; t < ncentroids; t++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            uint32_t lane[8];
+            _mm256_storeu_si256((__m256i *)lane, sum32[t][c]);
+            uint32_t total = 0;
+            for (int l = 0; l < 8; l++)
+                total += lane[l];
+            if (c < 3)
+                sums[t][c] += total;
+            else
+                counts[t] += total;
+        }
+    }
+    return i;
+}
+
+#endif // HAVE_AVX2_KERNEL
+
+void nearest_centroids(const unsigned char *const rgb[3], int npixels,
+                       const cv::Vec3d *centroids, int ncentroids,
+                       const int *index, unsigned char *assignment,
+                       uint32_t sums[][3], uint32_t *counts)
+{
+    if (npixels <= 0 || ncentroids <= 0)
+        return;
+
+    std::vector<int> q(3*ncentroids);
+    quantize(centroids, ncentroids, &q[0]);
+
+    int i = 0;
+    if (ncentroids <= NEAREST_CENTROID_MAX_SIMD_CLUSTERS)
+    {
+#ifdef HAVE_AVX2_KERNEL
+        if (__builtin_cpu_supports("avx2"))
+            i = nearest_centroids_avx2(rgb, npixels, &q[0], ncentroids, index,
+                                       assignment, sums, counts);
+        else
+#endif
+        {
+#ifdef __SSE2__
+            i = nearest_centroids_sse2(rgb, npixels, &q[0], ncentroids, index,
+                                       assignment, sums, counts);
+#endif
+        }
+    }
+
+    // The pixels left over
+    nearest_centroids_scalar(rgb, i, npixels, &q[0], ncentroids, index,
+                             assignment, sums, counts);
+}
@@ -0,0 +1,41 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef NEAREST_CENTROID_H
+#define NEAREST_CENTROID_H
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+// The colors and centroids are compared in fixed point, with this many
+// fractional bits, so the squared distances are exact 32 bit integers
+#define NEAREST_CENTROID_FRACTION_BITS 3
+
+// The vector kernels keep their per-cluster sums in registers for at most
+// this many centroids. With more, the scalar kernel runs.
+#define NEAREST_CENTROID_MAX_SIMD_CLUSTERS 16
+
+/*
+ * The assignment step of k-means in color space: find the nearest of the
+ * ncentroids centroids to each of npixels colors, given one array per
+ * channel, and set assignment[index[i]] to it. The color of each pixel is
+ * added to the sums of its centroid, and the pixel to its count, in the
+ * same pass. sums and counts are not cleared.
+ *
+ * The centroids are rounded to 1/2^NEAREST_CENTROID_FRACTION_BITS, and
+ * ties go to the first centroid. 8 pixels are assigned at a time with
+ * SSE2, or 16 with AVX2 when the processor has it, picked at run time.
+ */
+void nearest_centroids(const unsigned char *const rgb[3], int npixels,
+                       const cv::Vec3d *centroids, int ncentroids,
+                       const int *index, unsigned char *assignment,
+                       uint32_t sums[][3], uint32_t *counts);
+
+#endif // NEAREST_CENTROID_H
@@ -0,0 +1,62 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include "otsu_segmentation.h"
+
+float otsu_segmentation(const histogram &hist,
+                        double *centroid_fg, double *centroid_bg)
+{
+    int nbins = hist.get_n_bins();
+    double depth0 = hist.get_min(), binsize = hist.get_bin_size();
+
+    double count = hist.get_total();
+    if (count == 0)
+        return 0.0;
+
+    double sum = 0;
+    for (int b = 0; b < nbins; b++)
+        sum += hist[b]*(depth0 + b*binsize);
+
+    // Sweep the split after each bin, keeping the running count and sum
+    // of the depths in front of it. The variance between both sides is
+    // proportional to count_fg*count_bg*(mean_fg - mean_bg)^2.
+    double count_fg = 0, sum_fg = 0;
+    double best = -1, best_mean_fg = sum/count, best_mean_bg = sum/count;
+    int best_bin = nbins - 1;
+    for (int b = 0; b < nbins - 1; b++)
+    {
+        if (hist[b] == 0)
+            continue;
+
+        count_fg += hist[b];
+        sum_fg += hist[b]*(depth0 + b*binsize);
+
+        double count_bg = count - count_fg;
+        if (count_bg == 0)
+            break;
+
+        double mean_fg = sum_fg/count_fg;
+        double mean_bg = (sum - sum_fg)/count_bg;
+        double between = count_fg*count_bg*(mean_fg - mean_bg)*(mean_fg - mean_bg);
+        if (between > best)
+        {
+            best = between;
+            best_bin = b;
+            best_mean_fg = mean_fg;
+            best_mean_bg = mean_bg;
+        }
+    }
+
+    if (centroid_fg)
+        *centroid_fg = best_mean_fg;
+    if (centroid_bg)
+        *centroid_bg = best_mean_bg;
+
+    return depth0 + (best_bin + 1)*binsize;
+}
@@ -0,0 +1,28 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef OTSU_SEGMENTATION_H
+#define OTSU_SEGMENTATION_H
+
+#include "histogram.h"
+
+/**
+ * Splits a depth histogram in two with Otsu's method: the threshold is the
+ * one that maximizes the variance between the depths in front of it and
+ * the depths behind it. It is found in a single sweep over the bins,
+ * without iterating, so it always takes the same time.
+ *
+ * Returns the threshold, the start of the first bin behind it, so the
+ * pixels with depth smaller than it are the foreground. If centroid1 and
+ * centroid2 are not NULL, return the mean depth of both sides in them.
+ */
+float otsu_segmentation(const histogram &hist,
+                        double *centroid1 = 0, double *centroid2 = 0);
+
+#endif // OTSU_SEGMENTATION_H
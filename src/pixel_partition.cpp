@@ -0,0 +1,53 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include "pixel_partition.h"
+
+void pixel_partition::build(const unsigned char *trimap,
+                            const unsigned char *rgb,
+                            int width, const image_roi &roi)
+{
+    // Count the pixels of each label first, so each one can be written
+    // straight to its place without testing its label
+    int count[3] = {0, 0, 0};
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        const unsigned char *t = trimap + y*width;
+        for (int x = roi.x0; x < roi.x1; x++)
+            count[t[x]]++;
+    }
+
+    int *pIndex[3];
+    unsigned char *pColor[3][3];
+    for (int label = 0; label < 3; label++)
+    {
+        index[label].resize(count[label]);
+        for (int c = 0; c < 3; c++)
+            color[label][c].resize(count[label]);
+
+        // Not dereferenced when the label has no pixels
+        pIndex[label] = count[label] ? &index[label][0] : 0;
+        for (int c = 0; c < 3; c++)
+            pColor[label][c] = count[label] ? &color[label][c][0] : 0;
+    }
+
+    int next[3] = {0, 0, 0};
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        for (int i = y*width + roi.x0; i < y*width + roi.x1; i++)
+        {
+            int label = trimap[i];
+            int k = next[label]++;
+            pIndex[label][k] = i;
+            pColor[label][0][k] = rgb[3*i];
+            pColor[label][1][k] = rgb[3*i + 1];
+            pColor[label][2][k] = rgb[3*i + 2];
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef PIXEL_PARTITION_H
+#define PIXEL_PARTITION_H
+
+#include <vector>
+
+#include "roi.h"
+
+/*
+ * The pixels inside roi of a trimap, split by label (TRIMAP_BG, TRIMAP_FG
+ * and TRIMAP_U).
+ *
+ * For each label we keep the image indices of its pixels in scan order,
+ * and their colors copied next to each other, one array per channel. The
+ * color stages then walk only the pixels of the label they work on,
+ * reading their colors in sequence, instead of testing the label of every
+ * pixel of the roi on every pass. The partition is built once per frame,
+ * after the trimap is done, and its buffers are kept from frame to frame.
+ */
+class pixel_partition
+{
+    public:
+        // Split the pixels inside roi of a trimap and rgb image of the
+        // given width
+        void build(const unsigned char *trimap, const unsigned char *rgb,
+                   int width, const image_roi &roi);
+
+        // The number of pixels with a label
+        int size(unsigned char label) const { return index[label].size(); }
+
+        // The image indices of the pixels with a label
+        const int *indices(unsigned char label) const
+        {
+            return index[label].empty() ? 0 : &index[label][0];
+        }
+
+        // Channel c of the colors of the pixels with a label, in the order
+        // of indices()
+        const unsigned char *channel(unsigned char label, int c) const
+        {
+            return color[label][c].empty() ? 0 : &color[label][c][0];
+        }
+
+    private:
+        std::vector<int> index[3];
+        std::vector<unsigned char> color[3][3];
+};
+
+#endif // PIXEL_PARTITION_H
@@ -0,0 +1,249 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <math.h>
+
+#include "mincut_segmentation.h"
+#include "pyramid.h"
+
+image_roi pyramid_down_roi(const image_roi &roi, int level,
+                           int small_width, int small_height)
+{
+    int factor = 1 << level;
+
+    image_roi small;
+    small.x0 = std::min(roi.x0 >> level, small_width);
+    small.y0 = std::min(roi.y0 >> level, small_height);
+    small.x1 = std::min((roi.x1 + factor - 1) >> level, small_width);
+    small.y1 = std::min((roi.y1 + factor - 1) >> level, small_height);
+    return small;
+}
+
+void pyramid_down_depth(const unsigned short *depth, int width, int height,
+                        int level, unsigned short *small)
+{
+    int factor = 1 << level;
+    int small_width = pyramid_size(width, level);
+    int small_height = pyramid_size(height, level);
+
+    #pragma omp parallel for
+    for (int y = 0; y < small_height; y++)
+    {
+        for (int x = 0; x < small_width; x++)
+        {
+            // The first valid depth of the block, scanning from its center
+            // row, so thin edges are sampled the same way at every level
+            unsigned short d = 0;
+            for (int by = 0; by < factor && !d; by++)
+            {
+                int row = y*factor + ((by + factor/2) & (factor - 1));
+                const unsigned short *pDepth = depth + row*width + x*factor;
+                for (int bx = 0; bx < factor && !d; bx++)
+                    d = pDepth[(bx + factor/2) & (factor - 1)];
+            }
+            small[y*small_width + x] = d;
+        }
+    }
+}
+
+void pyramid_down_rgb(const unsigned char *rgb, int width, int height,
+                      int level, unsigned char *small)
+{
+    int factor = 1 << level;
+    int small_width = pyramid_size(width, level);
+    int small_height = pyramid_size(height, level);
+    int shift = 2*level;
+
+    #pragma omp parallel for
+    for (int y = 0; y < small_height; y++)
+    {
+        for (int x = 0; x < small_width; x++)
+        {
+            int sum[3] = {0, 0, 0};
+            for (int by = 0; by < factor; by++)
+            {
+                const unsigned char *pImage =
+                    rgb + 3*((y*factor + by)*width + x*factor);
+                for (int bx = 0; bx < factor; bx++, pImage += 3)
+                {
+                    sum[0] += pImage[0];
+                    sum[1] += pImage[1];
+                    sum[2] += pImage[2];
+                }
+            }
+
+            unsigned char *pSmall = small + 3*(y*small_width + x);
+            for (int c = 0; c < 3; c++)
+                pSmall[c] = (sum[c] + (1 << shift)/2) >> shift;
+        }
+    }
+}
+
+void pyramid_boundary_band(const bool *alpha, int width,
+                           const image_roi &roi, unsigned char *band)
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            int i = y*width + x;
+            bool label = alpha[i];
+            unsigned char in_band = 0;
+            for (int dy = -1; dy <= 1 && !in_band; dy++)
+            {
+                int ny = y + dy;
+                if (ny < roi.y0 || ny >= roi.y1)
+                    continue;
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int nx = x + dx;
+                    if (nx >= roi.x0 && nx < roi.x1 &&
+                        alpha[ny*width + nx] != label)
+                    {
+                        in_band = 1;
+                        break;
+                    }
+                }
+            }
+            band[i] = in_band;
+        }
+    }
+}
+
+void pyramid_up_segmentation(const bool *small_alpha,
+                             const unsigned char *small_trimap,
+                             const unsigned char *small_component,
+                             int small_width, int small_height, int level,
+                             int width, const image_roi &roi,
+                             bool *alpha, unsigned char *trimap,
+                             unsigned char *component)
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        // The right and bottom edges of images whose size is not a
+        // multiple of the factor use the last small row and column
+        int sy = std::min(y >> level, small_height - 1);
+        const bool *pSmallAlpha = small_alpha + sy*small_width;
+        const unsigned char *pSmallTrimap = small_trimap + sy*small_width;
+        const unsigned char *pSmallComponent =
+            small_component + sy*small_width;
+
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            int sx = std::min(x >> level, small_width - 1);
+            int i = y*width + x;
+            alpha[i] = pSmallAlpha[sx];
+            trimap[i] = pSmallTrimap[sx];
+            component[i] = pSmallComponent[sx];
+        }
+    }
+}
+
+// The energy of a color under a gaussian, up to a constant, as in
+// mincut_segmentation()
+static inline double gaussian_energy(const unsigned char *color,
+                                     const cv::Vec3d &mean,
+                                     const cv::Matx33d &inv_cov,
+                                     double log_pi_det)
+{
+    double d0 = color[0] - mean[0];
+    double d1 = color[1] - mean[1];
+    double d2 = color[2] - mean[2];
+    const cv::Matx33d &A = inv_cov;
+    double q = d0*(A(0,0)*d0 + A(0,1)*d1 + A(0,2)*d2) +
+               d1*(A(1,0)*d0 + A(1,1)*d1 + A(1,2)*d2) +
+               d2*(A(2,0)*d0 + A(2,1)*d1 + A(2,2)*d2);
+    return q/2.0 + log_pi_det;
+}
+
+// The lowest energy of a color under the components of a GMM
+static inline double gmm_energy(const unsigned char *color,
+                                const std::vector<cv::Vec3d> &mean,
+                                const std::vector<cv::Matx33d> &inv_cov,
+                                const std::vector<double> &log_pi_det,
+                                unsigned char *component)
+{
+    double energy = HUGE_VAL;
+    *component = 0;
+    for (unsigned int k = 0; k < mean.size(); k++)
+    {
+        double e = gaussian_energy(color, mean[k], inv_cov[k], log_pi_det[k]);
+        if (e < energy)
+        {
+            energy = e;
+            *component = k;
+        }
+    }
+    return energy;
+}
+
+void pyramid_refine_band(const unsigned short *depth, const unsigned char *rgb,
+                         int width, const image_roi &roi, int level,
+                         const unsigned char *small_band, int small_width,
+                         int small_height, double near_depth,
+                         double threshold,
+                         bool solve_unknown,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<double> det_cov[2],
+                         bool *alpha, unsigned char *trimap,
+                         unsigned char *component)
+{
+    // -log(pi) + (1/2)log(det), as in mincut_segmentation()
+    std::vector<double> log_pi_det[2];
+    for (int a = 0; a < 2; a++)
+    {
+        log_pi_det[a].resize(mean[a].size());
+        for (unsigned int k = 0; k < mean[a].size(); k++)
+            log_pi_det[a][k] = log(sqrt(det_cov[a][k])/pi[a][k]);
+    }
+    bool have_gmm = !mean[0].empty() && !mean[1].empty();
+
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        int sy = std::min(y >> level, small_height - 1);
+        const unsigned char *pBand = small_band + sy*small_width;
+
+        for (int x = roi.x0; x < roi.x1; x++)
+        {
+            if (!pBand[std::min(x >> level, small_width - 1)])
+                continue;
+
+            int i = y*width + x;
+            const unsigned char *color = rgb + 3*i;
+
+            if (depth[i] != 0)
+            {
+                alpha[i] = depth[i] >= near_depth && depth[i] < threshold;
+                trimap[i] = alpha[i];
+            }
+            else if (solve_unknown && have_gmm)
+            {
+                unsigned char k[2];
+                double energy_bg = gmm_energy(color, mean[0], inv_cov[0],
+                                              log_pi_det[0], &k[0]);
+                double energy_fg = gmm_energy(color, mean[1], inv_cov[1],
+                                              log_pi_det[1], &k[1]);
+                alpha[i] = energy_fg < energy_bg;
+                trimap[i] = alpha[i];
+            }
+            else
+            {
+                // Same as thresholding a zero depth
+                alpha[i] = true;
+                trimap[i] = TRIMAP_U;
+            }
+
+            if (have_gmm)
+                gmm_energy(color, mean[alpha[i]], inv_cov[alpha[i]],
+                           log_pi_det[alpha[i]], &component[i]);
+        }
+    }
+}
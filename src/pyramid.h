@@ -0,0 +1,86 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "roi.h"
+
+/*
+ * Multi-resolution segmentation.
+ *
+ * The images are shrunk by a factor of 2^level, the segmentation runs on
+ * the small images, and its result is scaled back up. Only the pixels in
+ * a thin band around the boundary of the small segmentation are labelled
+ * again from the full resolution images.
+ */
+
+// The size of an image dimension at a pyramid level
+inline int pyramid_size(int size, int level)
+{
+    return size >> level;
+}
+
+// The small image roi covering a full resolution roi
+image_roi pyramid_down_roi(const image_roi &roi, int level,
+                           int small_width, int small_height);
+
+// Shrink a depth map. Each small pixel takes a valid depth from its block,
+// if there is one, so the depths of the foreground and the background
+// never get blended along the edges.
+void pyramid_down_depth(const unsigned short *depth, int width, int height,
+                        int level, unsigned short *small);
+
+// Shrink an rgb image, averaging each block
+void pyramid_down_rgb(const unsigned char *rgb, int width, int height,
+                      int level, unsigned char *small);
+
+// Mark the small pixels inside roi that have a neighbour with a different
+// label in alpha. These are the pixels whose blocks get relabelled at full
+// resolution.
+void pyramid_boundary_band(const bool *alpha, int width,
+                           const image_roi &roi, unsigned char *band);
+
+// Scale the small segmentation (alpha, trimap and the GMM component of
+// each pixel) up to the full resolution pixels inside roi
+void pyramid_up_segmentation(const bool *small_alpha,
+                             const unsigned char *small_trimap,
+                             const unsigned char *small_component,
+                             int small_width, int small_height, int level,
+                             int width, const image_roi &roi,
+                             bool *alpha, unsigned char *trimap,
+                             unsigned char *component);
+
+/*
+ * Relabel the full resolution pixels inside roi that belong to a block in
+ * the band. Pixels with a valid depth are foreground if near_depth <=
+ * depth < threshold. Pixels without one are labelled unknown in the
+ * trimap, or, if solve_unknown is set, take the GMM (mean, inv_cov, pi,
+ * det_cov) under which their color has the lowest energy, the way mincut
+ * would label them without the smoothness term. component is set to the lowest energy component of the GMM of
+ * each relabelled pixel.
+ */
+void pyramid_refine_band(const unsigned short *depth, const unsigned char *rgb,
+                         int width, const image_roi &roi, int level,
+                         const unsigned char *small_band, int small_width,
+                         int small_height, double near_depth,
+                         double threshold,
+                         bool solve_unknown,
+                         std::vector<cv::Vec3d> mean[2],
+                         std::vector<cv::Matx33d> inv_cov[2],
+                         std::vector<double> pi[2],
+                         std::vector<double> det_cov[2],
+                         bool *alpha, unsigned char *trimap,
+                         unsigned char *component);
+
+#endif // PYRAMID_H
@@ -0,0 +1,167 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef ROI_H
+#define ROI_H
+
+#include <algorithm>
+#include <math.h>
+
+#include <opencv2/core/core.hpp>
+
+// A rectangular region of interest of an image: the pixels (x, y) with
+// x0 <= x < x1 and y0 <= y < y1
+struct image_roi
+{
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int area() const { return empty() ? 0 : width()*height(); }
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+
+    bool operator==(const image_roi &roi) const
+    {
+        return x0 == roi.x0 && y0 == roi.y0 && x1 == roi.x1 && y1 == roi.y1;
+    }
+    bool operator!=(const image_roi &roi) const { return !(*this == roi); }
+
+    // True if roi lies inside this one
+    bool contains(const image_roi &roi) const
+    {
+        return roi.empty() || (roi.x0 >= x0 && roi.y0 >= y0 &&
+                               roi.x1 <= x1 && roi.y1 <= y1);
+    }
+};
+
+// Walks the indices of the pixels of roi, row by row, in a row-major image
+// of the given width:
+//
+//     for (roi_iterator i(roi, width); !i.done(); ++i)
+//         image[i] = ...;
+class roi_iterator
+{
+    public:
+        roi_iterator(const image_roi &roi, int width)
+            : index(roi.y0*width + roi.x0), row_end(roi.y0*width + roi.x1),
+              end(roi.y1*width + roi.x0), skip(width - roi.width()),
+              width(width)
+        {
+            if (roi.empty())
+                index = end = 0;
+        }
+
+        bool done() const { return index >= end; }
+
+        roi_iterator &operator++()
+        {
+            if (++index == row_end)
+            {
+                index += skip;
+                row_end += width;
+            }
+            return *this;
+        }
+
+        operator int() const { return index; }
+
+    private:
+        int index, row_end, end, skip, width;
+};
+
+// The whole width x height image
+inline image_roi full_roi(int width, int height)
+{
+    image_roi roi = {0, 0, width, height};
+    return roi;
+}
+
+// The smallest roi containing both a and b
+inline image_roi roi_union(const image_roi &a, const image_roi &b)
+{
+    if (a.empty())
+        return b;
+    if (b.empty())
+        return a;
+    image_roi roi = {std::min(a.x0, b.x0), std::min(a.y0, b.y0),
+                     std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+    return roi;
+}
+
+// The pixels inside both a and b
+inline image_roi roi_intersection(const image_roi &a, const image_roi &b)
+{
+    image_roi roi = {std::max(a.x0, b.x0), std::max(a.y0, b.y0),
+                     std::min(a.x1, b.x1), std::min(a.y1, b.y1)};
+    return roi;
+}
+
+// A single row of npts pixels, for the functions that take a plain array
+inline image_roi linear_roi(int npts)
+{
+    image_roi roi = {0, 0, npts, 1};
+    return roi;
+}
+
+// Set the pixels of an image with the given number of channels that are
+// inside roi but outside keep to value. Clearing what was inside last
+// frame's roi keeps everything outside the current one cleared, without
+// touching the whole image.
+template <class T>
+void fill_roi_difference(T *image, int width, int channels,
+                         const image_roi &roi, const image_roi &keep,
+                         const T *value)
+{
+    for (int y = roi.y0; y < roi.y1; y++)
+    {
+        // The part [k0, k1) of the row we keep, if any
+        int k0 = roi.x1, k1 = roi.x1;
+        if (y >= keep.y0 && y < keep.y1)
+        {
+            k0 = std::min(std::max(keep.x0, roi.x0), roi.x1);
+            k1 = std::max(std::min(keep.x1, roi.x1), k0);
+        }
+
+        T *row = image + y*width*channels;
+        for (int x = roi.x0*channels; x < k0*channels; x += channels)
+            for (int c = 0; c < channels; c++)
+                row[x + c] = value[c];
+        for (int x = k1*channels; x < roi.x1*channels; x += channels)
+            for (int c = 0; c < channels; c++)
+                row[x + c] = value[c];
+    }
+}
+
+// The bounding box of n points on a width x height image, grown by margin
+// pixels on every side and clipped to the image
+inline image_roi bounding_roi(const cv::Vec2d *points, int n, int margin,
+                              int width, int height)
+{
+    if (n == 0)
+        return full_roi(width, height);
+
+    double xmin = points[0][0], xmax = points[0][0];
+    double ymin = points[0][1], ymax = points[0][1];
+    for (int i = 1; i < n; i++)
+    {
+        xmin = std::min(xmin, points[i][0]);
+        xmax = std::max(xmax, points[i][0]);
+        ymin = std::min(ymin, points[i][1]);
+        ymax = std::max(ymax, points[i][1]);
+    }
+
+    image_roi roi;
+    roi.x0 = std::max((int)floor(xmin) - margin, 0);
+    roi.y0 = std::max((int)floor(ymin) - margin, 0);
+    roi.x1 = std::min((int)ceil(xmax) + 1 + margin, width);
+    roi.y1 = std::min((int)ceil(ymax) + 1 + margin, height);
+    return roi;
+}
+
+#endif // ROI_H
@@ -0,0 +1,877 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "huffman_code.h"
+#include "session_codec.h"
+
+// The SSSE3 color transform is compiled for SSSE3 on its own, and only
+// called when the processor has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_KERNEL
+#include <tmmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Depth symbols. Residuals are differences between palette indices.
+ *
+ *     0-239:   a residual in [-120, 119], zigzag coded
+ *     240-251: 1 to 12 pixels with zero depth
+ *     252:     13 to 268 pixels with zero depth, in the next side byte
+ *     253:     269 or more pixels with zero depth, in the next 2 side bytes
+ *     254:     a raw palette index, in the next 2 side bytes
+ */
+#define SYMBOL_HOLES        240
+#define SYMBOL_LONG_HOLES   252
+#define SYMBOL_LONGER_HOLES 253
+#define SYMBOL_RAW          254
+
+#define MAX_RESIDUAL        119
+#define MAX_HOLES           12
+#define MAX_LONG_HOLES      (MAX_HOLES + 256)
+#define MAX_LONGER_HOLES    (MAX_LONG_HOLES + 65535)
+
+// Whether the R and B planes of an rgb image have G subtracted
+#define SUBTRACT_GREEN_R    0x1
+#define SUBTRACT_GREEN_B    0x2
+
+// The codes of the three planes and the SUBTRACT_GREEN flags
+#define RGB_HEADER_SIZE     (3*HUFFMAN_LENGTHS_SIZE + 1)
+
+static inline void put_u32(vector<unsigned char> &out, size_t pos, uint32_t v)
+{
+    memcpy(&out[pos], &v, sizeof(v));
+}
+
+static inline void push_u32(vector<unsigned char> &out, uint32_t v)
+{
+    out.resize(out.size() + sizeof(v));
+    put_u32(out, out.size() - sizeof(v), v);
+}
+
+static inline uint32_t get_u32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Variable length unsigned integers, 7 bits per byte
+static inline void push_varint(vector<unsigned char> &out, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(v | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+static inline bool get_varint(const unsigned char *&p, const unsigned char *end,
+                              uint32_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+        if (p >= end)
+            return false;
+        unsigned char b = *p++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline int zigzag(int r)
+{
+    return r >= 0 ? 2*r : -2*r - 1;
+}
+
+static inline int unzigzag(int z)
+{
+    return (z >> 1) ^ -(z & 1);
+}
+
+static inline int n_chunks(int height)
+{
+    return (height + CODEC_CHUNK_ROWS - 1)/CODEC_CHUNK_ROWS;
+}
+
+// Write the chunk table, the header of the image and the encoded chunks
+static void write_chunks(vector< vector<unsigned char> > &chunks,
+                         const vector<unsigned char> &header,
+                         vector<unsigned char> &out)
+{
+    int nchunks = chunks.size();
+    size_t start = out.size();
+    size_t table_size = (nchunks + 2)*sizeof(uint32_t);
+
+    size_t total = table_size + header.size();
+    for (int i = 0; i < nchunks; i++)
+        total += chunks[i].size();
+    out.resize(start + total);
+
+    put_u32(out, start, nchunks);
+    memcpy(&out[start + table_size], &header[0], header.size());
+    uint32_t offset = table_size + header.size();
+    for (int i = 0; i < nchunks; i++)
+    {
+        put_u32(out, start + (i+1)*sizeof(uint32_t), offset);
+        if (!chunks[i].empty())
+            memcpy(&out[start + offset], &chunks[i][0], chunks[i].size());
+        offset += chunks[i].size();
+    }
+    put_u32(out, start + (nchunks+1)*sizeof(uint32_t), offset);
+}
+
+// Validate the chunk table, followed by a header of header_size bytes,
+// returning the number of chunks or -1
+static int read_chunk_table(const unsigned char *data, size_t size, int height,
+                            size_t header_size)
+{
+    if (size < sizeof(uint32_t))
+        return -1;
+
+    int nchunks = get_u32(data);
+    if (nchunks != n_chunks(height) ||
+        size < (nchunks + 2)*sizeof(uint32_t) + header_size)
+        return -1;
+
+    uint32_t prev = (nchunks + 2)*sizeof(uint32_t) + header_size;
+    for (int i = 0; i <= nchunks; i++)
+    {
+        uint32_t offset = get_u32(data + (i+1)*sizeof(uint32_t));
+        if (offset < prev || offset > size)
+            return -1;
+        prev = offset;
+    }
+    return nchunks;
+}
+
+static inline const unsigned char *image_header(const unsigned char *data)
+{
+    return data + (get_u32(data) + 2)*sizeof(uint32_t);
+}
+
+static inline const unsigned char *chunk_begin(const unsigned char *data, int i)
+{
+    return data + get_u32(data + (i+1)*sizeof(uint32_t));
+}
+
+// Map the depths of a chunk to symbols, writing its palette and side bytes
+// to out
+static void depth_symbols(const unsigned short *depth, int width, int rows,
+                          unsigned short *lut, vector<unsigned char> &symbols,
+                          vector<unsigned char> &out)
+{
+    int n = width*rows;
+
+    // The palette of depth values present in the chunk, as increments
+    vector<unsigned short> palette;
+    palette.reserve(n);
+    for (int i = 0; i < n; i++)
+        if (depth[i])
+            palette.push_back(depth[i]);
+    sort(palette.begin(), palette.end());
+    palette.erase(unique(palette.begin(), palette.end()), palette.end());
+
+    uint32_t npalette = palette.size();
+    push_u32(out, npalette);
+    for (uint32_t k = 0; k < npalette; k++)
+        push_varint(out, palette[k] - (k ? palette[k - 1] : 0));
+
+    // Only the entries of the palette values are ever looked up
+    for (uint32_t k = 0; k < npalette; k++)
+        lut[palette[k]] = k;
+
+    vector<unsigned char> side;
+    symbols.clear();
+
+    int row_pred = 0;
+    for (int y = 0; y < rows; y++)
+    {
+        const unsigned short *row = depth + y*width;
+        int pred = row_pred;
+        bool first = true;
+
+        int x = 0;
+        while (x < width)
+        {
+            if (row[x] == 0)
+            {
+                int len = 1;
+                while (x + len < width && row[x + len] == 0)
+                    len++;
+                x += len;
+
+                while (len > 0)
+                {
+                    int l = min(len, MAX_LONGER_HOLES);
+                    if (l <= MAX_HOLES)
+                        symbols.push_back(SYMBOL_HOLES + l - 1);
+                    else if (l <= MAX_LONG_HOLES)
+                    {
+                        symbols.push_back(SYMBOL_LONG_HOLES);
+                        side.push_back(l - MAX_HOLES - 1);
+                    }
+                    else
+                    {
+                        symbols.push_back(SYMBOL_LONGER_HOLES);
+                        side.push_back((l - MAX_LONG_HOLES - 1) & 0xff);
+                        side.push_back((l - MAX_LONG_HOLES - 1) >> 8);
+                    }
+                    len -= l;
+                }
+                continue;
+            }
+
+            int idx = lut[row[x]];
+            int r = idx - pred;
+            if (r >= -MAX_RESIDUAL - 1 && r <= MAX_RESIDUAL)
+                symbols.push_back(zigzag(r));
+            else
+            {
+                symbols.push_back(SYMBOL_RAW);
+                side.push_back(idx & 0xff);
+                side.push_back(idx >> 8);
+            }
+
+            if (first)
+            {
+                row_pred = idx;
+                first = false;
+            }
+            pred = idx;
+            x++;
+        }
+    }
+
+    push_u32(out, symbols.size());
+    push_u32(out, side.size());
+    out.insert(out.end(), side.begin(), side.end());
+}
+
+#ifdef __SSE2__
+
+// The palette indices fit 16 bit lanes with room for 8 residuals
+#define MAX_SIMD_PALETTE    16384
+
+// Decode 8 residual symbols, returning false if they are not all
+// residuals or take the index out of the palette
+static inline bool decode_residuals_sse2(const unsigned char *s,
+                                         const unsigned short *palette,
+                                         int npalette, int &pred,
+                                         unsigned short *depth)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i z = _mm_loadl_epi64((const __m128i *)s);
+    __m128i low = _mm_min_epu8(z, _mm_set1_epi8(SYMBOL_HOLES - 1));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(low, z)) != 0xffff)
+        return false;
+
+    // Undo the zigzag and add up the residuals
+    z = _mm_unpacklo_epi8(z, zero);
+    __m128i r = _mm_xor_si128(_mm_srli_epi16(z, 1),
+        _mm_sub_epi16(zero, _mm_and_si128(z, _mm_set1_epi16(1))));
+    r = _mm_add_epi16(r, _mm_slli_si128(r, 2));
+    r = _mm_add_epi16(r, _mm_slli_si128(r, 4));
+    r = _mm_add_epi16(r, _mm_slli_si128(r, 8));
+    __m128i idx = _mm_add_epi16(r, _mm_set1_epi16(pred));
+
+    __m128i out = _mm_or_si128(_mm_cmpgt_epi16(zero, idx),
+        _mm_cmpgt_epi16(idx, _mm_set1_epi16(npalette - 1)));
+    if (_mm_movemask_epi8(out))
+        return false;
+
+    unsigned short index[8];
+    _mm_storeu_si128((__m128i *)index, idx);
+    for (int k = 0; k < 8; k++)
+        depth[k] = palette[index[k]];
+    pred = index[7];
+    return true;
+}
+
+#endif // __SSE2__
+
+static bool decode_depth_chunk(const unsigned char *p, const unsigned char *end,
+                               const huffman_code &code, int width, int rows,
+                               unsigned char *symbols, unsigned short *depth)
+{
+    uint32_t npalette;
+    if (end - p < (ptrdiff_t)sizeof(uint32_t))
+        return false;
+    npalette = get_u32(p);
+    p += sizeof(uint32_t);
+    if (npalette > 65535)
+        return false;
+
+    vector<unsigned short> palette(npalette + 1);
+    uint32_t value = 0;
+    for (uint32_t k = 0; k < npalette; k++)
+    {
+        uint32_t delta;
+        if (!get_varint(p, end, delta) || delta == 0 || delta > 65535 - value)
+            return false;
+        value += delta;
+        palette[k] = value;
+    }
+
+    // Every symbol is at least one pixel
+    if (end - p < 2*(ptrdiff_t)sizeof(uint32_t))
+        return false;
+    uint32_t nsymbols = get_u32(p);
+    uint32_t nside = get_u32(p + sizeof(uint32_t));
+    p += 2*sizeof(uint32_t);
+    if (nsymbols > (uint32_t)(width*rows) || (size_t)(end - p) < nside)
+        return false;
+    const unsigned char *side = p, *side_end = p + nside;
+
+    if (code.decode(side_end, end, symbols, nsymbols) != end)
+        return false;
+
+    const unsigned char *s = symbols, *s_end = symbols + nsymbols;
+    int row_pred = 0;
+    for (int y = 0; y < rows; y++)
+    {
+        unsigned short *row = depth + y*width;
+        int pred = row_pred;
+
+        int x = 0;
+        while (x < width)
+        {
+            // Runs of residuals, the common case
+            const unsigned char *run_end =
+                s + min<ptrdiff_t>(width - x, s_end - s);
+#ifdef __SSE2__
+            if (npalette <= MAX_SIMD_PALETTE)
+                while (run_end - s >= 8 &&
+                       decode_residuals_sse2(s, &palette[0], npalette,
+                                             pred, row + x))
+                {
+                    s += 8;
+                    x += 8;
+                }
+#endif
+            while (s < run_end && *s < SYMBOL_HOLES)
+            {
+                int idx = pred + unzigzag(*s++);
+                if ((unsigned int)idx >= npalette)
+                    return false;
+                row[x++] = palette[idx];
+                pred = idx;
+            }
+            if (x == width)
+                break;
+
+            if (s == s_end)
+                return false;
+            int sym = *s++;
+
+            int idx;
+            if (sym < SYMBOL_HOLES)
+                idx = pred + unzigzag(sym);
+            else if (sym == SYMBOL_RAW)
+            {
+                if (side_end - side < 2)
+                    return false;
+                idx = side[0] | side[1] << 8;
+                side += 2;
+            }
+            else
+            {
+                int len;
+                if (sym < SYMBOL_LONG_HOLES)
+                    len = sym - SYMBOL_HOLES + 1;
+                else if (sym == SYMBOL_LONG_HOLES && side < side_end)
+                    len = *side++ + MAX_HOLES + 1;
+                else if (sym == SYMBOL_LONGER_HOLES && side_end - side >= 2)
+                {
+                    len = (side[0] | side[1] << 8) + MAX_LONG_HOLES + 1;
+                    side += 2;
+                }
+                else
+                    return false;
+
+                if (len > width - x)
+                    return false;
+                memset(row + x, 0, len*sizeof(unsigned short));
+                x += len;
+                continue;
+            }
+
+            if ((unsigned int)idx >= npalette)
+                return false;
+            row[x++] = palette[idx];
+            pred = idx;
+        }
+
+        // The next row is predicted from the first depth of this one
+        for (x = 0; x < width; x++)
+            if (row[x])
+            {
+                row_pred = lower_bound(&palette[0], &palette[npalette],
+                                       row[x]) - &palette[0];
+                break;
+            }
+    }
+
+    return s == s_end && side == side_end;
+}
+
+void encode_depth(const unsigned short *depth, int width, int height,
+                  vector<unsigned char> &out)
+{
+    int nchunks = n_chunks(height);
+    vector< vector<unsigned char> > chunks(nchunks), symbols(nchunks);
+
+    #pragma omp parallel
+    {
+        // Value to palette index lookup table, one per thread
+        vector<unsigned short> lut(65536);
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < nchunks; i++)
+        {
+            int y = i*CODEC_CHUNK_ROWS;
+            int rows = min(CODEC_CHUNK_ROWS, height - y);
+            depth_symbols(depth + y*width, width, rows, &lut[0], symbols[i],
+                          chunks[i]);
+        }
+    }
+
+    // One code for the symbols of the whole image
+    unsigned int counts[256] = {0};
+    for (int i = 0; i < nchunks; i++)
+        for (size_t k = 0; k < symbols[i].size(); k++)
+            counts[symbols[i][k]]++;
+    huffman_code code;
+    code.build(counts);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nchunks; i++)
+        code.encode(symbols[i].empty() ? 0 : &symbols[i][0],
+                    symbols[i].size(), chunks[i]);
+
+    vector<unsigned char> header;
+    code.write(header);
+    write_chunks(chunks, header, out);
+}
+
+bool decode_depth(const unsigned char *data, size_t size,
+                  int width, int height, unsigned short *depth)
+{
+    int nchunks = read_chunk_table(data, size, height, HUFFMAN_LENGTHS_SIZE);
+    huffman_code code;
+    if (nchunks < 0 ||
+        !code.read(image_header(data), HUFFMAN_LENGTHS_SIZE))
+        return false;
+
+    bool ok = true;
+
+    #pragma omp parallel
+    {
+        vector<unsigned char> symbols(CODEC_CHUNK_ROWS*width);
+
+        #pragma omp for schedule(dynamic) reduction(&&:ok)
+        for (int i = 0; i < nchunks; i++)
+        {
+            int y = i*CODEC_CHUNK_ROWS;
+            int rows = min(CODEC_CHUNK_ROWS, height - y);
+            ok = decode_depth_chunk(chunk_begin(data, i),
+                                    chunk_begin(data, i + 1), code,
+                                    width, rows, &symbols[0],
+                                    depth + y*width) && ok;
+        }
+    }
+
+    return ok;
+}
+
+// The prediction of a value from the three above it
+static inline unsigned char predict_above(const unsigned char *up, int x,
+                                          int width)
+{
+    int left = up[x > 0 ? x - 1 : x], right = up[x < width - 1 ? x + 1 : x];
+    return (((left + right + 1) >> 1) + up[x] + 1) >> 1;
+}
+
+// Split a chunk into the planes G, R-G, B-G, R and B
+static void forward_color(const unsigned char *rgb, int n, unsigned char *t)
+{
+    for (int i = 0; i < n; i++, rgb += 3)
+    {
+        t[i] = rgb[1];
+        t[n + i] = rgb[0] - rgb[1];
+        t[2*n + i] = rgb[2] - rgb[1];
+        t[3*n + i] = rgb[0];
+        t[4*n + i] = rgb[2];
+    }
+}
+
+// Put the planes G, R and B of a chunk back together from the values
+// from i on, adding G back to R and B under the masks
+static void inverse_color_scalar(const unsigned char *t, int i, int n,
+                                 unsigned char red_mask,
+                                 unsigned char blue_mask, unsigned char *rgb)
+{
+    for (; i < n; i++)
+    {
+        rgb[3*i] = t[n + i] + (t[i] & red_mask);
+        rgb[3*i + 1] = t[i];
+        rgb[3*i + 2] = t[2*n + i] + (t[i] & blue_mask);
+    }
+}
+
+#ifdef HAVE_SSSE3_KERNEL
+
+// The same as inverse_color_scalar(), 16 pixels at a time. Each of the 48
+// bytes of rgb is shuffled out of one of the three planes.
+__attribute__((target("ssse3")))
+static void inverse_color_ssse3(const unsigned char *t, int n,
+                                unsigned char red_mask,
+                                unsigned char blue_mask, unsigned char *rgb)
+{
+    const __m128i red = _mm_set1_epi8(red_mask);
+    const __m128i blue = _mm_set1_epi8(blue_mask);
+    const __m128i shuffle[3][3] = {
+        {_mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5),
+         _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1),
+         _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)},
+        {_mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1),
+         _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10),
+         _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)},
+        {_mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1),
+         _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1),
+         _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)}};
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i g = _mm_loadu_si128((const __m128i *)(t + i));
+        __m128i c[3] = {
+            _mm_add_epi8(_mm_loadu_si128((const __m128i *)(t + n + i)),
+                         _mm_and_si128(g, red)),
+            g,
+            _mm_add_epi8(_mm_loadu_si128((const __m128i *)(t + 2*n + i)),
+                         _mm_and_si128(g, blue))};
+
+        for (int k = 0; k < 3; k++)
+            _mm_storeu_si128((__m128i *)(rgb + 3*i + 16*k),
+                _mm_or_si128(_mm_or_si128(
+                    _mm_shuffle_epi8(c[0], shuffle[k][0]),
+                    _mm_shuffle_epi8(c[1], shuffle[k][1])),
+                    _mm_shuffle_epi8(c[2], shuffle[k][2])));
+    }
+
+    inverse_color_scalar(t, i, n, red_mask, blue_mask, rgb);
+}
+
+#endif // HAVE_SSSE3_KERNEL
+
+// Put a chunk back together from its three planes, R and B having G
+// subtracted as given by the SUBTRACT_GREEN flags
+static void inverse_color(const unsigned char *t, int n, int subtract,
+                          unsigned char *rgb)
+{
+    unsigned char red_mask = subtract & SUBTRACT_GREEN_R ? 0xff : 0;
+    unsigned char blue_mask = subtract & SUBTRACT_GREEN_B ? 0xff : 0;
+#ifdef HAVE_SSSE3_KERNEL
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        inverse_color_ssse3(t, n, red_mask, blue_mask, rgb);
+        return;
+    }
+#endif
+    inverse_color_scalar(t, 0, n, red_mask, blue_mask, rgb);
+}
+
+#ifdef __SSE2__
+
+static inline __m128i zigzag_sse2(__m128i r)
+{
+    return _mm_xor_si128(_mm_add_epi8(r, r),
+                         _mm_cmpgt_epi8(_mm_setzero_si128(), r));
+}
+
+static inline __m128i unzigzag_sse2(__m128i z)
+{
+    return _mm_xor_si128(
+        _mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f)),
+        _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi8(1))));
+}
+
+// The first row of a plane, the running sums of its residuals, 16 values
+// at a time. Returns the number of values done.
+static int unpredict_first_row_sse2(const unsigned char *residual, int width,
+                                    unsigned char *row)
+{
+    unsigned char value = 0;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v = unzigzag_sse2(
+            _mm_loadu_si128((const __m128i *)(residual + x)));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, _mm_set1_epi8(value));
+        _mm_storeu_si128((__m128i *)(row + x), v);
+        value = row[x + 15];
+    }
+    return x;
+}
+
+// The same as predict_above() for x to x+15
+static inline __m128i predict_above_sse2(const unsigned char *up, int x)
+{
+    __m128i left = _mm_loadu_si128((const __m128i *)(up + x - 1));
+    __m128i right = _mm_loadu_si128((const __m128i *)(up + x + 1));
+    __m128i above = _mm_loadu_si128((const __m128i *)(up + x));
+    return _mm_avg_epu8(_mm_avg_epu8(left, right), above);
+}
+
+static inline void predict_sse2(const unsigned char *up,
+                                const unsigned char *row, int x,
+                                unsigned char *residual)
+{
+    __m128i r = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(row + x)),
+                             predict_above_sse2(up, x));
+    _mm_storeu_si128((__m128i *)(residual + x), zigzag_sse2(r));
+}
+
+static inline void unpredict_sse2(const unsigned char *up,
+                                  const unsigned char *residual, int x,
+                                  unsigned char *row)
+{
+    __m128i r = unzigzag_sse2(
+        _mm_loadu_si128((const __m128i *)(residual + x)));
+    _mm_storeu_si128((__m128i *)(row + x),
+                     _mm_add_epi8(predict_above_sse2(up, x), r));
+}
+
+#endif // __SSE2__
+
+// The prediction residuals of a plane. The first row is predicted from
+// the left and the others from above, and the SSE2 code does all but the
+// first and last value of those 16 at a time, the last vector overlapping
+// the one before it.
+static void predict_plane(const unsigned char *plane, int width, int rows,
+                          unsigned char *residual)
+{
+    int x = 1;
+    residual[0] = zigzag((signed char)plane[0]);
+#ifdef __SSE2__
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i r = _mm_sub_epi8(
+            _mm_loadu_si128((const __m128i *)(plane + x)),
+            _mm_loadu_si128((const __m128i *)(plane + x - 1)));
+        _mm_storeu_si128((__m128i *)(residual + x), zigzag_sse2(r));
+    }
+#endif
+    for (; x < width; x++)
+        residual[x] = zigzag((signed char)(plane[x] - plane[x - 1]));
+
+    for (int y = 1; y < rows; y++)
+    {
+        const unsigned char *row = plane + y*width, *up = row - width;
+        unsigned char *z = residual + y*width;
+
+        x = 0;
+#ifdef __SSE2__
+        if (width >= 18)
+        {
+            for (int k = 1; k < width - 1; k += 16)
+                predict_sse2(up, row, min(k, width - 17), z);
+            z[0] = zigzag((signed char)(row[0] - predict_above(up, 0, width)));
+            x = width - 1;
+        }
+#endif
+        for (; x < width; x++)
+            z[x] = zigzag((signed char)(row[x] - predict_above(up, x, width)));
+    }
+}
+
+// Rebuild a plane from its residuals
+static void unpredict_plane(const unsigned char *residual, int width, int rows,
+                            unsigned char *plane)
+{
+    int x = 0;
+#ifdef __SSE2__
+    x = unpredict_first_row_sse2(residual, width, plane);
+#endif
+    for (; x < width; x++)
+        plane[x] = (x ? plane[x - 1] : 0) + unzigzag(residual[x]);
+
+    for (int y = 1; y < rows; y++)
+    {
+        const unsigned char *z = residual + y*width;
+        unsigned char *row = plane + y*width;
+        const unsigned char *up = row - width;
+
+        x = 0;
+#ifdef __SSE2__
+        if (width >= 18)
+        {
+            for (int k = 1; k < width - 1; k += 16)
+                unpredict_sse2(up, z, min(k, width - 17), row);
+            row[0] = predict_above(up, 0, width) + unzigzag(z[0]);
+            x = width - 1;
+        }
+#endif
+        for (; x < width; x++)
+            row[x] = predict_above(up, x, width) + unzigzag(z[x]);
+    }
+}
+
+// The bits taken by symbols with the given counts under an ideal code
+static double coded_bits(const unsigned int *counts)
+{
+    double total = 0, bits = 0;
+    for (int s = 0; s < 256; s++)
+        total += counts[s];
+    for (int s = 0; s < 256; s++)
+        if (counts[s])
+            bits += counts[s]*log2(total/counts[s]);
+    return bits;
+}
+
+void encode_rgb(const unsigned char *rgb, int width, int height,
+                vector<unsigned char> &out)
+{
+    int nchunks = n_chunks(height);
+    vector< vector<unsigned char> > chunks(nchunks);
+    vector<unsigned char> residuals(5*width*height);
+    vector<unsigned int> chunk_counts(nchunks*5*256);
+
+    #pragma omp parallel
+    {
+        vector<unsigned char> planes(5*CODEC_CHUNK_ROWS*width);
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < nchunks; i++)
+        {
+            int y = i*CODEC_CHUNK_ROWS;
+            int rows = min(CODEC_CHUNK_ROWS, height - y);
+            int n = rows*width;
+            unsigned char *residual = &residuals[5*y*width];
+            unsigned int *counts = &chunk_counts[i*5*256];
+
+            forward_color(rgb + 3*y*width, n, &planes[0]);
+            for (int c = 0; c < 5; c++)
+            {
+                predict_plane(&planes[c*n], width, rows, residual + c*n);
+                for (int k = 0; k < n; k++)
+                    counts[c*256 + residual[c*n + k]]++;
+            }
+        }
+    }
+
+    unsigned int counts[5][256];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < nchunks; i++)
+        for (int c = 0; c < 5; c++)
+            for (int s = 0; s < 256; s++)
+                counts[c][s] += chunk_counts[(i*5 + c)*256 + s];
+
+    // Subtracting G from R and B only pays off when their noise is
+    // correlated, so keep whichever of each codes shorter, and code each
+    // plane with its own code for the whole image
+    int subtract = 0, plane[3] = {0, 3, 4};
+    if (coded_bits(counts[1]) <= coded_bits(counts[3]))
+    {
+        subtract |= SUBTRACT_GREEN_R;
+        plane[1] = 1;
+    }
+    if (coded_bits(counts[2]) <= coded_bits(counts[4]))
+    {
+        subtract |= SUBTRACT_GREEN_B;
+        plane[2] = 2;
+    }
+
+    huffman_code codes[3];
+    vector<unsigned char> header;
+    for (int c = 0; c < 3; c++)
+    {
+        codes[c].build(counts[plane[c]]);
+        codes[c].write(header);
+    }
+    header.push_back(subtract);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nchunks; i++)
+    {
+        int y = i*CODEC_CHUNK_ROWS;
+        int n = min(CODEC_CHUNK_ROWS, height - y)*width;
+        for (int c = 0; c < 3; c++)
+            codes[c].encode(&residuals[5*y*width + plane[c]*n], n, chunks[i]);
+    }
+
+    write_chunks(chunks, header, out);
+}
+
+bool decode_rgb(const unsigned char *data, size_t size,
+                int width, int height, unsigned char *rgb)
+{
+    int nchunks = read_chunk_table(data, size, height, RGB_HEADER_SIZE);
+    if (nchunks < 0)
+        return false;
+
+    const unsigned char *header = image_header(data);
+    huffman_code codes[3];
+    for (int c = 0; c < 3; c++)
+        if (!codes[c].read(header + c*HUFFMAN_LENGTHS_SIZE,
+                           HUFFMAN_LENGTHS_SIZE))
+            return false;
+    int subtract = header[3*HUFFMAN_LENGTHS_SIZE];
+
+    bool ok = true;
+
+    #pragma omp parallel
+    {
+        vector<unsigned char> residuals(3*CODEC_CHUNK_ROWS*width);
+        vector<unsigned char> planes(3*CODEC_CHUNK_ROWS*width);
+
+        #pragma omp for schedule(dynamic) reduction(&&:ok)
+        for (int i = 0; i < nchunks; i++)
+        {
+            int y = i*CODEC_CHUNK_ROWS;
+            int rows = min(CODEC_CHUNK_ROWS, height - y);
+            int n = rows*width;
+
+            const unsigned char *p = chunk_begin(data, i);
+            const unsigned char *end = chunk_begin(data, i + 1);
+            for (int c = 0; c < 3 && p; c++)
+                p = codes[c].decode(p, end, &residuals[c*n], n);
+            if (p != end)
+            {
+                ok = false;
+                continue;
+            }
+
+            for (int c = 0; c < 3; c++)
+                unpredict_plane(&residuals[c*n], width, rows, &planes[c*n]);
+            inverse_color(&planes[0], n, subtract, rgb + 3*y*width);
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,63 @@
+/****************************************************************************
+*
+*  Computer Vision, Fall 2011
+*  New York University
+*
+*  Created by Otavio Braga (obraga@cs.nyu.edu)
+*
+****************************************************************************/
+
+#ifndef SESSION_CODEC_H
+#define SESSION_CODEC_H
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Lossless codecs for the depth maps and rgb images of recorded sessions.
+ *
+ * An image is split into chunks of CODEC_CHUNK_ROWS rows which are coded
+ * independently, so they can be encoded and decoded in parallel. An
+ * encoded image is
+ *
+ *     uint32_t nchunks
+ *     uint32_t offsets[nchunks + 1]    (chunk i is in [offsets[i], offsets[i+1]))
+ *     header shared by the chunks
+ *     chunk data
+ *
+ * Depth chunks map the depth values to their index in a sorted palette of
+ * the values present in the chunk (the kinect only produces 2048 distinct
+ * depths, so neighbouring pixels usually have close indices). The index
+ * residuals with respect to the previous valid pixel, and the runs of
+ * pixels with zero depth (the holes that become TRIMAP_U in the
+ * segmentation), are mapped to byte symbols coded with one Huffman code
+ * for the whole image, whose lengths are the header.
+ *
+ * Rgb chunks are split in the planes G, R and B, with G subtracted from R
+ * and B where that makes them smaller to code. Each value is predicted
+ * from the three above it, the first row from the left, and the residuals
+ * of each plane are coded with a Huffman code of its own. The header has
+ * the three codes and which planes have G subtracted.
+ */
+
+#define CODEC_CHUNK_ROWS 16
+
+// Encode a width x height depth map, appending the result to out
+void encode_depth(const unsigned short *depth, int width, int height,
+                  std::vector<unsigned char> &out);
+
+// Decode a depth map encoded with encode_depth. Returns false if the data
+// is corrupt.
+bool decode_depth(const unsigned char *data, size_t size,
+                  int width, int height, unsigned short *depth);
+
+// Encode a width x height rgb image, appending the result to out
+void encode_rgb(const unsigned char *rgb, int width, int height,
+                std::vector<unsigned char> &out);
+
+// Decode an rgb image encoded with encode_rgb. Returns false if the data
+// is corrupt.
+bool decode_rgb(const unsigned char *data, size_t size,
+                int width, int height, unsigned char *rgb);
+
+#endif // SESSION_CODEC_H
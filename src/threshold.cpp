@@ -10,14 +10,22 @@
 #include <iostream>
 #include "threshold.h"
 
-void threshold_depth_map(unsigned short *depthimg,
+void threshold_depth_map(const unsigned short *depthimg,
                          int npts,
                          double threshold,
                          bool *foreground)
+{
+	threshold_depth_map(depthimg, npts, linear_roi(npts), threshold, foreground);
+}
+
+void threshold_depth_map(const unsigned short *depthimg,
+                         int width, const image_roi &roi,
+                         double threshold,
+                         bool *foreground)
 {    
     // !!!!!!!!!!!!!!!!!!!! Implement this !!!!!!!!!!!!!!!!!!!!
     //std::cout << "Warning: threshold_depth_map not implemented!\n";
-	for(int i=0; i< npts; i++){
+	for(roi_iterator i(roi, width); !i.done(); ++i){
 		if(depthimg[i] < threshold)
 			foreground[i] = true;
 		else
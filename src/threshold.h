@@ -10,12 +10,20 @@
 #ifndef THRESHOLD_SEGMENTATION_H
 #define THRESHOLD_SEGMENTATION_H
 
+#include "roi.h"
 
 // Set foreground[i] to true for the pixels with depth smaller than 'threshold'
 // !!!!!!!!!! Implement this !!!!!!!!!
-void threshold_depth_map(unsigned short *depthimg,
+void threshold_depth_map(const unsigned short *depthimg,
                          int npts,
                          double threshold,
                          bool *foreground);
 
+// The same, only for the pixels inside roi of a depth map with the given
+// width
+void threshold_depth_map(const unsigned short *depthimg,
+                         int width, const image_roi &roi,
+                         double threshold,
+                         bool *foreground);
+
 #endif // THRESHOLD_SEGMENTATION_H